@@ -189,3 +189,24 @@ int BufferCheckNewline(cBuffer buf,int index)
 
 
 
+/**************************************************************
+
+    unsigned long BufferHash(unsigned long hash,void *data,int size)
+
+    Adds size bytes of data to the hash value hash and returns
+    the new value (32 bit FNV-1a). Start with BUFFER_HASH_START.
+
+*/
+
+unsigned long BufferHash(unsigned long hash,void *data,int size)
+{
+    unsigned char *p=(unsigned char *)data;
+    int i;
+
+    for(i=0;i<size;i++)
+        {
+        hash^=(unsigned long)p[i];
+        hash=(hash*16777619UL)&0xffffffffUL;
+        }
+    return hash;
+}
@@ -29,6 +29,7 @@ typedef char * cBuffer;
 
 
 #define BUFFER_SIZE 500
+#define BUFFER_HASH_START 2166136261UL  /* Start value for BufferHash */
 
 
 #define MemoryAllocate(t,sz) (t *)malloc(sizeof(t)*sz)
@@ -43,6 +44,7 @@ int BufferReadDouble(cBuffer,double *,int);
 int BufferReadInt(cBuffer,int *,int);
 int BufferReadWord(cBuffer,char *,int);
 int BufferCheckNewline(cBuffer,int);
+unsigned long BufferHash(unsigned long,void *,int);
 
 
 #endif /* __BUFFER_H__ */
@@ -22,6 +22,7 @@
 #include "fileio.h"
 #include "buffer.h"
 #include "defs.h"
+#include "spect.h"
 
 
 
@@ -35,10 +36,16 @@ typedef struct {double x, y, z;}   ColorXYZ;
 typedef struct {
         int MaxWL;
         int MinWL;
-        int size;
+        int size;           /* Samples in a color vector */
+        int curve;          /* Values in a 1 nm curve */
+        int method;         /* COLOR_SAMPLE_NM, _HALL or _MEYER */
+        int *bounds;        /* Hall sample bounds, size+1 values */
+        ColorType toXYZ;    /* Samples to XYZ, 3 rows of size */
+        ColorType work;     /* 1 nm curve read before sampling */
         } ColorStruct;
 
 #define DEFAULT_COLOR_VALUE 0.5
+#define COLOR_ALIGN 64    /* Alignment of color vectors in bytes */
 
 #define RED    0
 #define GREEN  1
@@ -60,7 +67,10 @@ typedef struct {
 
 static ColorStruct color={  MAX_WAWE_LENGTH,
                             MIN_WAWE_LENGTH,
-                            MAX_WAWE_LENGTH-MIN_WAWE_LENGTH+1 };
+                            MAX_WAWE_LENGTH-MIN_WAWE_LENGTH+1,
+                            MAX_WAWE_LENGTH-MIN_WAWE_LENGTH+1,
+                            COLOR_SAMPLE_NM,
+                            NULL,NULL,NULL };
 
 static Logical init=FALSE;
 
@@ -69,7 +79,6 @@ static double        RGBtoXYZ[3][3];
 static ColorType     X_tristim = NULL;
 static ColorType     Y_tristim = NULL;
 static ColorType     Z_tristim = NULL;
-static ColorType     tmp_curve = NULL;
 static double        XYZscale = 1.0;
 static ColorXYZ      RGBprimary[4];
 
@@ -134,11 +143,33 @@ static double       CIEXYZ[81][4] = {
          {780, 0.0000, 0.0000, 0.0000} };
 
 
+/*
+    Sampling of Meyer (1988): the AC1C2 space of the samples at
+    456.4, 490.9, 557.7 and 631.4 nm.
+*/
+
+#define MEYER_SAMPLES 4
+#define MEYER_SCALE   1.057863  /* Y of an identity curve */
+
+static double XYZ_to_ACC[3][3] = {{-0.0177,  1.0090, 0.0073},
+                                  {-1.5370,  1.0821, 0.3209},
+                                  { 0.1946, -0.2045, 0.5264}};
+static double samp_to_ACC[3][MEYER_SAMPLES] =
+                             {{0.00000, 0.18892, 0.67493,  0.19253},
+                              {0.00000, 0.00000, 0.31824, -0.46008},
+                              {0.54640, 0.00000, 0.00000,  0.00000}};
+static double MeyerWL[MEYER_SAMPLES] = { 456.4, 490.9, 557.7, 631.4 };
+
+
 /* Internal functions */
 
+static Logical  InitSampling(int);
+static void     SpectToSample(ColorType,ColorType);
+static ColorXYZ CurveToXYZ(ColorType);
 static ColorXYZ SpectToXYZ(ColorType);
 static ColorRGB SpectToRGB(ColorType);
-static Logical  MultSpect(ColorType,ColorType,ColorType);
+static ColorRGB XYZToRGB(ColorXYZ);
+static double   MultSpectArea(ColorType,ColorType);
 static double   SpectArea(ColorType);
 static Logical  CSpaceToXYZ (ColorXYZ *,double [3][3]);
 static Logical  TInverse (double [3][3],double [3][3]);
@@ -151,23 +182,29 @@ static ColorRGB ClipRGB(ColorRGB in_rgb);
 
 /**************************************************************
 
-    Logical ColorInit(void)
+    Logical ColorInit(int method,int step)
 
     Builds the transformation from a set of primaries to the CIEXYZ
     color space. This is the basis for the generation of the color
     transformations in the color routine set. Returns FALSE if there
     is a singularity.
 
+    The color vectors are sampled by method: COLOR_SAMPLE_NM keeps
+    the 1 nm curves, COLOR_SAMPLE_HALL averages them over boxes of
+    step nm (Hall 1983) and COLOR_SAMPLE_MEYER takes the 4 samples
+    of Meyer (1988). The curves read from files are always
+    interpolated at 1 nm first and then sampled.
+
 */
 
-Logical ColorInit(void)
+Logical ColorInit(int method,int step)
 {
     int clr, ct;
-    double len;
 
     if (init==TRUE)
         return FALSE;
     init = TRUE;
+    SpectInit(SPECT_BEST);
 
     /*
         load primaries and build transformations, use the
@@ -192,17 +229,15 @@ Logical ColorInit(void)
 
     {
         int ii, nm=color.MinWL;
-        double *x, *y, *z;
+        ColorType x, y, z;
         double x_cur, y_cur, z_cur;
         double x_inc, y_inc, z_inc;
 
-        if((tmp_curve=ColorVectorInit())==NULL)
-            goto error;
-        if ((x = X_tristim = ColorVectorInit()) == NULL)
+        if ((x = X_tristim = MemoryAllocate(BasicColorType,color.curve)) == NULL)
             goto error;
-        if ((y = Y_tristim = ColorVectorInit()) == NULL)
+        if ((y = Y_tristim = MemoryAllocate(BasicColorType,color.curve)) == NULL)
             goto error;
-        if ((z = Z_tristim = ColorVectorInit()) == NULL)
+        if ((z = Z_tristim = MemoryAllocate(BasicColorType,color.curve)) == NULL)
             goto error;
         for (ct=0; ct<80; ct++)
             {
@@ -246,6 +281,11 @@ XYZ_done:
     */
 
     XYZscale = 1.0 / SpectArea(Y_tristim);
+
+    color.method = method;
+    if (method!=COLOR_SAMPLE_NM)
+        if (InitSampling(step)==FALSE)
+            goto error;
     return TRUE;
 
 error:
@@ -267,11 +307,24 @@ void ColorExit(void)
 {
     if (init==FALSE)
         return;
-    ColorVectorExit(X_tristim);
-    ColorVectorExit(Y_tristim);
-    ColorVectorExit(Z_tristim);
-    ColorVectorExit(tmp_curve);
-    X_tristim = Y_tristim = Z_tristim = tmp_curve = NULL;
+    if (X_tristim != NULL)
+        MemoryFree(X_tristim);
+    if (Y_tristim != NULL)
+        MemoryFree(Y_tristim);
+    if (Z_tristim != NULL)
+        MemoryFree(Z_tristim);
+    X_tristim = Y_tristim = Z_tristim = NULL;
+    if (color.bounds != NULL)
+        MemoryFree(color.bounds);
+    if (color.toXYZ != NULL)
+        MemoryFree(color.toXYZ);
+    if (color.work != NULL)
+        MemoryFree(color.work);
+    color.bounds = NULL;
+    color.toXYZ = NULL;
+    color.work = NULL;
+    color.method = COLOR_SAMPLE_NM;
+    color.size = color.curve;
     init = FALSE;
     return;
 }
@@ -282,18 +335,26 @@ void ColorExit(void)
 
     ColorType ColorVectorInit(void)
 
-    Allocates memory and initializes a color spectrum vector
+    Allocates memory and initializes a color spectrum vector. The
+    vector starts at a COLOR_ALIGN byte boundary so that the vector
+    loads of the spectral kernels do not straddle cache lines. The
+    allocated block is stored just before the vector.
 
 */
 
 ColorType ColorVectorInit(void)
 {
     ColorType buf=NULL;
+    char *mem;
     int i;
 
-    buf=MemoryAllocate(BasicColorType,color.size);
-    if(buf==NULL)
+    mem=BufferAllocate((sizeof(BasicColorType)*color.size+
+                        sizeof(char *)+COLOR_ALIGN-1));
+    if(mem==NULL)
         return NULL;
+    buf=(ColorType)(((unsigned long)mem+sizeof(char *)+COLOR_ALIGN-1)
+                    &~(unsigned long)(COLOR_ALIGN-1));
+    ((char **)buf)[-1]=mem;
     for(i=0;i<color.size;i++)
         buf[i]=DEFAULT_COLOR_VALUE;
     return buf;
@@ -314,7 +375,7 @@ void ColorVectorExit(ColorType buf)
 {
     if(buf==NULL)
         return;
-    MemoryFree(buf);
+    MemoryFree(((char **)buf)[-1]);
     return;
 }
 
@@ -326,7 +387,8 @@ void ColorVectorExit(ColorType buf)
                             String name,int bSize)
 
     This function reads color vector from file and
-    interpolates it.
+    interpolates it. With sampling the curve is interpolated
+    at 1 nm and then sampled to vector.
 
 */
 
@@ -337,9 +399,12 @@ Logical ColorReadVector(cBuffer buf,ColorType vector,
     int     CurL,PrevL,WaweL;
     double     WaweV,PrevV=0.0;
     double     k=0.0;
+    ColorType sampled=vector;
 
     if(init==FALSE)
         return FALSE;
+    if(color.method!=COLOR_SAMPLE_NM)
+        vector=color.work;
     FileIOReadLine(name,buf,bSize);
     CurL=PrevL=color.MinWL;
     vector[0]=PrevV;
@@ -379,8 +444,10 @@ Logical ColorReadVector(cBuffer buf,ColorType vector,
         FileIOReadLine(name,buf,bSize);
         }
     if(CurL<color.MaxWL)
-        for(;i<color.size;i++)
+        for(;i<color.curve;i++)
             vector[i]=0.0;
+    if(color.method!=COLOR_SAMPLE_NM)
+        SpectToSample(vector,sampled);
     return TRUE;
 
 }
@@ -404,27 +471,81 @@ int ColorGetSize(void)
 
 /*****************************************************************
 
-    RGBType *ColorGetRGB (ColorType spectral)
+    RGBType *ColorGetRGB (ColorType spectral,RGBType *rgb)
 
-    Returns the sample values if successful, and NULL
-    if not successfull.The curve is first sampled to XYZ
-    then transformed to RGB.
+    Stores the sample values to rgb and returns it if successful,
+    and NULL if not successfull. The curve is first sampled to XYZ
+    then transformed to RGB. No static storage is used so the
+    function can be called from several render threads.
 
 */
 
-RGBType *ColorGetRGB (ColorType spectral)
+RGBType *ColorGetRGB (ColorType spectral,RGBType *rgb)
 {
     ColorRGB tmp;
-    static RGBType rgb;
 
-    if(spectral==NULL || init==FALSE)
+    if(spectral==NULL || rgb==NULL || init==FALSE)
         return NULL;
     tmp=SpectToRGB(spectral);
     tmp=ClipRGB(tmp);
-    rgb.r=(int)(tmp.r*255);
-    rgb.g=(int)(tmp.g*255);
-    rgb.b=(int)(tmp.b*255);
-    return &rgb;
+    rgb->r=(int)(tmp.r*255);
+    rgb->g=(int)(tmp.g*255);
+    rgb->b=(int)(tmp.b*255);
+    return rgb;
+}
+
+
+
+/*****************************************************************
+
+    Logical ColorGetXYZ (ColorType spectral,double *xyz)
+
+    Stores the tristimulus values of the curve to xyz[0..2].
+    The values are linear in the curve, so the XYZ of a sum of
+    curves is the sum of their XYZ values.
+
+*/
+
+Logical ColorGetXYZ (ColorType spectral,double *xyz)
+{
+    ColorXYZ tmp;
+
+    if(spectral==NULL || xyz==NULL || init==FALSE)
+        return FALSE;
+    tmp=SpectToXYZ(spectral);
+    xyz[0]=tmp.x;
+    xyz[1]=tmp.y;
+    xyz[2]=tmp.z;
+    return TRUE;
+}
+
+
+
+/*****************************************************************
+
+    RGBType *ColorXYZGetRGB (double *xyz,RGBType *rgb)
+
+    Stores the RGB values of the tristimulus values xyz[0..2] to
+    rgb and returns it. The same transformation and clipping is
+    used as in ColorGetRGB().
+
+*/
+
+RGBType *ColorXYZGetRGB (double *xyz,RGBType *rgb)
+{
+    ColorXYZ in;
+    ColorRGB tmp;
+
+    if(xyz==NULL || rgb==NULL || init==FALSE)
+        return NULL;
+    in.x=xyz[0];
+    in.y=xyz[1];
+    in.z=xyz[2];
+    tmp=ClipRGB(XYZToRGB(in));
+    rgb->r=(int)(tmp.r*255);
+    rgb->g=(int)(tmp.g*255);
+    rgb->b=(int)(tmp.b*255);
+    return rgb;
 }
 
 
@@ -438,30 +559,150 @@ RGBType *ColorGetRGB (ColorType spectral)
 
 /*****************************************************************
 
-    Logical MultSpect(ColorType c1,ColorType c2,ColorType c3)
+    static Logical InitSampling(int step)
 
-    Multiply spectral curve 'c1' by spectral curve 'c2' to get
-    spectral curve 'c3'. Returns TRUE if successful, FALSE if
-    the color routines are not initialized.
+    Makes the sample to XYZ matrix of the sampling method. The
+    Hall box of a sample is reconstructed to a 1 nm curve, the
+    first and last box reaching to the ends of the range, and
+    sampled to XYZ. The Meyer matrix is the samples to AC1C2
+    matrix concatenated with the AC1C2 to XYZ matrix.
 
 */
 
-Logical MultSpect(ColorType c1,ColorType c2,ColorType c3)
+static Logical InitSampling(int step)
 {
-    int i;
+    ColorXYZ xyz;
+    double ACC_to_XYZ[3][3];
+    int s, ct, n, wl;
+
+    if (color.method == COLOR_SAMPLE_MEYER)
+        n = MEYER_SAMPLES;
+    else if (color.method == COLOR_SAMPLE_HALL && step > 0 &&
+             step <= color.MaxWL-color.MinWL)
+        n = (color.MaxWL-color.MinWL)/step;
+    else
+        return FALSE;
+    if ((color.toXYZ = MemoryAllocate(BasicColorType,(3*n))) == NULL)
+        return FALSE;
+    if ((color.work = MemoryAllocate(BasicColorType,color.curve)) == NULL)
+        return FALSE;
 
-    for(i=color.size; --i>=0; )
-        *c3++ = *c1++ * *c2++;
+    if (color.method == COLOR_SAMPLE_MEYER)
+        {
+        if (TInverse(XYZ_to_ACC, ACC_to_XYZ)==FALSE)
+            return FALSE;
+        for (s=0; s<n; s++)
+            for (ct=0; ct<3; ct++)
+                color.toXYZ[ct*n+s] =
+                    ((ACC_to_XYZ[ct][0] * samp_to_ACC[0][s]) +
+                     (ACC_to_XYZ[ct][1] * samp_to_ACC[1][s]) +
+                     (ACC_to_XYZ[ct][2] * samp_to_ACC[2][s])) / MEYER_SCALE;
+        }
+    else
+        {
+        if ((color.bounds = MemoryAllocate(int,(n+1))) == NULL)
+            return FALSE;
+        for (s=0; s<=n; s++)
+            color.bounds[s] = color.MinWL+s*step;
+        color.bounds[n] = color.MaxWL+1;
+        for (s=0; s<n; s++)
+            {
+            for (wl=color.MinWL, ct=0; wl<=color.MaxWL; wl++, ct++)
+                color.work[ct] = ((wl>=color.bounds[s] || s==0) &&
+                                  (wl<color.bounds[s+1] || s==n-1)) ?
+                                 1.0 : 0.0;
+            xyz = CurveToXYZ(color.work);
+            color.toXYZ[s] = xyz.x;
+            color.toXYZ[n+s] = xyz.y;
+            color.toXYZ[2*n+s] = xyz.z;
+            }
+        }
+    color.size = n;
     return TRUE;
 }
 
 
 
+/*****************************************************************
+
+    static void SpectToSample(ColorType curve,ColorType sample)
+
+    Samples the 1 nm curve. A Hall sample is the average of the
+    curve over its box, a Meyer sample is interpolated between
+    the nearest wavelengths.
+
+*/
+
+static void SpectToSample(ColorType curve,ColorType sample)
+{
+    int s, wl, ct;
+    double sum, t;
+
+    if (color.method == COLOR_SAMPLE_MEYER)
+        for (s=0; s<MEYER_SAMPLES; s++)
+            {
+            wl = (int)MeyerWL[s];
+            t = MeyerWL[s]-wl;
+            sample[s] = curve[wl-color.MinWL] +
+                    t*(curve[wl+1-color.MinWL] - curve[wl-color.MinWL]);
+            }
+    else
+        for (s=0; s<color.size; s++)
+            {
+            for (wl=color.bounds[s], sum=0.0, ct=0;
+                 wl<color.bounds[s+1]; wl++, ct++)
+                sum += curve[wl-color.MinWL];
+            sample[s] = sum / ct;
+            }
+    return;
+}
+
+
+
+/*****************************************************************
+
+    double MultSpectArea(ColorType c1,ColorType c2)
+
+    Returns the area under the product of spectral curves 'c1'
+    and 'c2'. No intermediate curve is needed.
+
+*/
+
+static double MultSpectArea(ColorType c1,ColorType c2)
+{
+    return SpectDot(c1,c2,color.curve);
+}
+
+
+
 /*****************************************************************
 
     ColorXYZ SpectToXYZ(ColorType spectral)
 
-    Returns the sample values in tristimulus coordinates.
+    Returns the sample values in tristimulus coordinates. Sampled
+    vectors are transformed by the sample to XYZ matrix.
+
+*/
+
+ColorXYZ SpectToXYZ(ColorType spectral)
+{
+    ColorXYZ xyz;
+
+    if (color.method == COLOR_SAMPLE_NM)
+        return CurveToXYZ(spectral);
+    xyz.x = SpectDot(color.toXYZ, spectral, color.size);
+    xyz.y = SpectDot(color.toXYZ+color.size, spectral, color.size);
+    xyz.z = SpectDot(color.toXYZ+2*color.size, spectral, color.size);
+    return xyz;
+}
+
+
+
+/*****************************************************************
+
+    ColorXYZ CurveToXYZ(ColorType spectral)
+
+    Returns the 1 nm curve in tristimulus coordinates.
 
     Multiplies the spectral curve by each of the sampling curves
     then integrates the resulting curves. The XYZ values are then
@@ -469,16 +710,13 @@ Logical MultSpect(ColorType c1,ColorType c2,ColorType c3)
 
 */
 
-ColorXYZ SpectToXYZ(ColorType spectral)
+static ColorXYZ CurveToXYZ(ColorType spectral)
 {
     ColorXYZ xyz;
 
-    (void)MultSpect(spectral, X_tristim, tmp_curve);
-    xyz.x = XYZscale * SpectArea(tmp_curve);
-    (void)MultSpect(spectral, Y_tristim, tmp_curve);
-    xyz.y = XYZscale * SpectArea(tmp_curve);
-    (void)MultSpect(spectral, Z_tristim, tmp_curve);
-    xyz.z = XYZscale * SpectArea(tmp_curve);
+    xyz.x = XYZscale * MultSpectArea(spectral, X_tristim);
+    xyz.y = XYZscale * MultSpectArea(spectral, Y_tristim);
+    xyz.z = XYZscale * MultSpectArea(spectral, Z_tristim);
     return xyz;
 }
 
@@ -494,12 +732,7 @@ ColorXYZ SpectToXYZ(ColorType spectral)
 
 double SpectArea (ColorType c1)
 {
-    int ct;
-    double area = 0.0;
-
-    for (ct=color.size; --ct>=0; )
-        area += *c1++;
-    return area;
+    return SpectSum(c1,color.curve);
 }
 
 
@@ -515,10 +748,23 @@ double SpectArea (ColorType c1)
 
 ColorRGB SpectToRGB (ColorType spectral)
 {
-    ColorXYZ xyz;
+    return XYZToRGB(SpectToXYZ(spectral));
+}
+
+
+
+/*****************************************************************
+
+    ColorRGB XYZToRGB (ColorXYZ xyz)
+
+    Returns the tristimulus values xyz in RGB.
+
+*/
+
+static ColorRGB XYZToRGB (ColorXYZ xyz)
+{
     ColorRGB rgb;
 
-    xyz = SpectToXYZ (spectral);
     rgb.r = (XYZtoRGB[0][0] * xyz.x)+(XYZtoRGB[0][1] * xyz.y)
                                     +(XYZtoRGB[0][2] * xyz.z);
     rgb.g = (XYZtoRGB[1][0] * xyz.x)+(XYZtoRGB[1][1] * xyz.y)
@@ -23,13 +23,24 @@
 #include "buffer.h"
 
 
+/* With SINGLE_PRECISION the spectra are stored as floats, the
+   color conversions still sum in double, see Spect.c */
+
+#ifdef SINGLE_PRECISION
+typedef float BasicColorType;
+#else
 typedef double BasicColorType;
+#endif /* SINGLE_PRECISION */
 typedef BasicColorType * ColorType;
 typedef struct {
     unsigned char r,g,b;
                 } RGBType;
 
-Logical ColorInit(void);
+#define COLOR_SAMPLE_NM    0    /* 1 nm curves */
+#define COLOR_SAMPLE_HALL  1    /* Box samples, Hall (1983) */
+#define COLOR_SAMPLE_MEYER 2    /* 4 samples, Meyer (1988) */
+
+Logical ColorInit(int,int);
 void ColorExit(void);
 ColorType ColorVectorInit(void);
 void ColorVectorExit(ColorType);
@@ -37,7 +48,9 @@ void ColorVectorExit(ColorType);
 Logical ColorReadVector(cBuffer,ColorType,String,int);
 int ColorGetSize(void);
 
-RGBType *ColorGetRGB (ColorType);
+RGBType *ColorGetRGB (ColorType,RGBType *);
+Logical ColorGetXYZ (ColorType,double *);
+RGBType *ColorXYZGetRGB (double *,RGBType *);
 
 
 #endif /* __COLOR_H__ */
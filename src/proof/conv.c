@@ -0,0 +1,518 @@
+/**************************************************************/
+/* This software was made by Oskar Lnnberg                   */
+/*                                                            */
+/* Copyright (c) by Oskar Lnnberg                            */
+/*                                                            */
+/* Permission to use, copy, modify, distribute, and sell this */
+/* software and its documentation for any purpose is not      */
+/* granted without permission from the copyright owner.       */
+/**************************************************************/
+
+
+/*
+    Conv.c - Two dimensional correlation of an image with a kernel
+
+    The correlation is made directly, as a sum of separable
+    kernels taken from the singular value decomposition of the
+    kernel or with the fast Fourier transform. The cheapest method
+    is chosen for each image and kernel.
+
+    Images and kernels are stored row after row. With an image a
+    of size ax*ay and a kernel k of size kx*ky the result has size
+    (ax+kx-1)*(ay+ky-1) and
+
+        out(i,j)=sum k(m,n)*a(i+m-kx+1,j+n-ky+1)
+
+    where a is zero outside the image.
+*/
+
+
+
+#include <math.h>
+#include "c_types.h"
+#include "buffer.h"
+#include "conv.h"
+
+
+
+/**************************************************************/
+
+/* structure and type definitions */
+
+typedef struct {
+        double *v;          /* Column part, ky values */
+        double *h;          /* Row part, kx values */
+        int rank;           /* Number of separable terms */
+        } SEPARABLE;
+
+
+/* Internal functions */
+
+static void CorrelateDirect(double *,int,int,double *,int,int,double *);
+static void CorrelateSeparable(double *,int,int,SEPARABLE *,int,int,double *,double *);
+static Logical CorrelateFFT(double *,int,int,double *,int,int,double *);
+static Logical Decompose(double *,int,int,SEPARABLE *);
+static void FFT(double *,double *,int,int,double *,double *,int);
+static Logical FFTTable(int,double **,double **);
+static int PowerOfTwo(int);
+
+
+/* Internal constants */
+
+#define PI 3.14159265358979323846
+
+#define SVD_SWEEPS    30        /* Jacobi sweeps at most */
+#define SVD_EPSILON   1.0e-15   /* Columns taken as orthogonal */
+#define SVD_TOLERANCE 1.0e-9    /* Relative size of dropped terms */
+#define FFT_COST      16.0      /* Work of one butterfly, in products */
+
+
+
+/**************************************************************/
+
+
+
+/**************************************************************
+
+    int ConvCorrelate(double *a,int ax,int ay,
+                      double *k,int kx,int ky,
+                      double *out,int method)
+
+    Correlates the image a with the kernel k into out, which must
+    hold (ax+kx-1)*(ay+ky-1) values. With method CONV_AUTO the
+    method with the smallest estimated work is used. Returns the
+    method used or CONV_ERROR if memory runs out.
+
+*/
+
+int ConvCorrelate(double *a,int ax,int ay,double *k,int kx,int ky,
+                  double *out,int method)
+{
+    SEPARABLE sep;
+    double *tmp=NULL,cost,best,n;
+    int i,ox=ax+kx-1,oy=ay+ky-1,nonzero;
+
+    sep.v=NULL;
+    sep.h=NULL;
+    sep.rank=0;
+    for(i=0;i<ox*oy;i++)
+        out[i]=0.0;
+    if(method==CONV_AUTO || method==CONV_SEPARABLE)
+        if(Decompose(k,kx,ky,&sep)==FALSE)
+            goto error;
+
+    if(method==CONV_AUTO)
+        {
+        for(i=0,nonzero=0;i<ax*ay;i++)
+            if(a[i]!=0.0)
+                nonzero++;
+        best=(double)nonzero*kx*ky;
+        method=CONV_DIRECT;
+        cost=(double)sep.rank*ox*(ay*kx+oy*ky);
+        if(cost<best)
+            {
+            best=cost;
+            method=CONV_SEPARABLE;
+            }
+        n=(double)PowerOfTwo(ox)*PowerOfTwo(oy);
+        cost=3.0*FFT_COST*n*log(n)/log(2.0);
+        if(cost<best)
+            method=CONV_FFT;
+        }
+
+    switch(method)
+        {
+        case CONV_SEPARABLE:
+            if((tmp=MemoryAllocate(double,(ox*ay)))==NULL)
+                goto error;
+            CorrelateSeparable(a,ax,ay,&sep,kx,ky,tmp,out);
+            MemoryFree(tmp);
+            break;
+        case CONV_FFT:
+            if(CorrelateFFT(a,ax,ay,k,kx,ky,out)==FALSE)
+                goto error;
+            break;
+        default:
+            method=CONV_DIRECT;
+            CorrelateDirect(a,ax,ay,k,kx,ky,out);
+            break;
+        }
+    if(sep.v!=NULL)
+        MemoryFree(sep.v);
+    if(sep.h!=NULL)
+        MemoryFree(sep.h);
+    return method;
+
+error:
+    if(sep.v!=NULL)
+        MemoryFree(sep.v);
+    if(sep.h!=NULL)
+        MemoryFree(sep.h);
+    return CONV_ERROR;
+}
+
+
+
+
+/**************************************************************
+    Internal functions for this file
+***************************************************************/
+
+
+
+/**************************************************************
+
+    static void CorrelateDirect(double *a,int ax,int ay,
+                                double *k,int kx,int ky,
+                                double *out)
+
+    Adds every non zero image value times the kernel to the
+    result. The zero area around the ink costs nothing.
+
+*/
+
+static void CorrelateDirect(double *a,int ax,int ay,double *k,int kx,int ky,
+                            double *out)
+{
+    double value,*o;
+    int x,y,m,n,ox=ax+kx-1;
+
+    for(y=0;y<ay;y++)
+        for(x=0;x<ax;x++)
+            {
+            if((value=a[y*ax+x])==0.0)
+                continue;
+            for(n=0;n<ky;n++)
+                {
+                o=out+(y+ky-1-n)*ox+x+kx-1;
+                for(m=0;m<kx;m++)
+                    o[-m]+=value*k[n*kx+m];
+                }
+            }
+    return;
+}
+
+
+
+/**************************************************************
+
+    static void CorrelateSeparable(double *a,int ax,int ay,
+                                   SEPARABLE *sep,int kx,int ky,
+                                   double *tmp,double *out)
+
+    Correlates every separable term first along the rows into
+    tmp, which holds (ax+kx-1)*ay values, and then along the
+    columns into the result.
+
+*/
+
+static void CorrelateSeparable(double *a,int ax,int ay,SEPARABLE *sep,
+                               int kx,int ky,double *tmp,double *out)
+{
+    double *h,*v,sum;
+    int r,i,j,m,ox=ax+kx-1,oy=ay+ky-1,first,last;
+
+    for(r=0;r<sep->rank;r++)
+        {
+        h=sep->h+r*kx;
+        v=sep->v+r*ky;
+        for(j=0;j<ay;j++)
+            for(i=0;i<ox;i++)
+                {
+                first=(i<kx-1) ? kx-1-i : 0;
+                last=(i>=ax) ? ax+kx-2-i : kx-1;
+                for(m=first,sum=0.0;m<=last;m++)
+                    sum+=h[m]*a[j*ax+i+m-kx+1];
+                tmp[j*ox+i]=sum;
+                }
+        for(j=0;j<oy;j++)
+            {
+            first=(j<ky-1) ? ky-1-j : 0;
+            last=(j>=ay) ? ay+ky-2-j : ky-1;
+            for(m=first;m<=last;m++)
+                for(i=0;i<ox;i++)
+                    out[j*ox+i]+=v[m]*tmp[(j+m-ky+1)*ox+i];
+            }
+        }
+    return;
+}
+
+
+
+/**************************************************************
+
+    static Logical CorrelateFFT(double *a,int ax,int ay,
+                                double *k,int kx,int ky,
+                                double *out)
+
+    Correlates with the fast Fourier transform. The image and
+    the mirrored kernel are padded to powers of two at least as
+    large as the result, so the circular convolution has no wrap
+    around. Returns FALSE if memory runs out.
+
+*/
+
+static Logical CorrelateFFT(double *a,int ax,int ay,double *k,int kx,int ky,
+                            double *out)
+{
+    double *are=NULL,*aim=NULL,*kre=NULL,*kim=NULL;
+    double *xcos=NULL,*xsin=NULL,*ycos=NULL,*ysin=NULL,re,im;
+    int nx,ny,i,j,ox=ax+kx-1,oy=ay+ky-1;
+    Logical ok=FALSE;
+
+    nx=PowerOfTwo(ox);
+    ny=PowerOfTwo(oy);
+    if((are=MemoryAllocate(double,(nx*ny)))==NULL ||
+       (aim=MemoryAllocate(double,(nx*ny)))==NULL ||
+       (kre=MemoryAllocate(double,(nx*ny)))==NULL ||
+       (kim=MemoryAllocate(double,(nx*ny)))==NULL)
+        goto exit;
+    if(FFTTable(nx,&xcos,&xsin)==FALSE || FFTTable(ny,&ycos,&ysin)==FALSE)
+        goto exit;
+    for(i=0;i<nx*ny;i++)
+        are[i]=aim[i]=kre[i]=kim[i]=0.0;
+    for(j=0;j<ay;j++)
+        for(i=0;i<ax;i++)
+            are[j*nx+i]=a[j*ax+i];
+    for(j=0;j<ky;j++)
+        for(i=0;i<kx;i++)
+            kre[(ky-1-j)*nx+kx-1-i]=k[j*kx+i];
+
+    for(j=0;j<ny;j++)
+        {
+        FFT(are+j*nx,aim+j*nx,nx,1,xcos,xsin,1);
+        FFT(kre+j*nx,kim+j*nx,nx,1,xcos,xsin,1);
+        }
+    for(i=0;i<nx;i++)
+        {
+        FFT(are+i,aim+i,ny,nx,ycos,ysin,1);
+        FFT(kre+i,kim+i,ny,nx,ycos,ysin,1);
+        }
+    for(i=0;i<nx*ny;i++)
+        {
+        re=are[i]*kre[i]-aim[i]*kim[i];
+        im=are[i]*kim[i]+aim[i]*kre[i];
+        are[i]=re;
+        aim[i]=im;
+        }
+    for(i=0;i<nx;i++)
+        FFT(are+i,aim+i,ny,nx,ycos,ysin,-1);
+    for(j=0;j<oy;j++)
+        {
+        FFT(are+j*nx,aim+j*nx,nx,1,xcos,xsin,-1);
+        for(i=0;i<ox;i++)
+            out[j*ox+i]=are[j*nx+i]/(nx*ny);
+        }
+    ok=TRUE;
+
+exit:
+    if(are!=NULL) MemoryFree(are);
+    if(aim!=NULL) MemoryFree(aim);
+    if(kre!=NULL) MemoryFree(kre);
+    if(kim!=NULL) MemoryFree(kim);
+    if(xcos!=NULL) MemoryFree(xcos);
+    if(xsin!=NULL) MemoryFree(xsin);
+    if(ycos!=NULL) MemoryFree(ycos);
+    if(ysin!=NULL) MemoryFree(ysin);
+    return ok;
+}
+
+
+
+/**************************************************************
+
+    static Logical Decompose(double *k,int kx,int ky,
+                             SEPARABLE *sep)
+
+    Splits the kernel into a sum of separable terms with the one
+    sided Jacobi singular value decomposition. Terms are taken in
+    order of size until the dropped ones are negligible. Returns
+    FALSE if memory runs out.
+
+*/
+
+static Logical Decompose(double *k,int kx,int ky,SEPARABLE *sep)
+{
+    double *u=NULL,*w=NULL,*norm=NULL;
+    double alpha,beta,gamma,zeta,t,c,s,tmp,total,rest;
+    int sweep,p,q,i,r,rotated,*order=NULL;
+    Logical ok=FALSE;
+
+    /* The columns of u=k*w are made orthogonal, then
+       k(m,n)=sum u(n,r)*w(m,r). */
+
+    if((u=MemoryAllocate(double,(kx*ky)))==NULL ||
+       (w=MemoryAllocate(double,(kx*kx)))==NULL ||
+       (norm=MemoryAllocate(double,kx))==NULL ||
+       (order=MemoryAllocate(int,kx))==NULL)
+        goto exit;
+    for(i=0;i<kx*ky;i++)
+        u[i]=k[i];
+    for(i=0;i<kx*kx;i++)
+        w[i]=(i%(kx+1)==0) ? 1.0 : 0.0;
+
+    for(sweep=0,rotated=1;sweep<SVD_SWEEPS && rotated!=0;sweep++)
+        for(p=0,rotated=0;p<kx-1;p++)
+            for(q=p+1;q<kx;q++)
+                {
+                for(i=0,alpha=beta=gamma=0.0;i<ky;i++)
+                    {
+                    alpha+=u[i*kx+p]*u[i*kx+p];
+                    beta+=u[i*kx+q]*u[i*kx+q];
+                    gamma+=u[i*kx+p]*u[i*kx+q];
+                    }
+                if(fabs(gamma)<=SVD_EPSILON*sqrt(alpha*beta))
+                    continue;
+                rotated++;
+                zeta=(beta-alpha)/(2.0*gamma);
+                t=((zeta>=0.0) ? 1.0 : -1.0)/(fabs(zeta)+sqrt(1.0+zeta*zeta));
+                c=1.0/sqrt(1.0+t*t);
+                s=c*t;
+                for(i=0;i<ky;i++)
+                    {
+                    tmp=u[i*kx+p];
+                    u[i*kx+p]=c*tmp-s*u[i*kx+q];
+                    u[i*kx+q]=s*tmp+c*u[i*kx+q];
+                    }
+                for(i=0;i<kx;i++)
+                    {
+                    tmp=w[i*kx+p];
+                    w[i*kx+p]=c*tmp-s*w[i*kx+q];
+                    w[i*kx+q]=s*tmp+c*w[i*kx+q];
+                    }
+                }
+
+    for(p=0,total=0.0;p<kx;p++)
+        {
+        for(i=0,norm[p]=0.0;i<ky;i++)
+            norm[p]+=u[i*kx+p]*u[i*kx+p];
+        total+=norm[p];
+        order[p]=p;
+        }
+    for(p=1;p<kx;p++)
+        for(q=p;q>0 && norm[order[q]]>norm[order[q-1]];q--)
+            {
+            i=order[q];
+            order[q]=order[q-1];
+            order[q-1]=i;
+            }
+    for(r=0,rest=total;r<kx && rest>SVD_TOLERANCE*SVD_TOLERANCE*total;r++)
+        rest-=norm[order[r]];
+
+    if((sep->v=MemoryAllocate(double,(r*ky+1)))==NULL ||
+       (sep->h=MemoryAllocate(double,(r*kx+1)))==NULL)
+        goto exit;
+    sep->rank=r;
+    for(p=0;p<r;p++)
+        {
+        for(i=0;i<ky;i++)
+            sep->v[p*ky+i]=u[i*kx+order[p]];
+        for(i=0;i<kx;i++)
+            sep->h[p*kx+i]=w[i*kx+order[p]];
+        }
+    ok=TRUE;
+
+exit:
+    if(u!=NULL) MemoryFree(u);
+    if(w!=NULL) MemoryFree(w);
+    if(norm!=NULL) MemoryFree(norm);
+    if(order!=NULL) MemoryFree(order);
+    return ok;
+}
+
+
+
+/**************************************************************
+
+    static void FFT(double *re,double *im,int n,int stride,
+                    double *cs,double *sn,int dir)
+
+    Radix 2 fast Fourier transform in place of n values stride
+    apart. The direction dir is 1 forward and -1 backward, the
+    backward transform is not scaled. cs and sn are from FFTTable.
+
+*/
+
+static void FFT(double *re,double *im,int n,int stride,double *cs,double *sn,
+                int dir)
+{
+    double wr,wi,tr,ti;
+    int i,j,bit,len,half,step,a,b;
+
+    for(i=1,j=0;i<n;i++)
+        {
+        for(bit=n>>1;j&bit;bit>>=1)
+            j^=bit;
+        j^=bit;
+        if(i<j)
+            {
+            tr=re[i*stride]; re[i*stride]=re[j*stride]; re[j*stride]=tr;
+            ti=im[i*stride]; im[i*stride]=im[j*stride]; im[j*stride]=ti;
+            }
+        }
+    for(len=2;len<=n;len<<=1)
+        {
+        half=len>>1;
+        step=n/len;
+        for(i=0;i<n;i+=len)
+            for(j=0;j<half;j++)
+                {
+                wr=cs[j*step];
+                wi=-dir*sn[j*step];
+                a=(i+j)*stride;
+                b=(i+j+half)*stride;
+                tr=wr*re[b]-wi*im[b];
+                ti=wr*im[b]+wi*re[b];
+                re[b]=re[a]-tr;
+                im[b]=im[a]-ti;
+                re[a]+=tr;
+                im[a]+=ti;
+                }
+        }
+    return;
+}
+
+
+
+/**************************************************************
+
+    static Logical FFTTable(int n,double **cs,double **sn)
+
+    Makes the cosine and sine tables of a transform of length n.
+    Returns FALSE if memory runs out.
+
+*/
+
+static Logical FFTTable(int n,double **cs,double **sn)
+{
+    int i;
+
+    if((*cs=MemoryAllocate(double,(n/2+1)))==NULL ||
+       (*sn=MemoryAllocate(double,(n/2+1)))==NULL)
+        return FALSE;
+    for(i=0;i<=n/2;i++)
+        {
+        (*cs)[i]=cos(2.0*PI*i/n);
+        (*sn)[i]=sin(2.0*PI*i/n);
+        }
+    return TRUE;
+}
+
+
+
+/**************************************************************
+
+    static int PowerOfTwo(int n)
+
+    Returns the smallest power of two not less than n.
+
+*/
+
+static int PowerOfTwo(int n)
+{
+    int p;
+
+    for(p=1;p<n;p<<=1)
+        ;
+    return p;
+}
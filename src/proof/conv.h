@@ -0,0 +1,33 @@
+/**************************************************************/
+/* This software was made by Oskar Lnnberg                   */
+/*                                                            */
+/* Copyright (c) by Oskar Lnnberg                            */
+/*                                                            */
+/* Permission to use, copy, modify, distribute, and sell this */
+/* software and its documentation for any purpose is not      */
+/* granted without permission from the copyright owner.       */
+/**************************************************************/
+
+
+/*
+    Conv.h - Headerfile for Conv.c
+*/
+
+
+#ifndef __CONV__
+#define __CONV__
+
+
+#include "c_types.h"
+
+
+#define CONV_ERROR     -1   /* ConvCorrelate: out of memory */
+#define CONV_AUTO       0   /* Cheapest of the methods below */
+#define CONV_DIRECT     1
+#define CONV_SEPARABLE  2
+#define CONV_FFT        3
+
+int ConvCorrelate(double *,int,int,double *,int,int,double *,int);
+
+
+#endif /* __CONV__ */
@@ -56,6 +56,7 @@
 #define PICTURE_Y_SIZE 10  /* Size in millimeters */
 #define PICTURE_VIEW_DIRECTION 0
 #define DOT_SIZE 20        /* In micrometers, dots are square dots */
+#define RENDER_THREADS 1   /* Number of render threads */
 
 
 /* Default file names */
@@ -116,14 +117,48 @@
 -y   the y size of picture in millimeters\n\
 -d   pixel size in micrometers\n\
 -t   picture name in which the tif file is saved\n\
--l   light information file name\n\
+-l   light information file name, or a list of them\n\
+     separated by commas. A picture is saved for each\n\
+     light, named picture_light.tif.\n\
 -p   paper information file name\n\
 -i   ink information file name\n\
 -I   use ink information in rendering\n\
 -P   Uses the Phong illumination model for rendering\n\
 -B   Uses the Blinn illumination model for rendering\n\
 -V   Defines the view direction according to picture \n\
-     normal. Default is zero max is 90 degrees."
+     normal. Default is zero max is 90 degrees. A list\n\
+     of angles separated by commas makes a picture for\n\
+     each angle, named picture_Vangle.tif.\n\
+-j   number of render threads, default is one\n\
+-n   paper normal map, n(one), f(loat) or o(ctahedral).\n\
+     A b after f or o interpolates the normals bilinearly\n\
+     if the dots are smaller than the paper pixels, for\n\
+     example fb. Default is float, nearest normals.\n\
+-L   linear shading, the pixel color is summed from XYZ\n\
+     values of the spectral products made once.\n\
+-s   spectral sampling, width of samples in nanometers or\n\
+     m(eyer) for 4 samples. Default is 1 nm.\n\
+-g   keeps the geometry of the pixels, so that the next\n\
+     picture with other spectra or illumination model is\n\
+     shaded without finding it again.\n\
+-c   texture space shading, the paper is shaded once for\n\
+     each pixel of the roughness matrix and a picture pixel\n\
+     gets the color of the paper pixel nearest to the point\n\
+     it sees. Approximate: off the paper grid the shadow of\n\
+     that paper pixel is used, so up to about 15 % of the\n\
+     pixels may be wrongly lit or shadowed. Exact from the\n\
+     nadir with a dot size that is a multiple of the paper\n\
+     pixel size. Ignored with bilinear normals.\n\
+-z   compression of the picture files, n(one), p(ackbits)\n\
+     or l(zw). Default is none.\n\
+-T   tile size of the picture files, a multiple of 16.\n\
+     The tiles are written as soon as they are rendered.\n\
+     Default is 0, the files are saved in strips.\n\
+-k   ink sweep file, each line has the splitting,\n\
+     deposition and absorption coefficients of a picture\n\
+     named picture_kline.tif.\n\
+-K   ink sweep file, only the ink transfer statistics of\n\
+     each line are printed."
 
 
 #endif /* __DEFS__ */
@@ -24,6 +24,7 @@
 #include "fileio.h"
 #include "message.h"
 #include "paper.h"
+#include "conv.h"
 
 
 
@@ -34,6 +35,12 @@
 typedef double ConvType;
 typedef char   ImageType;
 
+#ifdef SINGLE_PRECISION
+typedef float  FieldType;    /* Transfer field element type */
+#else
+typedef double FieldType;    /* Transfer field element type */
+#endif /* SINGLE_PRECISION */
+
 typedef struct  {
     int         x,y;
                 } IPoint;
@@ -62,7 +69,12 @@ typedef struct  {
     double      Deposition;
     double      Absorption;
 
-    double      Transfer;
+    FieldType  *Field;        /* Convolved ink image at the pixels */
+    IPoint      FieldMin;     /* of the ink image, rows one after */
+    IPoint      FieldSize;    /* another, NULL if not made */
+    FieldType  *Roughness;    /* Paper roughness at the same pixels */
+    unsigned char *Occupied;  /* Bit for each INK_BLOCK x INK_BLOCK */
+    IPoint      Blocks;       /* block of Field, set if not all zero */
 
     ColorType   Ambient;
     double      AmbientScale;
@@ -92,6 +104,8 @@ typedef struct  {
 
 #define WORD_SIZE 20
 
+#define INK_BLOCK 8       /* Field pixels in an occupancy block */
+
 
 /* Global variables for this file */
 
@@ -111,6 +125,9 @@ static Logical FreeConvMem(void);
 static Logical ReadImageType(cBuffer,int,String);
 static Logical FreeImageMem(void);
 static Logical AllocateImageMem(void);
+static double InkConvolution(POINT *);
+static Logical MakeOccupancy(void);
+static void FieldIndex(double,double,double,int,int,int *);
 
 #define GetImageElement(x,y) (ink.Image[x][y]==IMAGE_FLAG ? ink.ImageScale : 0.0)
 #define Round(x) (floor(x+0.5))
@@ -238,7 +255,7 @@ Logical InkInit(String InkFile)
 
             case 'c':       /* convolution matrix */
                 {
-                int index=0,i;
+                int index=0;
 
                 /* The size of the Convolution matrix */
                 if((index=BufferReadInt(buf,&ink.IConv.x,index))<=0)
@@ -298,6 +315,7 @@ Logical InkExit(void)
     if(init==FALSE)
         return FALSE;
     init=FALSE;
+    InkFieldExit();
     FreeImageMem();
     FreeConvMem();
     ExitStructure();
@@ -320,6 +338,9 @@ double InkPicturePixel(POINT *px)
             || px->y > (ink.Location.y+ink.DSize.y) )
         return 0.0;
     GetPoint(px,&ind);
+    if ( ind.x < 0 || ind.x >= ink.ISize.x
+            || ind.y < 0 || ind.y >= ink.ISize.y )
+        return 0.0;
     return GetImageElement(ind.x,ind.y);
 }
 
@@ -334,28 +355,355 @@ double InkPicturePixel(POINT *px)
     g(x)=[A(x)f(x)] o h(x) [s+dz(x)]
     'o'  means convolution
 
+    The transfer is got from the terms of InkTransferTerms().
+
 */
 
 double InkTransfer(POINT *px)
 {
-    POINT pnt;
-    int ix,iy;
-    double result=0;
+    double conv,roughness;
+
+    conv=InkTransferTerms(px,&roughness);
+    return InkTransferOf(conv,roughness);
+}
+
+
 
+/**************************************************************
+
+    double InkTransferTerms(POINT *px,double *roughness)
+
+    Returns the convolution term ImageScale*[A(x)f(x)] o h(x) of
+    the ink transfer for a point px and stores the roughness
+    term z(x) to roughness. The transfer is linear in the
+    splitting and deposition coefficients, so InkTransferOf()
+    gets it from the terms for any of them. Where no ink is
+    transferred zero is returned and roughness is zero.
+
+    If the transfer field has been made the convolution is
+    taken from the field pixel nearest to px. Else it is
+    computed only near the ink image, see InkCovered().
+
+*/
+
+double InkTransferTerms(POINT *px,double *roughness)
+{
+    int u,v;
+    double result;
+
+    *roughness=0.0;
     if(init==FALSE)
         return 0.0;
-    pnt.x=px->x-ink.IConvCenter.x*ink.PixelSize;
+    if(ink.Field!=NULL)
+        {
+        u=(int)Round((px->x-ink.Location.x)/ink.PixelSize)-ink.FieldMin.x;
+        v=(int)Round((px->y-ink.Location.y)/ink.PixelSize)-ink.FieldMin.y;
+        if(u<0 || u>=ink.FieldSize.x || v<0 || v>=ink.FieldSize.y)
+            return 0.0;
+        result=ink.Field[v*ink.FieldSize.x+u];
+        if(result==0.0)
+            return 0.0;
+        }
+    else if(InkCovered(px,px)==TRUE)
+        result=InkConvolution(px);
+    else
+        return 0.0;
+    *roughness=PaperRoughness(px);
+    return ink.ImageScale*result;
+}
+
+
+
+/**************************************************************
+
+    double InkTransferOf(double conv,double roughness)
+
+    Returns the ink transfer of the terms conv and roughness
+    given by InkTransferTerms() with the current splitting and
+    deposition coefficients.
+
+    g(x)=conv*[s+dz(x)]
+
+*/
+
+double InkTransferOf(double conv,double roughness)
+{
+    return conv*(ink.Splitting+ink.Deposition*roughness);
+}
+
+
+
+/**************************************************************
+
+    Logical InkSetCoefficients(double splitting,double deposition,
+                               double absorption)
+
+    Changes the splitting, deposition and absorption
+    coefficients read from the ink file. The transfer field
+    does not depend on them, so it is kept.
+
+*/
+
+Logical InkSetCoefficients(double splitting,double deposition,
+                           double absorption)
+{
+    if(init==FALSE)
+        return FALSE;
+    ink.Splitting=splitting;
+    ink.Deposition=deposition;
+    ink.Absorption=absorption;
+    return TRUE;
+}
+
+
+
+/**************************************************************
+
+    Logical InkTransferStatistics(double *mean,double *max,
+                                  double *coverage)
+
+    Computes the mean and the maximum of the ink transfer over
+    the transfer field with the current coefficients, and the
+    mean optical ink coverage 1-exp(-2*g*absorption). The
+    transfer is got from the convolution and roughness fields,
+    so no convolution is done. Returns FALSE if the transfer
+    field has not been made.
+
+*/
+
+Logical InkTransferStatistics(double *mean,double *max,double *coverage)
+{
+    double transfer,sum=0.0,top=0.0,cover=0.0;
+    int i,n;
+
+    if(init==FALSE || ink.Field==NULL)
+        return FALSE;
+    n=ink.FieldSize.x*ink.FieldSize.y;
+    for(i=0;i<n;i++)
+        {
+        if(ink.Field[i]==0.0)
+            continue;
+        transfer=InkTransferOf(ink.ImageScale*ink.Field[i],ink.Roughness[i]);
+        sum+=transfer;
+        if(transfer>top)
+            top=transfer;
+        cover+=1.0-exp(-2*transfer*ink.Absorption);
+        }
+    *mean=sum/n;
+    *max=top;
+    *coverage=cover/n;
+    return TRUE;
+}
+
+
+
+/**************************************************************
+
+    Logical InkFieldInit(void)
+
+    Makes the transfer field: the convolution part of InkTransfer
+    for every pixel of the ink image grid where it can be non
+    zero, that is the ink image widened by the convolution matrix.
+    The ink image on the paper contact area is correlated with the
+    convolution matrix by ConvCorrelate, which picks the direct,
+    separable or Fourier method by the size of the matrix and the
+    image. With SINGLE_PRECISION the field is correlated in double
+    and stored as floats. The paper roughness at the field pixels
+    is kept in a second field for InkTransferStatistics(). The
+    paper must be initialized. The field is exact for points on
+    the ink image grid; when the ink and paper pixel sizes are
+    the same and the location is on the paper grid it is exact
+    for all points. A field already made is kept until
+    InkFieldExit() or InkExit().
+
+*/
+
+Logical InkFieldInit(void)
+{
+    POINT pnt;
+    double *image=NULL,*kernel=NULL,*field=NULL;
+    int u,v;
+
+    if(init==FALSE)
+        return FALSE;
+    if(ink.Field!=NULL)
+        return TRUE;
+    if(ink.PicType==NONE || ink.Convolution==NULL)
+        return FALSE;
+
+    /* A field pixel u gets ink from image pixels u-center to
+       u-center+IConv-1. */
+
+    ink.FieldMin.x=ink.IConvCenter.x-ink.IConv.x+1;
+    ink.FieldMin.y=ink.IConvCenter.y-ink.IConv.y+1;
+    ink.FieldSize.x=ink.ISize.x+ink.IConv.x-1;
+    ink.FieldSize.y=ink.ISize.y+ink.IConv.y-1;
+    if((ink.Field=MemoryAllocate(FieldType,(ink.FieldSize.x*ink.FieldSize.y)))==NULL ||
+       (ink.Roughness=MemoryAllocate(FieldType,(ink.FieldSize.x*ink.FieldSize.y)))==NULL ||
+       (image=MemoryAllocate(double,(ink.ISize.x*ink.ISize.y)))==NULL ||
+       (kernel=MemoryAllocate(double,(ink.IConv.x*ink.IConv.y)))==NULL)
+        goto error;
     pnt.z=0.0;
-    for(ix=0;ix<ink.IConv.x;ix++,pnt.x+=ink.PixelSize)
+    for(v=0;v<ink.ISize.y;v++)
         {
-        pnt.y=px->y-ink.IConvCenter.y*ink.PixelSize;
-        for(iy=0;iy<ink.IConv.y;iy++,pnt.y+=ink.PixelSize)
-            result+=((double)PaperContact(&pnt))*
-                      InkPicturePixel(&pnt)*
-                      ink.Convolution[ix][iy];
+        pnt.y=ink.Location.y+v*ink.PixelSize;
+        for(u=0;u<ink.ISize.x;u++)
+            {
+            pnt.x=ink.Location.x+u*ink.PixelSize;
+            image[v*ink.ISize.x+u]=((double)PaperContact(&pnt))*
+                                   InkPicturePixel(&pnt);
+            }
+        }
+    for(v=0;v<ink.IConv.y;v++)
+        for(u=0;u<ink.IConv.x;u++)
+            kernel[v*ink.IConv.x+u]=ink.Convolution[u][v];
+#ifdef SINGLE_PRECISION
+    if((field=MemoryAllocate(double,(ink.FieldSize.x*ink.FieldSize.y)))==NULL)
+        goto error;
+#else
+    field=ink.Field;
+#endif /* SINGLE_PRECISION */
+    if(ConvCorrelate(image,ink.ISize.x,ink.ISize.y,
+                     kernel,ink.IConv.x,ink.IConv.y,
+                     field,CONV_AUTO)==CONV_ERROR)
+        goto error;
+#ifdef SINGLE_PRECISION
+    for(u=0;u<ink.FieldSize.x*ink.FieldSize.y;u++)
+        ink.Field[u]=(FieldType)field[u];
+    MemoryFree(field);
+    field=NULL;
+#endif /* SINGLE_PRECISION */
+    for(v=0;v<ink.FieldSize.y;v++)
+        {
+        pnt.y=ink.Location.y+(v+ink.FieldMin.y)*ink.PixelSize;
+        for(u=0;u<ink.FieldSize.x;u++)
+            {
+            pnt.x=ink.Location.x+(u+ink.FieldMin.x)*ink.PixelSize;
+            ink.Roughness[v*ink.FieldSize.x+u]=(FieldType)PaperRoughness(&pnt);
+            }
         }
-    ink.Transfer=ink.ImageScale*result*(ink.Splitting+ink.Deposition*PaperRoughness(px));
-    return ink.Transfer;
+    if(MakeOccupancy()==FALSE)
+        goto error;
+    MemoryFree(image);
+    MemoryFree(kernel);
+    return TRUE;
+
+error:
+    if(image!=NULL)
+        MemoryFree(image);
+    if(kernel!=NULL)
+        MemoryFree(kernel);
+#ifdef SINGLE_PRECISION
+    if(field!=NULL)
+        MemoryFree(field);
+#endif /* SINGLE_PRECISION */
+    InkFieldExit();
+    return FALSE;
+}
+
+
+
+/**************************************************************
+
+    void InkFieldExit(void)
+
+    Frees the transfer and roughness fields.
+
+*/
+
+void InkFieldExit(void)
+{
+    if(ink.Field!=NULL)
+        MemoryFree(ink.Field);
+    if(ink.Roughness!=NULL)
+        MemoryFree(ink.Roughness);
+    if(ink.Occupied!=NULL)
+        MemoryFree(ink.Occupied);
+    ink.Field=NULL;
+    ink.Roughness=NULL;
+    ink.Occupied=NULL;
+    return;
+}
+
+
+
+/**************************************************************
+
+    unsigned long InkGeometryKey(void)
+
+    Returns a hash of everything of the ink that the terms of
+    the ink transfer depend on: the image, its place and scale
+    and the convolution matrix. The coefficients and the
+    spectra are left out, see InkTransferTerms().
+
+*/
+
+unsigned long InkGeometryKey(void)
+{
+    unsigned long key=BUFFER_HASH_START;
+    int i;
+
+    if(init==FALSE)
+        return 0;
+    key=BufferHash(key,&ink.PixelSize,sizeof(double));
+    key=BufferHash(key,&ink.Location,sizeof(DPoint));
+    key=BufferHash(key,&ink.ISize,sizeof(IPoint));
+    key=BufferHash(key,&ink.DSize,sizeof(DPoint));
+    key=BufferHash(key,&ink.PicType,sizeof(int));
+    key=BufferHash(key,&ink.ImageScale,sizeof(double));
+    if(ink.Image!=NULL)
+        for(i=0;i<ink.ISize.x;i++)
+            key=BufferHash(key,ink.Image[i],(int)sizeof(ImageType)*ink.ISize.y);
+    key=BufferHash(key,&ink.IConv,sizeof(IPoint));
+    key=BufferHash(key,&ink.IConvCenter,sizeof(IPoint));
+    if(ink.Convolution!=NULL)
+        for(i=0;i<ink.IConv.x;i++)
+            key=BufferHash(key,ink.Convolution[i],(int)sizeof(ConvType)*ink.IConv.y);
+    return key;
+}
+
+
+
+/**************************************************************
+
+    Logical InkCovered(POINT *min,POINT *max)
+
+    Tells if the ink transfer can be non zero somewhere in the
+    rectangle from min to max (um). Outside the ink image
+    widened by the convolution matrix it is zero. If the
+    transfer field has been made, the blocks of the field in the
+    rectangle are checked from the occupancy bits too, so the
+    answer is exact to a block.
+
+*/
+
+Logical InkCovered(POINT *min,POINT *max)
+{
+    int u[2],v[2],x,y,b;
+
+    if(init==FALSE || ink.PicType==NONE || ink.Convolution==NULL)
+        return FALSE;
+    if(ink.Field==NULL)
+        {
+        if(max->x<ink.Location.x+(ink.IConvCenter.x-ink.IConv.x)*ink.PixelSize ||
+           max->y<ink.Location.y+(ink.IConvCenter.y-ink.IConv.y)*ink.PixelSize ||
+           min->x>ink.Location.x+(ink.ISize.x+ink.IConvCenter.x)*ink.PixelSize ||
+           min->y>ink.Location.y+(ink.ISize.y+ink.IConvCenter.y)*ink.PixelSize)
+            return FALSE;
+        return TRUE;
+        }
+    FieldIndex(min->x,max->x,ink.Location.x,ink.FieldMin.x,ink.FieldSize.x,u);
+    FieldIndex(min->y,max->y,ink.Location.y,ink.FieldMin.y,ink.FieldSize.y,v);
+    if(u[0]>u[1] || v[0]>v[1])
+        return FALSE;
+    for(y=v[0]/INK_BLOCK;y<=v[1]/INK_BLOCK;y++)
+        for(x=u[0]/INK_BLOCK;x<=u[1]/INK_BLOCK;x++)
+            {
+            b=y*ink.Blocks.x+x;
+            if(ink.Occupied[b/8]&(1<<(b%8)))
+                return TRUE;
+            }
+    return FALSE;
 }
 
 
@@ -430,6 +778,94 @@ static void GetPoint(POINT *px,IPoint *ind)
 
 
 
+/**************************************************************
+
+    static double InkConvolution(POINT *px)
+
+    Convolves the ink image on the paper contact area with the
+    convolution matrix at point px.
+
+*/
+
+static double InkConvolution(POINT *px)
+{
+    POINT pnt;
+    int ix,iy;
+    double result=0;
+
+    pnt.x=px->x-ink.IConvCenter.x*ink.PixelSize;
+    pnt.z=0.0;
+    for(ix=0;ix<ink.IConv.x;ix++,pnt.x+=ink.PixelSize)
+        {
+        pnt.y=px->y-ink.IConvCenter.y*ink.PixelSize;
+        for(iy=0;iy<ink.IConv.y;iy++,pnt.y+=ink.PixelSize)
+            result+=((double)PaperContact(&pnt))*
+                      InkPicturePixel(&pnt)*
+                      ink.Convolution[ix][iy];
+        }
+    return result;
+}
+
+
+
+/**************************************************************
+
+    static Logical MakeOccupancy(void)
+
+    Sets the occupancy bit of every block of the transfer field
+    that has a non zero element.
+
+*/
+
+static Logical MakeOccupancy(void)
+{
+    int u,v,b;
+
+    ink.Blocks.x=(ink.FieldSize.x+INK_BLOCK-1)/INK_BLOCK;
+    ink.Blocks.y=(ink.FieldSize.y+INK_BLOCK-1)/INK_BLOCK;
+    b=(ink.Blocks.x*ink.Blocks.y+7)/8;
+    if((ink.Occupied=MemoryAllocate(unsigned char,b))==NULL)
+        return FALSE;
+    memset(ink.Occupied,0,b);
+    for(v=0;v<ink.FieldSize.y;v++)
+        for(u=0;u<ink.FieldSize.x;u++)
+            if(ink.Field[v*ink.FieldSize.x+u]!=0.0)
+                {
+                b=(v/INK_BLOCK)*ink.Blocks.x+u/INK_BLOCK;
+                ink.Occupied[b/8]|=(unsigned char)(1<<(b%8));
+                }
+    return TRUE;
+}
+
+
+
+/**************************************************************
+
+    static void FieldIndex(double lo,double hi,double loc,
+                           int first,int size,int *ind)
+
+    Stores the range of the field indices of the points lo..hi
+    (um) in one direction to ind[0]..ind[1], clipped to the
+    field, as InkTransfer finds them. The range is empty if
+    ind[0]>ind[1]. The ink location, the first field pixel and
+    the field size in that direction are loc, first and size.
+
+*/
+
+static void FieldIndex(double lo,double hi,double loc,int first,
+                       int size,int *ind)
+{
+    double a,b;
+
+    a=Round((lo-loc)/ink.PixelSize)-first;
+    b=Round((hi-loc)/ink.PixelSize)-first;
+    ind[0]=(a>0.0) ? (a<(double)size ? (int)a : size) : 0;
+    ind[1]=(b<(double)(size-1)) ? (b>-1.0 ? (int)b : -1) : size-1;
+    return;
+}
+
+
+
 /**************************************************************
 
     static Logical InitializeStructure(void)
@@ -458,9 +894,11 @@ static Logical InitializeStructure(void)
     ink.Splitting=INK_SPLITTING;
     ink.Deposition=INK_DEPOSITION;
     ink.Absorption=INK_ABSORPTION;
-    ink.Transfer=0.0;
     ink.ImageScale=INK_LAYER;
     ink.PicType=NONE;
+    ink.Field=NULL;
+    ink.Roughness=NULL;
+    ink.Occupied=NULL;
     if((ink.Ambient=ColorVectorInit())==NULL)
         return FALSE;
     ink.AmbientScale=INK_AMBIENT_COEFFICIENT;
@@ -28,6 +28,14 @@ Logical InkExit(void);
 
 double InkPicturePixel(POINT *);
 double InkTransfer(POINT *);
+double InkTransferTerms(POINT *,double *);
+double InkTransferOf(double,double);
+Logical InkSetCoefficients(double,double,double);
+Logical InkTransferStatistics(double *,double *,double *);
+Logical InkCovered(POINT *,POINT *);
+unsigned long InkGeometryKey(void);
+Logical InkFieldInit(void);
+void InkFieldExit(void);
 double InkGetSpecularBeta(void);
 double InkAbsorptionCoefficient(void);
 
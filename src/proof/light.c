@@ -15,6 +15,7 @@
 
 
 
+#include <string.h>
 #include "defs.h"
 #include "color.h"
 #include "light.h"
@@ -36,16 +37,21 @@ typedef struct  {
     ColorType           AmbientColor;
                 }   LightStruct ;
 
+#define LIST_SEPARATOR ','  /* Separates the files of a light list */
+
 
 /* Global variables for this file */
 
-static LightStruct light;
+static LightStruct *lights=NULL;    /* Illuminants of the list */
+static LightStruct *light=NULL;     /* The selected illuminant */
+static int count=0;
 static int init=FALSE;
 
 
 /* Internal functions */
 
-static Logical InitializeStructure(void);
+static Logical ReadLight(String,LightStruct *);
+static Logical InitializeStructure(LightStruct *);
 static void ExitStructure(void);
 
 
@@ -55,90 +61,53 @@ static void ExitStructure(void);
 
 /**************************************************************
 
-    int lightInit(String lightName)
+    int lightInit(String LightNames)
 
-    Reads the light file and initializes the paper struct
+    Reads the light files and initializes the light structs.
+    LightNames is a list of light files separated by commas,
+    one illuminant for each file. The first one is selected.
 
 */
 
-int LightInit(String LightName)
+int LightInit(String LightNames)
 {
-    cBuffer buf=NULL;
-    int     bSize=BUFFER_SIZE;
-    int     size;
+    String  name=NULL;
+    String  end;
+    int     i;
 
     if(init==TRUE)
+        return FALSE;
+    count=1;
+    for(i=0;LightNames[i]!='\0';i++)
+        if(LightNames[i]==LIST_SEPARATOR)
+            count++;
+    if((lights=MemoryAllocate(LightStruct,count))==NULL)
         goto error;
-    if(InitializeStructure()==FALSE)
-        goto error;
-    if (FileIOOpen(LightName,READ) == FALSE)
-        goto error;
-    if((buf=BufferAllocate(bSize))==NULL)
+    for(i=0;i<count;i++)
+        {
+        lights[i].Color=NULL;
+        lights[i].AmbientColor=NULL;
+        }
+    if((name=MemoryAllocate(char,(strlen(LightNames)+1)))==NULL)
         goto error;
-    size=ColorGetSize();
-    while (FileIOReadLine(LightName,buf,bSize)!=FALSE)
+    for(i=0;i<count;i++)
         {
-        switch (buf[0])
-            {
-
-            case 'X':       /* light position X coordinate */
-                if(BufferReadDouble(buf,&light.X,0)<=0)
-                    goto error;
-                break;
-
-            case 'Y':       /* light position Y coordinate */
-                if(BufferReadDouble(buf,&light.Y,0)<=0)
-                    goto error;
-                break;
-
-            case 'Z':       /* light position Z coordinate */
-                if(BufferReadDouble(buf,&light.Z,0)<=0)
-                    goto error;
-                break;
-
-            case 'c':       /* Color and intensity of light */
-                {
-                int i;
-
-                if(BufferReadDouble(buf,&light.Intensity,0)<=0)
-                    goto error;
-                if((ColorReadVector(buf,light.Color,
-                                      LightName,bSize))==FALSE)
-                    goto error;
-                for(i=0;i<size;i++)
-                    light.Color[i]=light.Color[i]*light.Intensity;
-                }
-                break;
-
-            case 'a':       /* Color and Intensity of ambient light */
-                {
-                int i;
-
-                if(BufferReadDouble(buf,&light.AmbientIntensity,0)<=0)
-                    goto error;
-                if((ColorReadVector(buf,light.AmbientColor,
-                                      LightName,bSize))==FALSE)
-                    goto error;
-                for(i=0;i<size;i++)
-                    light.AmbientColor[i]=light.AmbientColor[i]*light.AmbientIntensity;
-                }
-                break;
-
-            case '#':       /* comment */
-            case ' ':
-            default:        /* Ignore unknown character */
-                break;
-            }
+        if((end=strchr(LightNames,LIST_SEPARATOR))==NULL)
+            end=LightNames+strlen(LightNames);
+        strncpy(name,LightNames,end-LightNames);
+        name[end-LightNames]='\0';
+        if(ReadLight(name,&lights[i])==FALSE)
+            goto error;
+        LightNames=end+1;
         }
+    MemoryFree(name);
+    light=lights;
     init=TRUE;
-    (void)FileIOClose(LightName);
-    BufferFree(buf);
     return TRUE;
 
 error:
-    (void)FileIOClose(LightName);
-    if(buf!=NULL)
-        BufferFree(buf);
+    if(name!=NULL)
+        MemoryFree(name);
     ExitStructure();
     MessageWarning("Can't initialize light structure");
     return FALSE;
@@ -165,6 +134,42 @@ Logical LightExit(void)
 
 
 
+/**************************************************************
+
+    int LightCount(void)
+
+    Returns the number of illuminants read by LightInit()
+
+*/
+
+int LightCount(void)
+{
+    if(init==FALSE)
+        return 0;
+    return count;
+}
+
+
+
+/**************************************************************
+
+    Logical LightSelect(int n)
+
+    Selects the illuminant n, counted from zero in the order of
+    the light list. The other functions use the selected one.
+
+*/
+
+Logical LightSelect(int n)
+{
+    if(init==FALSE || n<0 || n>=count)
+        return FALSE;
+    light=lights+n;
+    return TRUE;
+}
+
+
+
 /**************************************************************
 
     Logical lightVector(VECTOR *Dir,POINT *px)
@@ -177,9 +182,9 @@ Logical LightVector(VECTOR *Dir,POINT *px)
 {
     if(init==FALSE)
         return FALSE;
-    Dir->i = light.X - px->x;
-    Dir->j = light.Y - px->y;
-    Dir->k = light.Z - px->z;
+    Dir->i = light->X - px->x;
+    Dir->j = light->Y - px->y;
+    Dir->k = light->Z - px->z;
     VectorNorm(Dir);
     return TRUE;
 }
@@ -199,7 +204,7 @@ ColorType LightSpecColor(void)
 {
     if(init==FALSE)
         return NULL;
-    return light.Color;
+    return light->Color;
 }
 
 
@@ -217,7 +222,7 @@ ColorType LightAmbientColor(void)
 {
     if(init==FALSE)
         return NULL;
-    return light.AmbientColor;
+    return light->AmbientColor;
 }
 
 
@@ -231,23 +236,111 @@ ColorType LightAmbientColor(void)
 
 /**************************************************************
 
-    Logical InitializeStructure(void)
+    static Logical ReadLight(String LightName,LightStruct *l)
+
+    Reads the light file LightName to the light struct l.
+
+*/
+
+static Logical ReadLight(String LightName,LightStruct *l)
+{
+    cBuffer buf=NULL;
+    int     bSize=BUFFER_SIZE;
+    int     size;
+
+    if(InitializeStructure(l)==FALSE)
+        goto error;
+    if (FileIOOpen(LightName,READ) == FALSE)
+        goto error;
+    if((buf=BufferAllocate(bSize))==NULL)
+        goto error;
+    size=ColorGetSize();
+    while (FileIOReadLine(LightName,buf,bSize)!=FALSE)
+        {
+        switch (buf[0])
+            {
+
+            case 'X':       /* light position X coordinate */
+                if(BufferReadDouble(buf,&l->X,0)<=0)
+                    goto error;
+                break;
+
+            case 'Y':       /* light position Y coordinate */
+                if(BufferReadDouble(buf,&l->Y,0)<=0)
+                    goto error;
+                break;
+
+            case 'Z':       /* light position Z coordinate */
+                if(BufferReadDouble(buf,&l->Z,0)<=0)
+                    goto error;
+                break;
+
+            case 'c':       /* Color and intensity of light */
+                {
+                int i;
+
+                if(BufferReadDouble(buf,&l->Intensity,0)<=0)
+                    goto error;
+                if((ColorReadVector(buf,l->Color,
+                                      LightName,bSize))==FALSE)
+                    goto error;
+                for(i=0;i<size;i++)
+                    l->Color[i]=l->Color[i]*l->Intensity;
+                }
+                break;
+
+            case 'a':       /* Color and Intensity of ambient light */
+                {
+                int i;
+
+                if(BufferReadDouble(buf,&l->AmbientIntensity,0)<=0)
+                    goto error;
+                if((ColorReadVector(buf,l->AmbientColor,
+                                      LightName,bSize))==FALSE)
+                    goto error;
+                for(i=0;i<size;i++)
+                    l->AmbientColor[i]=l->AmbientColor[i]*l->AmbientIntensity;
+                }
+                break;
+
+            case '#':       /* comment */
+            case ' ':
+            default:        /* Ignore unknown character */
+                break;
+            }
+        }
+    (void)FileIOClose(LightName);
+    BufferFree(buf);
+    return TRUE;
+
+error:
+    (void)FileIOClose(LightName);
+    if(buf!=NULL)
+        BufferFree(buf);
+    return FALSE;
+}
+
+
+
+/**************************************************************
+
+    Logical InitializeStructure(LightStruct *l)
 
-    This function puts the default values to light struct.
+    This function puts the default values to light struct l.
 
 */
 
-static Logical InitializeStructure(void)
+static Logical InitializeStructure(LightStruct *l)
 {
-    light.X=LIGHT_X_POSITION;
-    light.Y=LIGHT_Y_POSITION;
-    light.Z=LIGHT_Z_POSITION;
-    if((light.Color=ColorVectorInit())==NULL)
+    l->X=LIGHT_X_POSITION;
+    l->Y=LIGHT_Y_POSITION;
+    l->Z=LIGHT_Z_POSITION;
+    if((l->Color=ColorVectorInit())==NULL)
         return FALSE;
-    if((light.AmbientColor=ColorVectorInit())==NULL)
+    if((l->AmbientColor=ColorVectorInit())==NULL)
         return FALSE;
-    light.Intensity=LIGHT_INTENSITY;
-    light.AmbientIntensity=LIGHT_AMBIENT_INTENSITY;
+    l->Intensity=LIGHT_INTENSITY;
+    l->AmbientIntensity=LIGHT_AMBIENT_INTENSITY;
     return TRUE;
 }
 
@@ -257,15 +350,25 @@ static Logical InitializeStructure(void)
 
     static void ExitStructure(void)
 
-    This function frees memory used by vectors.
+    This function frees memory used by the light structs.
 
 */
 
 static void ExitStructure(void)
 {
-    ColorVectorExit(light.Color);
-    light.Color=NULL;
-    ColorVectorExit(light.AmbientColor);
-    light.AmbientColor=NULL;
+    int i;
+
+    if(lights!=NULL)
+        {
+        for(i=0;i<count;i++)
+            {
+            ColorVectorExit(lights[i].Color);
+            ColorVectorExit(lights[i].AmbientColor);
+            }
+        MemoryFree(lights);
+        }
+    lights=NULL;
+    light=NULL;
+    count=0;
     return;
 }
@@ -27,6 +27,8 @@
 
 Logical LightInit(String);
 Logical LightExit(void);
+int LightCount(void);
+Logical LightSelect(int);
 ColorType LightSpecColor(void);
 ColorType LightAmbientColor(void);
 Logical LightVector(VECTOR *,POINT *);
@@ -16,6 +16,7 @@
 
 
 #include <math.h>
+#include <limits.h>
 #include "defs.h"
 #include "paper.h"
 #include "buffer.h"
@@ -33,7 +34,20 @@ typedef unsigned char RoughType; /* Roughness type defined for  */
                                   /* saving space in roughness */
                                   /* matrix in PaperStruct. */
 
+#ifdef SINGLE_PRECISION
+typedef float BetaType;     /* Beta matrix element type */
+#else
 typedef double BetaType;    /* Beta matrix element type */
+#endif /* SINGLE_PRECISION */
+
+
+typedef struct  {           /* Normal map element of three floats */
+    float       i,j,k;
+                } FNormal;
+
+typedef struct  {           /* Octahedral normal map element */
+    unsigned short u,v;
+                } ONormal;
 
 
 typedef struct  {
@@ -46,6 +60,21 @@ typedef struct  {
                 } DPoint;
 
 
+#define PYRAMID_LEVELS 32  /* Max levels of the height pyramid */
+#define PYRAMID_MISSES 32  /* Pixel steps before a block is tried */
+#define PERIOD_TRIES 16    /* Paper periods tried by GetPeriod */
+#define PERIOD_EPS 1e-9    /* Relative error of a whole period */
+
+typedef struct  {           /* Ray followed by MarchRay */
+    Logical     MainDirection;
+    int         na,nb;        /* Matrix size in main and minor direction */
+    int         ma,mb;        /* and the masks for WrapIndex */
+    int         ia,da;        /* Main index of the start and its step */
+    double      fb,s;         /* Minor position of the start and its step */
+    double      z,c;          /* Height of the start and rise of a step */
+    int         steps;        /* Steps below the maximum roughness */
+                } RAY;
+
 typedef struct  {
     double      PixelSize;    /* Size in um */
 
@@ -73,9 +102,28 @@ typedef struct  {
 
     DPoint      DBeta;        /* Actual size of Beta matrix */
 
-    BetaType  **Beta;
+    IPoint      Mask;         /* ISize-1 if it is a power of two */
+
+    IPoint      BetaMask;     /* IBeta-1 if it is a power of two */
+
+    IPoint      Texels;       /* Common period of the matrices */
+
+    BetaType   *Beta;         /* Beta matrix, rows one after another */
 
-    RoughType **Rough;
+    RoughType  *Rough;        /* Roughness matrix, rows one after another */
+
+    int         Levels;       /* Levels of the height pyramid above Rough */
+    int         Level[PYRAMID_LEVELS]; /* Offset of level l+1 */
+    RoughType  *MaxRough;     /* Max and min of the 2^l x 2^l blocks */
+    RoughType  *MinRough;     /* of Rough, levels one after another */
+
+    char       *Shadow;       /* Self shadow mask for ShadowLight */
+    VECTOR      ShadowLight;
+
+    int         NormalType;   /* Type of the normal map elements */
+    Logical     NormalBilinear; /* TRUE if normals are interpolated */
+    char       *NormalMem;    /* Memory allocated for normal map */
+    void       *Normal;       /* Cache aligned normal map */
 
                 } PaperStruct ;
 
@@ -85,6 +133,11 @@ typedef struct  {
 
 #define Z_DIV 0.0001
 
+#define SHADOW_MAX_PHASES 64  /* Max phases of the shadow sweep */
+
+#define CACHE_LINE 64      /* Alignment of the normal map in bytes */
+#define OCT_MAX 65535.0    /* Largest octahedral coordinate */
+
 
 /* Global variables for this file */
 
@@ -100,6 +153,13 @@ static void ExitStructures(void);
 static Logical ReadRoughnessMatrix(cBuffer,int,String);
 static Logical AllocateRoughnessMem(void);
 static Logical FreeRoughnessMem(void);
+static Logical BuildPyramid(void);
+static void FreePyramid(void);
+static int MarchRay(VECTOR*,POINT*,Logical,POINT*);
+static void RayIndex(RAY*,int,int*,int*);
+static int RunEnd(RAY*,int,int,int,int,int);
+static int GetPeriod(int,double);
+static int CommonPeriod(int,int);
 
 static Logical ReadBetaMatrix(cBuffer,int,String);
 static Logical AllocateBetaMem(void);
@@ -108,13 +168,27 @@ static Logical FreeBetaMem(void);
 static void GetPoint(POINT*,IPoint*);
 static void GetRealPoint(POINT*,IPoint*);
 static void GetBetaPoint(POINT*,IPoint*);
-
-#define GetElement(x,y) ((double)paper.Rough[x][y]*paper.Range/(double)HIGH_VALUE)
-#define GetBetaElement(x,y) ((double)paper.Beta[x][y]+(double)paper.SpecularBeta)
+static double GetSweepElement(int,int,Logical);
+static void ShiftBorderPoint(IPoint*);
+
+static void CalculateNormal(IPoint*,VECTOR*);
+static void GetMapNormal(int,int,VECTOR*);
+static void GetBilinearNormal(POINT*,VECTOR*);
+static void EncodeOctahedral(VECTOR*,ONormal*);
+static void DecodeOctahedral(ONormal*,VECTOR*);
+static void FreeNormalMap(void);
+
+#define GetElement(c,r) GetHeight(paper.Rough[(r)*paper.ISize.x+(c)])
+#define GetBetaElement(c,r) ((double)paper.Beta[(r)*paper.IBeta.x+(c)]+(double)paper.SpecularBeta)
 #define GetMaxRange() paper.Range
-#define Remainder(x) (x-floor(x)) /* Remainder of a division */
+#define GetHeight(v) ((double)(v)*paper.Range/(double)HIGH_VALUE)
+#define LevelSize(n,l) ((((n)-1)>>(l))+1)
 #define Round(x) (floor(x+0.5))
 
+/* Index i wrapped to 0..n-1, mask is n-1 if n is a power of two */
+#define WrapIndex(i,n,mask) ((mask)!=0 ? (i)&(mask) : ((i)%(n)+(n))%(n))
+#define PowerOfTwoMask(n) (((n)&((n)-1))==0 ? (n)-1 : 0)
+
 
 /**************************************************************/
 
@@ -213,7 +287,7 @@ int PaperInit(String PaperName)
 
             case 'r':       /* roughness matrix */
                 {
-                int index=0,i;
+                int index=0;
 
                 /* The size of the roughness matrix */
                 if((index=BufferReadInt(buf,&paper.ISize.x,index))<=0)
@@ -232,7 +306,7 @@ int PaperInit(String PaperName)
 
             case 'a':       /* angle of beta */
                 {
-                int index=0,i;
+                int index=0;
 
                 /* The size of the Beta matrix */
                 if((index=BufferReadInt(buf,&paper.IBeta.x,index))<=0)
@@ -260,6 +334,18 @@ int PaperInit(String PaperName)
     paper.DSize.y=paper.PixelSize*paper.ISize.y;
     paper.DBeta.x=paper.PixelSize*paper.IBeta.x;
     paper.DBeta.y=paper.PixelSize*paper.IBeta.y;
+    paper.Mask.x=PowerOfTwoMask(paper.ISize.x);
+    paper.Mask.y=PowerOfTwoMask(paper.ISize.y);
+    paper.BetaMask.x=PowerOfTwoMask(paper.IBeta.x);
+    paper.BetaMask.y=PowerOfTwoMask(paper.IBeta.y);
+    paper.Texels=paper.ISize;
+    if(paper.Beta!=NULL)
+        {
+        paper.Texels.x=CommonPeriod(paper.ISize.x,paper.IBeta.x);
+        paper.Texels.y=CommonPeriod(paper.ISize.y,paper.IBeta.y);
+        }
+    if(BuildPyramid()==FALSE)
+        goto error;
     (void)FileIOClose(PaperName);
     BufferFree(buf);
     init=TRUE;
@@ -271,6 +357,7 @@ error:
     (void)FileIOClose(PaperName);
     if(buf!=NULL)
         BufferFree(buf);
+    FreePyramid();
     FreeRoughnessMem();
     FreeBetaMem();
     ExitStructures();
@@ -294,7 +381,10 @@ Logical PaperExit(void)
     if(init==FALSE)
         return FALSE;
     init=FALSE;
+    PaperShadowExit();
+    FreeNormalMap();
     ExitStructures();
+    FreePyramid();
     FreeRoughnessMem();
     FreeBetaMem();
     return TRUE;
@@ -306,7 +396,10 @@ Logical PaperExit(void)
 
     Logical PaperGetNormalVector(VECTOR *Normal,POINT *px)
 
-    This function calculates the normal vector of a point px
+    This function calculates the normal vector of a point px.
+    If the normal map has been made the normal is fetched from
+    the map, interpolated bilinearly if that was asked for and
+    the dots are smaller than the paper pixels.
 
     Point px is in micrometers (um).
 
@@ -314,37 +407,23 @@ Logical PaperExit(void)
 
 Logical PaperGetNormalVector(VECTOR *Normal,POINT *px)
 {
-    double val1X,val1Y,val3X,val3Y;
     IPoint ind;
-    VECTOR a,b,*c;
 
     if(init==FALSE)
         goto error;
+    if(paper.Normal!=NULL)
+        {
+        if(paper.NormalBilinear==TRUE)
+            GetBilinearNormal(px,Normal);
+        else
+            {
+            GetRealPoint(px,&ind);
+            GetMapNormal(ind.x,ind.y,Normal);
+            }
+        return TRUE;
+        }
     GetPoint(px,&ind);
-
-    /* Get the point values from roughness matrix */
-
-    val1X=GetElement((ind.x-1),ind.y);
-    val1Y=GetElement(ind.x,(ind.y-1));
-    val3X=GetElement((ind.x+1),ind.y);
-    val3Y=GetElement(ind.x,(ind.y+1));
-
-    /* Calculate the vectors for the tanget plane */
-
-    a.k=(val1X-val3X)/2;
-    a.i=paper.PixelSize;
-    a.j=0.0;
-    b.k=(val1Y-val3Y)/2;
-    b.j=paper.PixelSize;
-    b.i=0.0;
-
-    /* Calculate the Normal vector of the surface */
-
-    c=VectorCross(&a,&b);
-    Normal->i=c->i;
-    Normal->j=c->j;
-    Normal->k=c->k;
-    VectorNorm(Normal);
+    CalculateNormal(&ind,Normal);
     return TRUE;
 
 error:
@@ -358,78 +437,306 @@ error:
 
 /**************************************************************
 
-    Logical PaperSelfShadow(VECTOR *Light,POINT *px)
-
-    Calculates the self shadow effect for point px of light
-    direction L. Light vector has to be normalized.
+    Logical PaperNormalMapInit(int type,double DotSize,Logical Bilinear)
 
-    Point px is in micrometers (um).
+    Makes the normal map of the roughness matrix. The normals
+    are stored as three floats (PAPER_NORMAL_FLOAT) or as two
+    16 bit octahedral coordinates (PAPER_NORMAL_OCTAHEDRAL) in
+    a cache aligned array. With PAPER_NORMAL_NONE the normals
+    are calculated for every pixel. A pixel gets the normal of
+    the nearest cell, unless Bilinear is TRUE and the dot size
+    DotSize of the picture is smaller than the paper pixel size.
+    Then the normals are interpolated bilinearly.
 
 */
 
-Logical PaperSelfShadow(VECTOR *Light,POINT *px)
+Logical PaperNormalMapInit(int type,double DotSize,Logical Bilinear)
 {
     IPoint ind;
-    POINT ScanPX,BscPX,LgtPX;
-    double dx;
+    VECTOR n;
+    int    size,x,y;
+
+    if(init==FALSE)
+        return FALSE;
+    FreeNormalMap();
+    switch(type)
+        {
+        case PAPER_NORMAL_NONE:
+            return TRUE;
+        case PAPER_NORMAL_FLOAT:
+            size=sizeof(FNormal);
+            break;
+        case PAPER_NORMAL_OCTAHEDRAL:
+            size=sizeof(ONormal);
+            break;
+        default:
+            return FALSE;
+        }
+    size=size*paper.ISize.x*paper.ISize.y;
+    if((paper.NormalMem=BufferAllocate(size+CACHE_LINE))==NULL)
+        return FALSE;
+    paper.Normal=(void *)(((unsigned long)paper.NormalMem+CACHE_LINE-1)
+                          &~(unsigned long)(CACHE_LINE-1));
+    for(x=0;x<paper.ISize.x;x++)
+        for(y=0;y<paper.ISize.y;y++)
+            {
+            ind.x=x;
+            ind.y=y;
+            ShiftBorderPoint(&ind);
+            CalculateNormal(&ind,&n);
+            if(type==PAPER_NORMAL_FLOAT)
+                {
+                FNormal *f=(FNormal *)paper.Normal+y*paper.ISize.x+x;
+
+                f->i=(float)n.i;
+                f->j=(float)n.j;
+                f->k=(float)n.k;
+                }
+            else
+                EncodeOctahedral(&n,(ONormal *)paper.Normal+y*paper.ISize.x+x);
+            }
+    paper.NormalType=type;
+    paper.NormalBilinear=(Bilinear==TRUE && DotSize<paper.PixelSize) ?
+                         TRUE : FALSE;
+    return TRUE;
+}
+
+
+
+/**************************************************************
+
+    Logical PaperShadowInit(VECTOR *Light)
+
+    Computes the self shadow mask of the roughness matrix for the
+    light direction Light. After this PaperSelfShadow looks the
+    shadow of a point that lies on a cell of the matrix up from
+    the mask instead of marching through the matrix. Points
+    between the cells start the march from another minor
+    direction position, so they are still marched. A mask made
+    for the same light direction is kept.
+
+    The mask is made with a horizon sweep against the main
+    direction of the light. The ray steps through the same cells
+    as in the march of PaperSelfShadow, so the minor direction
+    slope is handled as a fraction p/q. If no fraction with q
+    below SHADOW_MAX_PHASES steps the same way as the march no
+    mask is made and all the points are marched.
+
+    After q steps the ray has moved p cells in the minor
+    direction whatever the phase of the step pattern, so the
+    sweep goes with steps of q cells. The horizon of a cell is
+    the highest point met by these steps, lowered by the rise of
+    the ray, and it is got from the cell q steps nearer to the
+    light. The matrix is periodic, so the sweep goes around it
+    until the light ray is above the maximum roughness. A cell is
+    in shadow if the horizon of one of the q cells after it is
+    above it. Only one horizon is kept for each cell.
+
+    Returns FALSE if no mask is needed or it can't be made.
+
+*/
+
+Logical PaperShadowInit(VECTOR *Light)
+{
+    double *horizon=NULL;
+    double s,c,h,hor;
+    int    *offset=NULL;
+    int na,nb,a,b,an,bn,da,p,q,phase,step,period,periods,steps,n;
     Logical MainDirection=TRUE;
+    char shadow;
 
     if(init==FALSE)
         return FALSE;
+    if(paper.Shadow!=NULL && Light->i==paper.ShadowLight.i &&
+       Light->j==paper.ShadowLight.j && Light->k==paper.ShadowLight.k)
+        return TRUE;
+    PaperShadowExit();
 
-    /* Prevent dividing by zero or a very small value */
+    /* Light from the zenith does not need a mask */
 
     if(Light->i<Z_DIV && Light->i>(-Z_DIV) &&
        Light->j<Z_DIV && Light->j>(-Z_DIV))
         return FALSE;
 
-    dx=paper.PixelSize;
-    GetRealPoint(px,&ind);
-    if(Light->i!=0.0)
-        LgtPX.x=Light->i/fabs(Light->i);
-    else
-        LgtPX.x=1.0;
-    if(Light->j!=0.0)
-        LgtPX.y=Light->j/fabs(Light->j);
-    else
-        LgtPX.y=1.0;
     if(fabs(Light->i)<fabs(Light->j))
         MainDirection=FALSE;
-    BscPX.x=ScanPX.x=px->x;
-    BscPX.y=ScanPX.y=px->y;
-    BscPX.z=ScanPX.z=GetElement(ind.x,ind.y);
+    if(MainDirection==TRUE)
+        {
+        na=paper.ISize.x;
+        nb=paper.ISize.y;
+        da=(Light->i>0.0 ? 1 : -1);
+        s=Light->j/fabs(Light->i);
+        }
+    else
+        {
+        na=paper.ISize.y;
+        nb=paper.ISize.x;
+        da=(Light->j>0.0 ? 1 : -1);
+        s=Light->i/fabs(Light->j);
+        }
+
+    /* Rise of the light ray for one step and the number of steps
+       the ray needs to get over the maximum roughness */
+
+    c=Light->k*paper.PixelSize*sqrt(1.0+s*s);
+    if(c>0.0)
+        steps=(int)ceil(paper.Range/c);
+    else
+        steps=na;
+
+    /* Slope of the minor direction as a fraction p/q which
+       rounds the same way as s for all the steps */
 
-    do
+    for(q=1;q<SHADOW_MAX_PHASES;q++)
         {
-        if(MainDirection==TRUE)
+        p=(int)Round(s*q);
+        for(n=1;n<=steps;n++)
+            if((int)Round(n*s)!=(int)Round((double)n*p/q))
+                break;
+        if(n>steps)
+            break;
+        }
+    if(q==SHADOW_MAX_PHASES)
+        return FALSE;
+    p=(int)Round(s*q);
+
+    /* Number of sweeps around the matrix */
+
+    periods=(steps+q)/na+2;
+
+    if((offset=MemoryAllocate(int,q+1))==NULL)
+        goto error;
+    if((horizon=MemoryAllocate(double,na*nb))==NULL)
+        goto error;
+    if((paper.Shadow=MemoryAllocate(char,na*nb))==NULL)
+        goto error;
+    for(phase=0;phase<=q;phase++)
+        offset[phase]=(int)Round((double)phase*p/q);
+    for(a=0;a<na;a++)
+        for(b=0;b<nb;b++)
+            horizon[a*nb+b]=GetSweepElement(a,b,MainDirection);
+
+    /* Sweep against the light direction */
+
+    for(period=0;period<periods;period++)
+        for(step=0;step<na;step++)
             {
-            ScanPX.x+=LgtPX.x*dx;
-            ScanPX.y+=(Light->j/fabs(Light->i))*dx;
+            a=(da>0 ? na-1-step : step);
+            an=((a+q*da)%na+na)%na;
+            for(b=0;b<nb;b++)
+                {
+                bn=((b+p)%nb+nb)%nb;
+                hor=horizon[an*nb+bn]-q*c;
+                if(hor>horizon[a*nb+b])
+                    horizon[a*nb+b]=hor;
+                }
             }
-        else
+
+    /* A cell is in shadow if a horizon after it is above it */
+
+    for(a=0;a<na;a++)
+        for(b=0;b<nb;b++)
             {
-            ScanPX.y+=LgtPX.y*dx;
-            ScanPX.x+=(Light->i/fabs(Light->j))*dx;
+            h=GetSweepElement(a,b,MainDirection);
+            shadow=FALSE;
+            for(phase=1;phase<=q && shadow==FALSE;phase++)
+                {
+                an=((a+phase*da)%na+na)%na;
+                bn=((b+offset[phase])%nb+nb)%nb;
+                if(horizon[an*nb+bn]-phase*c>h)
+                    shadow=TRUE;
+                }
+            if(MainDirection==TRUE)
+                paper.Shadow[b*paper.ISize.x+a]=shadow;
+            else
+                paper.Shadow[a*paper.ISize.x+b]=shadow;
             }
-        GetRealPoint(&ScanPX,&ind);
-        ScanPX.z = GetElement(ind.x,ind.y);
-        LgtPX.z = Light->k*sqrt((ScanPX.x-BscPX.x)*(ScanPX.x-BscPX.x)
-                               +(ScanPX.y-BscPX.y)*(ScanPX.y-BscPX.y))
-                               +BscPX.z;
-        if(LgtPX.z<ScanPX.z)
-            return TRUE;
-        } while(LgtPX.z<GetMaxRange());
+    paper.ShadowLight=*Light;
+    MemoryFree(horizon);
+    MemoryFree(offset);
+    return TRUE;
+
+error:
+    if(horizon!=NULL)
+        MemoryFree(horizon);
+    if(offset!=NULL)
+        MemoryFree(offset);
+    PaperShadowExit();
     return FALSE;
 }
 
 
 
+/**************************************************************
+
+    void PaperShadowExit(void)
+
+    Frees the self shadow mask.
+
+*/
+
+void PaperShadowExit(void)
+{
+    if(paper.Shadow!=NULL)
+        MemoryFree(paper.Shadow);
+    paper.Shadow=NULL;
+    return;
+}
+
+
+
+/**************************************************************
+
+    Logical PaperSelfShadow(VECTOR *Light,POINT *px)
+
+    Calculates the self shadow effect for point px of light
+    direction L. Light vector has to be normalized. If the
+    shadow mask has been made for this light and px lies on a
+    cell of the matrix the result is taken from the mask, else
+    the light ray is followed by MarchRay() until it is first
+    below the surface.
+
+    Point px is in micrometers (um).
+
+*/
+
+Logical PaperSelfShadow(VECTOR *Light,POINT *px)
+{
+    IPoint ind;
+    double x,y;
+
+    if(init==FALSE)
+        return FALSE;
+
+    /* Prevent dividing by zero or a very small value */
+
+    if(Light->i<Z_DIV && Light->i>(-Z_DIV) &&
+       Light->j<Z_DIV && Light->j>(-Z_DIV))
+        return FALSE;
+
+    x=px->x/paper.PixelSize;
+    y=px->y/paper.PixelSize;
+    if(paper.Shadow!=NULL && x==floor(x) && y==floor(y) &&
+       Light->i==paper.ShadowLight.i &&
+       Light->j==paper.ShadowLight.j && Light->k==paper.ShadowLight.k)
+        {
+        GetRealPoint(px,&ind);
+        return (Logical)paper.Shadow[ind.y*paper.ISize.x+ind.x];
+        }
+    return (MarchRay(Light,px,FALSE,NULL)>0) ? TRUE : FALSE;
+}
+
+
+
 /**************************************************************
 
     Logical PaperHiddenPixel(VECTOR *V,POINT *px,POINT *out)
 
     Searches the pixel seen from direction V when looking
     at pixel px. The actualy seen pixel is stored to out pixel.
+    It is the last point of the ray from px to V that is below
+    the surface, found by MarchRay(). The direction can be
+    different for every pixel.
 
     Points px and out are in micrometers (um).
 
@@ -437,11 +744,6 @@ Logical PaperSelfShadow(VECTOR *Light,POINT *px)
 
 Logical PaperHiddenPixel(VECTOR *V,POINT *px,POINT *out)
 {
-    IPoint ind;
-    POINT ScanPX,BscPX,V_PX;
-    double dx;
-    Logical MainDirection=TRUE;
-
     if(init==FALSE)
         return FALSE;
 
@@ -455,46 +757,7 @@ Logical PaperHiddenPixel(VECTOR *V,POINT *px,POINT *out)
        V->j<Z_DIV && V->j>(-Z_DIV))
         return FALSE;
 
-    dx=paper.PixelSize;
-    GetRealPoint(px,&ind);
-    if(V->i!=0.0)
-        V_PX.x=V->i/fabs(V->i);
-    else
-        V_PX.x=1.0;
-    if(V->j!=0.0)
-        V_PX.y=V->j/fabs(V->j);
-    else
-        V_PX.y=1.0;
-    if(fabs(V->i)<fabs(V->j))
-        MainDirection=FALSE;
-    BscPX.x=ScanPX.x=px->x;
-    BscPX.y=ScanPX.y=px->y;
-    BscPX.z=ScanPX.z=GetElement(ind.x,ind.y);
-
-    do
-        {
-        if(MainDirection==TRUE)
-            {
-            ScanPX.x+=V_PX.x*dx;
-            ScanPX.y+=(V->j/fabs(V->i))*dx;
-            }
-        else
-            {
-            ScanPX.y+=V_PX.y*dx;
-            ScanPX.x+=(V->i/fabs(V->j))*dx;
-            }
-        GetRealPoint(&ScanPX,&ind);
-        ScanPX.z = GetElement(ind.x,ind.y);
-        V_PX.z = V->k*sqrt((ScanPX.x-BscPX.x)*(ScanPX.x-BscPX.x)
-                            +(ScanPX.y-BscPX.y)*(ScanPX.y-BscPX.y))
-                            +BscPX.z;
-        if(V_PX.z<ScanPX.z)
-            {
-            out->x=ScanPX.x;
-            out->y=ScanPX.y;
-            out->z=ScanPX.z;
-            }
-        } while(V_PX.z<GetMaxRange());
+    (void)MarchRay(V,px,TRUE,out);
     return TRUE;
 }
 
@@ -551,6 +814,153 @@ double PaperGetSpecularBeta(POINT *px)
 
 
 
+Logical PaperHasBetaMatrix(void)
+{
+    if(init==FALSE)
+        return FALSE;
+    return (paper.Beta!=NULL) ? TRUE : FALSE;
+}
+
+
+
+/**************************************************************
+
+    unsigned long PaperGeometryKey(void)
+
+    Returns a hash of everything of the paper that the geometry
+    of a picture depends on: the roughness and beta matrices,
+    their scales and the normal map. The spectra are left out.
+
+*/
+
+unsigned long PaperGeometryKey(void)
+{
+    unsigned long key=BUFFER_HASH_START;
+
+    if(init==FALSE)
+        return 0;
+    key=BufferHash(key,&paper.PixelSize,sizeof(double));
+    key=BufferHash(key,&paper.Range,sizeof(double));
+    key=BufferHash(key,&paper.Contact,sizeof(double));
+    key=BufferHash(key,&paper.SpecularBeta,sizeof(double));
+    key=BufferHash(key,&paper.ISize,sizeof(IPoint));
+    key=BufferHash(key,paper.Rough,
+                   (int)sizeof(RoughType)*paper.ISize.x*paper.ISize.y);
+    if(paper.Beta!=NULL)
+        {
+        key=BufferHash(key,&paper.IBeta,sizeof(IPoint));
+        key=BufferHash(key,paper.Beta,
+                       (int)sizeof(BetaType)*paper.IBeta.x*paper.IBeta.y);
+        }
+    key=BufferHash(key,&paper.NormalType,sizeof(int));
+    key=BufferHash(key,&paper.NormalBilinear,sizeof(Logical));
+    return key;
+}
+
+
+
+/**************************************************************
+
+    Logical PaperGetPeriod(double DotSize,int *x,int *y)
+
+    Gets the period of the paper in dots of size DotSize (um).
+    The roughness and beta matrices repeat after x dots in the x
+    direction and after y dots in the y direction. Returns FALSE
+    if the matrices don't repeat at a whole dot in a few periods.
+
+*/
+
+Logical PaperGetPeriod(double DotSize,int *x,int *y)
+{
+    if(init==FALSE || DotSize<=0.0)
+        return FALSE;
+    *x=GetPeriod(paper.ISize.x,DotSize);
+    *y=GetPeriod(paper.ISize.y,DotSize);
+    if(paper.Beta!=NULL)
+        {
+        *x=CommonPeriod(*x,GetPeriod(paper.IBeta.x,DotSize));
+        *y=CommonPeriod(*y,GetPeriod(paper.IBeta.y,DotSize));
+        }
+    return (*x>0 && *y>0) ? TRUE : FALSE;
+}
+
+
+
+/**************************************************************
+
+    int PaperTexels(void)
+
+    Returns the number of texels. The texels are the paper
+    pixels of the common period of the roughness and beta
+    matrices, so the normal, self shadow, roughness and beta
+    of a texel are those of all the grid points of the paper
+    that repeat it. Returns 0 if the period is too large or the
+    normals are interpolated, as then a texel would give a point
+    between the grid points a wrong normal.
+
+*/
+
+int PaperTexels(void)
+{
+    if(init==FALSE || paper.Texels.x<=0 || paper.Texels.y<=0 ||
+       paper.Texels.x>INT_MAX/paper.Texels.y)
+        return 0;
+    if(paper.Normal!=NULL && paper.NormalBilinear==TRUE)
+        return 0;
+    return paper.Texels.x*paper.Texels.y;
+}
+
+
+
+/**************************************************************
+
+    int PaperTexel(POINT *px)
+
+    Returns the texel nearest to point px, numbered rows one
+    after another, or -1 if the paper is not initialized. The
+    texel has the self shadow of px only if px is on the paper
+    grid.
+
+    Point px is in micrometers (um).
+
+*/
+
+int PaperTexel(POINT *px)
+{
+    int x,y;
+
+    if(init==FALSE)
+        return -1;
+    x=WrapIndex((int)Round(px->x/paper.PixelSize),paper.Texels.x,0);
+    y=WrapIndex((int)Round(px->y/paper.PixelSize),paper.Texels.y,0);
+    return y*paper.Texels.x+x;
+}
+
+
+
+/**************************************************************
+
+    Logical PaperTexelPoint(int texel,POINT *px)
+
+    Stores the point of the texel texel, numbered as in
+    PaperTexel(), to px.
+
+    Point px is in micrometers (um).
+
+*/
+
+Logical PaperTexelPoint(int texel,POINT *px)
+{
+    if(init==FALSE || texel<0 || texel>=PaperTexels())
+        return FALSE;
+    px->x=(texel%paper.Texels.x)*paper.PixelSize;
+    px->y=(texel/paper.Texels.x)*paper.PixelSize;
+    px->z=0.0;
+    return TRUE;
+}
+
+
+
 double PaperGetSpecularScale(void)
 {
     if(init==FALSE)
@@ -617,9 +1027,24 @@ double PaperGetPixelSize(void)
 
 static void GetPoint(POINT *px,IPoint *ind)
 {
-    double dX,dY;
-
     GetRealPoint(px,ind);
+    ShiftBorderPoint(ind);
+    return;
+}
+
+
+
+/**************************************************************
+
+    static void ShiftBorderPoint(IPoint *ind)
+
+    Shifts a matrix index on the border of matrix towards the
+    center.
+
+*/
+
+static void ShiftBorderPoint(IPoint *ind)
+{
     if(ind->x==0)
         ind->x=1;
     else if(ind->x==(paper.ISize.x-1))
@@ -633,23 +1058,206 @@ static void GetPoint(POINT *px,IPoint *ind)
 
 
 
+/**************************************************************
+
+    static void CalculateNormal(IPoint *ind,VECTOR *Normal)
+
+    Calculates the normal vector of the roughness matrix at
+    index ind. The index must not be on the border of matrix.
+
+*/
+
+static void CalculateNormal(IPoint *ind,VECTOR *Normal)
+{
+    double val1X,val1Y,val3X,val3Y;
+    VECTOR a,b;
+
+    /* Get the point values from roughness matrix */
+
+    val1X=GetElement((ind->x-1),ind->y);
+    val1Y=GetElement(ind->x,(ind->y-1));
+    val3X=GetElement((ind->x+1),ind->y);
+    val3Y=GetElement(ind->x,(ind->y+1));
+
+    /* Calculate the vectors for the tanget plane */
+
+    a.k=(val1X-val3X)/2;
+    a.i=paper.PixelSize;
+    a.j=0.0;
+    b.k=(val1Y-val3Y)/2;
+    b.j=paper.PixelSize;
+    b.i=0.0;
+
+    /* Calculate the Normal vector of the surface */
+
+    (void)VectorCross(&a,&b,Normal);
+    VectorNorm(Normal);
+    return;
+}
+
+
+
+/**************************************************************
+
+    static void GetMapNormal(int x,int y,VECTOR *Normal)
+
+    Fetches the normal vector of index (x,y) from the normal map.
+
+*/
+
+static void GetMapNormal(int x,int y,VECTOR *Normal)
+{
+    FNormal *f;
+
+    if(paper.NormalType==PAPER_NORMAL_OCTAHEDRAL)
+        {
+        DecodeOctahedral((ONormal *)paper.Normal+y*paper.ISize.x+x,Normal);
+        return;
+        }
+    f=(FNormal *)paper.Normal+y*paper.ISize.x+x;
+    Normal->i=f->i;
+    Normal->j=f->j;
+    Normal->k=f->k;
+    return;
+}
+
+
+
+/**************************************************************
+
+    static void GetBilinearNormal(POINT *px,VECTOR *Normal)
+
+    Interpolates the normal vector of point px bilinearly from
+    the four nearest normals of the normal map.
+
+*/
+
+static void GetBilinearNormal(POINT *px,VECTOR *Normal)
+{
+    double u,v;
+    int    x0,y0,x1,y1;
+    VECTOR n00,n01,n10,n11;
+
+    u=px->x/paper.PixelSize;
+    v=px->y/paper.PixelSize;
+    x0=(int)floor(u);
+    y0=(int)floor(v);
+    u-=x0;
+    v-=y0;
+    x0=WrapIndex(x0,paper.ISize.x,paper.Mask.x);
+    y0=WrapIndex(y0,paper.ISize.y,paper.Mask.y);
+    x1=(x0+1<paper.ISize.x ? x0+1 : 0);
+    y1=(y0+1<paper.ISize.y ? y0+1 : 0);
+    GetMapNormal(x0,y0,&n00);
+    GetMapNormal(x0,y1,&n01);
+    GetMapNormal(x1,y0,&n10);
+    GetMapNormal(x1,y1,&n11);
+    Normal->i=(1.0-u)*((1.0-v)*n00.i+v*n01.i)+u*((1.0-v)*n10.i+v*n11.i);
+    Normal->j=(1.0-u)*((1.0-v)*n00.j+v*n01.j)+u*((1.0-v)*n10.j+v*n11.j);
+    Normal->k=(1.0-u)*((1.0-v)*n00.k+v*n01.k)+u*((1.0-v)*n10.k+v*n11.k);
+    VectorNorm(Normal);
+    return;
+}
+
+
+
+/**************************************************************
+
+    static void EncodeOctahedral(VECTOR *n,ONormal *o)
+
+    Stores the normalized vector n in octahedral coordinates.
+    The vector is projected to the octahedron |i|+|j|+|k|=1
+    and the lower half is folded over the upper one.
+
+*/
+
+static void EncodeOctahedral(VECTOR *n,ONormal *o)
+{
+    double u,v,sum,t;
+
+    sum=fabs(n->i)+fabs(n->j)+fabs(n->k);
+    u=n->i/sum;
+    v=n->j/sum;
+    if(n->k<0.0)
+        {
+        t=u;
+        u=(1.0-fabs(v))*(t>=0.0 ? 1.0 : -1.0);
+        v=(1.0-fabs(t))*(v>=0.0 ? 1.0 : -1.0);
+        }
+    o->u=(unsigned short)floor((u*0.5+0.5)*OCT_MAX+0.5);
+    o->v=(unsigned short)floor((v*0.5+0.5)*OCT_MAX+0.5);
+    return;
+}
+
+
+
+/**************************************************************
+
+    static void DecodeOctahedral(ONormal *o,VECTOR *n)
+
+    Returns the normalized vector of octahedral coordinates o.
+
+*/
+
+static void DecodeOctahedral(ONormal *o,VECTOR *n)
+{
+    double t;
+
+    n->i=o->u*(2.0/OCT_MAX)-1.0;
+    n->j=o->v*(2.0/OCT_MAX)-1.0;
+    n->k=1.0-fabs(n->i)-fabs(n->j);
+    if(n->k<0.0)
+        {
+        t=n->i;
+        n->i=(1.0-fabs(n->j))*(t>=0.0 ? 1.0 : -1.0);
+        n->j=(1.0-fabs(t))*(n->j>=0.0 ? 1.0 : -1.0);
+        }
+    VectorNorm(n);
+    return;
+}
+
+
+
+/**************************************************************
+
+    static void FreeNormalMap(void)
+
+    Frees the memory used by the normal map.
+
+*/
+
+static void FreeNormalMap(void)
+{
+    if(paper.NormalMem!=NULL)
+        BufferFree(paper.NormalMem);
+    paper.NormalMem=NULL;
+    paper.Normal=NULL;
+    paper.NormalType=PAPER_NORMAL_NONE;
+    paper.NormalBilinear=FALSE;
+    return;
+}
+
+
+
 /**************************************************************
 
     Logical GetRealPoint(*DPoint px,*IPoint ind)
 
     This function converts the actual point information
     to matrix index. The index is saved to second argument.
+    The point is rounded to the nearest pixel and the pixel
+    index is wrapped into the periodic matrix.
 
 */
 
 static void GetRealPoint(POINT *px,IPoint *ind)
 {
-    double dX,dY;
+    int x,y;
 
-    dX=Remainder(px->x/paper.DSize.x)*paper.DSize.x;
-    dY=Remainder(px->y/paper.DSize.y)*paper.DSize.y;
-    ind->x=Round(dX/paper.PixelSize);
-    ind->y=Round(dY/paper.PixelSize);
+    x=(int)Round(px->x/paper.PixelSize);
+    y=(int)Round(px->y/paper.PixelSize);
+    ind->x=WrapIndex(x,paper.ISize.x,paper.Mask.x);
+    ind->y=WrapIndex(y,paper.ISize.y,paper.Mask.y);
     return;
 }
 
@@ -666,17 +1274,35 @@ static void GetRealPoint(POINT *px,IPoint *ind)
 
 static void GetBetaPoint(POINT *px,IPoint *ind)
 {
-    double dX,dY;
+    int x,y;
 
-    dX=Remainder(px->x/paper.DBeta.x)*paper.DBeta.x;
-    dY=Remainder(px->y/paper.DBeta.y)*paper.DBeta.y;
-    ind->x=Round(dX/paper.PixelSize);
-    ind->y=Round(dY/paper.PixelSize);
+    x=(int)Round(px->x/paper.PixelSize);
+    y=(int)Round(px->y/paper.PixelSize);
+    ind->x=WrapIndex(x,paper.IBeta.x,paper.BetaMask.x);
+    ind->y=WrapIndex(y,paper.IBeta.y,paper.BetaMask.y);
     return;
 }
 
 
 
+/**************************************************************
+
+    static double GetSweepElement(int a,int b,Logical MainDirection)
+
+    Returns the roughness element at index a of the main direction
+    and b of the minor direction of the shadow sweep.
+
+*/
+
+static double GetSweepElement(int a,int b,Logical MainDirection)
+{
+    if(MainDirection==TRUE)
+        return GetElement(a,b);
+    return GetElement(b,a);
+}
+
+
+
 /**************************************************************
 
     Logical InitializeStructure(void)
@@ -712,8 +1338,20 @@ static Logical InitializeStructure(void)
     paper.IBeta.y=0;
     paper.DBeta.x=0.0;
     paper.DBeta.y=0.0;
+    paper.Mask.x=0;
+    paper.Mask.y=0;
+    paper.BetaMask.x=0;
+    paper.BetaMask.y=0;
     paper.Rough=NULL;
+    paper.Levels=0;
+    paper.MaxRough=NULL;
+    paper.MinRough=NULL;
     paper.Beta=NULL;
+    paper.Shadow=NULL;
+    paper.NormalType=PAPER_NORMAL_NONE;
+    paper.NormalBilinear=FALSE;
+    paper.NormalMem=NULL;
+    paper.Normal=NULL;
     return TRUE;
 }
 
@@ -773,7 +1411,7 @@ static Logical ReadRoughnessMatrix(cBuffer buf,int bSize,String PaperName)
                 FreeRoughnessMem();
                 return FALSE;
                 }
-            paper.Rough[x][y]=(RoughType)tmp;
+            paper.Rough[y*paper.ISize.x+x]=(RoughType)tmp;
             }
         }
     return TRUE;
@@ -785,19 +1423,15 @@ static Logical ReadRoughnessMatrix(cBuffer buf,int bSize,String PaperName)
 
     Logical AllocateRoughnessMem(PaperStruct *paper)
 
-    Allocates memory for a matrix
+    Allocates one block of memory for the matrix
 
 */
 
 static Logical AllocateRoughnessMem(void)
 {
-    int i;
-
-    paper.Rough=MemoryAllocate(RoughType*,paper.ISize.x);
+    paper.Rough=MemoryAllocate(RoughType,paper.ISize.x*paper.ISize.y);
     if(paper.Rough==NULL)
         return FALSE;
-    for(i=0;i<paper.ISize.x;i++)
-        paper.Rough[i]=MemoryAllocate(RoughType,paper.ISize.y);
     return TRUE;
 }
 
@@ -813,11 +1447,8 @@ static Logical AllocateRoughnessMem(void)
 
 static Logical FreeRoughnessMem(void)
 {
-    int       i;
-
-    for(i=0;i<paper.ISize.x;i++)
-        MemoryFree(paper.Rough[i]);
-    MemoryFree(paper.Rough);
+    if(paper.Rough!=NULL)
+        MemoryFree(paper.Rough);
     paper.Rough=NULL;
     paper.ISize.x=0;
     paper.ISize.y=0;
@@ -828,6 +1459,370 @@ static Logical FreeRoughnessMem(void)
 
 
 
+/**************************************************************
+
+    static Logical BuildPyramid(void)
+
+    Builds the height pyramid of the roughness matrix. An element
+    of level l is the max (MaxRough) or min (MinRough) of a block
+    of 2^l x 2^l roughness elements, made from 2 x 2 elements of
+    level l-1. The blocks on the last row and column are smaller
+    if the size is not a power of two. Level 0 is the roughness
+    matrix itself and is not stored.
+
+*/
+
+static Logical BuildPyramid(void)
+{
+    RoughType *smax,*smin,*dmax,*dmin,hi,lo;
+    int l,x,y,i,j,sx,sy,dx,dy,size=0;
+
+    FreePyramid();
+    for(l=1;l<=PYRAMID_LEVELS &&
+            (LevelSize(paper.ISize.x,l-1)>1 || LevelSize(paper.ISize.y,l-1)>1);l++)
+        {
+        paper.Level[l-1]=size;
+        size+=LevelSize(paper.ISize.x,l)*LevelSize(paper.ISize.y,l);
+        }
+    paper.Levels=l-1;
+    if(size==0)
+        return TRUE;
+    if((paper.MaxRough=MemoryAllocate(RoughType,(2*size)))==NULL)
+        {
+        paper.Levels=0;
+        return FALSE;
+        }
+    paper.MinRough=paper.MaxRough+size;
+
+    smax=smin=paper.Rough;
+    for(l=1;l<=paper.Levels;l++)
+        {
+        sx=LevelSize(paper.ISize.x,l-1);
+        sy=LevelSize(paper.ISize.y,l-1);
+        dx=LevelSize(paper.ISize.x,l);
+        dy=LevelSize(paper.ISize.y,l);
+        dmax=paper.MaxRough+paper.Level[l-1];
+        dmin=paper.MinRough+paper.Level[l-1];
+        for(y=0;y<dy;y++)
+            for(x=0;x<dx;x++)
+                {
+                hi=LOW_VALUE;
+                lo=HIGH_VALUE;
+                for(j=2*y;j<2*y+2 && j<sy;j++)
+                    for(i=2*x;i<2*x+2 && i<sx;i++)
+                        {
+                        if(smax[j*sx+i]>hi)
+                            hi=smax[j*sx+i];
+                        if(smin[j*sx+i]<lo)
+                            lo=smin[j*sx+i];
+                        }
+                dmax[y*dx+x]=hi;
+                dmin[y*dx+x]=lo;
+                }
+        smax=dmax;
+        smin=dmin;
+        }
+    return TRUE;
+}
+
+
+
+/**************************************************************
+
+    static void FreePyramid(void)
+
+    Frees the height pyramid.
+
+*/
+
+static void FreePyramid(void)
+{
+    if(paper.MaxRough!=NULL)
+        MemoryFree(paper.MaxRough);
+    paper.MaxRough=NULL;
+    paper.MinRough=NULL;
+    paper.Levels=0;
+    return;
+}
+
+
+
+/**************************************************************
+
+    static int MarchRay(VECTOR *V,POINT *px,Logical Last,POINT *hit)
+
+    Follows the ray from point px to direction V in steps of one
+    pixel in the main direction until the ray is above the
+    highest point of the matrix. Returns the first step where the ray is
+    below the surface, or the last one if Last is TRUE, and 0 if
+    there is none. The point of that step is stored to hit if it
+    is not NULL.
+
+    The steps are those of a pixel by pixel march, but a run of
+    steps in one block of the height pyramid is skipped if the
+    block is below the ray and taken at once if it is above the
+    ray. Blocks are tried after PYRAMID_MISSES single steps and
+    get larger after every skip, so long empty stretches are
+    crossed in a few lookups while short rays are stepped. A ray
+    that does not rise is followed once around the matrix.
+
+    V has to be normalized and not vertical.
+
+*/
+
+static int MarchRay(VECTOR *V,POINT *px,Logical Last,POINT *hit)
+{
+    RAY    ray;
+    IPoint ind;
+    double steps,lo,hi,h;
+    int    n,m,l,dir,wa,wb,x,y,i,miss;
+
+    ray.MainDirection=(fabs(V->i)<fabs(V->j)) ? FALSE : TRUE;
+    if(ray.MainDirection==TRUE)
+        {
+        ray.na=paper.ISize.x;
+        ray.nb=paper.ISize.y;
+        ray.ma=paper.Mask.x;
+        ray.mb=paper.Mask.y;
+        ray.da=(V->i>0.0 ? 1 : -1);
+        ray.s=V->j/fabs(V->i);
+        ray.ia=(int)Round(px->x/paper.PixelSize);
+        ray.fb=px->y/paper.PixelSize;
+        }
+    else
+        {
+        ray.na=paper.ISize.y;
+        ray.nb=paper.ISize.x;
+        ray.ma=paper.Mask.y;
+        ray.mb=paper.Mask.x;
+        ray.da=(V->j>0.0 ? 1 : -1);
+        ray.s=V->i/fabs(V->j);
+        ray.ia=(int)Round(px->y/paper.PixelSize);
+        ray.fb=px->x/paper.PixelSize;
+        }
+    GetRealPoint(px,&ind);
+    ray.z=GetElement(ind.x,ind.y);
+    ray.c=V->k*paper.PixelSize*sqrt(1.0+ray.s*ray.s);
+
+    /* The ray is below the maximum roughness before step steps */
+
+    h=(paper.Levels>0 ? GetHeight(paper.MaxRough[paper.Level[paper.Levels-1]])
+                      : GetMaxRange());
+    if(ray.c>0.0)
+        {
+        steps=ceil((h-ray.z)/ray.c)-1.0;
+        ray.steps=(steps<(double)(INT_MAX/2) ? (int)steps : INT_MAX/2);
+        }
+    else
+        ray.steps=ray.na;
+
+    /* The level goes up after a skipped run and down when the
+       block is neither below nor above the ray. Single pixels
+       are stepped a few times before trying a block again */
+
+    dir=(Last==TRUE ? -1 : 1);
+    n=(Last==TRUE ? ray.steps : 1);
+    l=0;
+    miss=0;
+    while(n>=1 && n<=ray.steps)
+        {
+        RayIndex(&ray,n,&wa,&wb);
+        if(l==0)
+            {
+            h=(ray.MainDirection==TRUE ? GetElement(wa,wb) : GetElement(wb,wa));
+            if(ray.z+n*ray.c<h)
+                goto found;
+            n+=dir;
+            if(++miss>=PYRAMID_MISSES && paper.Levels>0)
+                {
+                l=1;
+                miss=0;
+                }
+            continue;
+            }
+        m=RunEnd(&ray,n,wa,wb,l,dir);
+        x=(ray.MainDirection==TRUE ? wa : wb)>>l;
+        y=(ray.MainDirection==TRUE ? wb : wa)>>l;
+        i=paper.Level[l-1]+y*LevelSize(paper.ISize.x,l)+x;
+        lo=ray.z+n*ray.c;
+        hi=ray.z+m*ray.c;
+        if(lo>hi)
+            {
+            h=lo;
+            lo=hi;
+            hi=h;
+            }
+        if(GetHeight(paper.MaxRough[i])<=lo)
+            {
+            n=m+dir;
+            if(l<paper.Levels)
+                l++;
+            }
+        else if(GetHeight(paper.MinRough[i])>hi)
+            goto found;
+        else
+            l--;
+        }
+    return 0;
+
+found:
+    if(hit!=NULL)
+        {
+        RayIndex(&ray,n,&wa,&wb);
+        if(ray.MainDirection==TRUE)
+            {
+            hit->x=px->x+n*ray.da*paper.PixelSize;
+            hit->y=px->y+n*ray.s*paper.PixelSize;
+            hit->z=GetElement(wa,wb);
+            }
+        else
+            {
+            hit->y=px->y+n*ray.da*paper.PixelSize;
+            hit->x=px->x+n*ray.s*paper.PixelSize;
+            hit->z=GetElement(wb,wa);
+            }
+        }
+    return n;
+}
+
+
+
+/**************************************************************
+
+    static void RayIndex(RAY *ray,int n,int *wa,int *wb)
+
+    Stores the matrix index of step n of the ray in the main
+    direction to wa and in the minor direction to wb.
+
+*/
+
+static void RayIndex(RAY *ray,int n,int *wa,int *wb)
+{
+    int a,b;
+
+    a=ray->ia+n*ray->da;
+    b=(int)Round(ray->fb+n*ray->s);
+    *wa=WrapIndex(a,ray->na,ray->ma);
+    *wb=WrapIndex(b,ray->nb,ray->mb);
+    return;
+}
+
+
+
+/**************************************************************
+
+    static int RunEnd(RAY *ray,int n,int wa,int wb,int l,int dir)
+
+    Returns the last step of the run from step n to direction dir
+    (1 or -1) that stays in the same block of level l of the
+    height pyramid as step n and in steps 1..ray->steps. The
+    matrix index of step n is wa,wb as given by RayIndex().
+
+*/
+
+static int RunEnd(RAY *ray,int n,int wa,int wb,int l,int dir)
+{
+    int start,end,m,b,lo,hi;
+    double k;
+
+    /* Main direction moves one index a step */
+
+    if((1<<l)>=ray->na)
+        m=(dir>0 ? ray->steps : 1);
+    else
+        {
+        start=(wa>>l)<<l;
+        end=(start+(1<<l)<ray->na ? start+(1<<l) : ray->na);
+        m=n+dir*(ray->da*dir>0 ? end-1-wa : wa-start);
+        }
+    if(m<1)
+        m=1;
+    if(m>ray->steps)
+        m=ray->steps;
+    if((1<<l)>=ray->nb || ray->s==0.0)
+        return m;
+
+    /* Minor direction index has to stay in lo..hi */
+
+    start=(wb>>l)<<l;
+    end=(start+(1<<l)<ray->nb ? start+(1<<l) : ray->nb);
+    b=(int)Round(ray->fb+n*ray->s);
+    lo=b-(wb-start);
+    hi=b+(end-1-wb);
+    k=Round(ray->fb+m*ray->s);
+    if(k>=(double)lo && k<=(double)hi)
+        return m;
+    k=((ray->s*dir>0.0 ? hi+0.5 : lo-0.5)-ray->fb)/ray->s;
+    if(dir>0 && k<(double)m)
+        m=(k>(double)n ? (int)floor(k) : n);
+    if(dir<0 && k>(double)m)
+        m=(k<(double)n ? (int)ceil(k) : n);
+    while(m!=n)
+        {
+        b=(int)Round(ray->fb+m*ray->s);
+        if(b>=lo && b<=hi)
+            break;
+        m-=dir;
+        }
+    return m;
+}
+
+
+
+/**************************************************************
+
+    static int GetPeriod(int size,double DotSize)
+
+    Returns the smallest number of dots of size DotSize that is
+    a whole number of periods of size matrix pixels, or 0 if it
+    is not found in PERIOD_TRIES periods.
+
+*/
+
+static int GetPeriod(int size,double DotSize)
+{
+    double p;
+    int k;
+
+    for(k=1;k<=PERIOD_TRIES;k++)
+        {
+        p=k*size*paper.PixelSize/DotSize;
+        if(p>=1.0 && p<(double)INT_MAX && fabs(p-Round(p))<=PERIOD_EPS*p)
+            return (int)Round(p);
+        }
+    return 0;
+}
+
+
+
+/**************************************************************
+
+    static int CommonPeriod(int a,int b)
+
+    Returns the least common multiple of the periods a and b,
+    or 0 if either is 0 or it is too large.
+
+*/
+
+static int CommonPeriod(int a,int b)
+{
+    int x=a,y=b,t;
+
+    if(a<=0 || b<=0)
+        return 0;
+    while(y!=0)
+        {
+        t=x%y;
+        x=y;
+        y=t;
+        }
+    if(a/x>INT_MAX/b)
+        return 0;
+    return a/x*b;
+}
+
+
+
 /**************************************************************
 
     static Logical ReadBetaMatrix(cBuffer buf,int bSize,
@@ -861,7 +1856,7 @@ static Logical ReadBetaMatrix(cBuffer buf,int bSize,String PaperName)
                 FreeBetaMem();
                 return FALSE;
                 }
-            paper.Beta[x][y]=(BetaType)tmp;
+            paper.Beta[y*paper.IBeta.x+x]=(BetaType)tmp;
             }
         }
     return TRUE;
@@ -873,19 +1868,15 @@ static Logical ReadBetaMatrix(cBuffer buf,int bSize,String PaperName)
 
     static Logical AllocateBetaMem(void)
 
-    Allocates memory for a matrix
+    Allocates one block of memory for the matrix
 
 */
 
 static Logical AllocateBetaMem(void)
 {
-    int i;
-
-    paper.Beta=MemoryAllocate(BetaType*,paper.IBeta.x);
+    paper.Beta=MemoryAllocate(BetaType,paper.IBeta.x*paper.IBeta.y);
     if(paper.Beta==NULL)
         return FALSE;
-    for(i=0;i<paper.IBeta.x;i++)
-        paper.Beta[i]=MemoryAllocate(BetaType,paper.IBeta.y);
     return TRUE;
 }
 
@@ -901,11 +1892,8 @@ static Logical AllocateBetaMem(void)
 
 static Logical FreeBetaMem(void)
 {
-    int       i;
-
-    for(i=0;i<paper.IBeta.x;i++)
-        MemoryFree(paper.Beta[i]);
-    MemoryFree(paper.Beta);
+    if(paper.Beta!=NULL)
+        MemoryFree(paper.Beta);
     paper.Beta=NULL;
     paper.IBeta.x=0;
     paper.IBeta.y=0;
@@ -23,12 +23,22 @@
 #include "vector.h"
 
 
+/* Types of the normal map */
+
+#define PAPER_NORMAL_NONE       0  /* Normals are calculated for each pixel */
+#define PAPER_NORMAL_FLOAT      1  /* Three floats for each normal */
+#define PAPER_NORMAL_OCTAHEDRAL 2  /* Two 16 bit octahedral coordinates */
+
+
 Logical PaperInit(String);
 Logical PaperExit(void);
+Logical PaperNormalMapInit(int,double,Logical);
 
 Logical PaperGetNormalVector(VECTOR *,POINT *);
 Logical PaperHiddenPixel(VECTOR *,POINT *,POINT *);
 Logical PaperSelfShadow(VECTOR *,POINT *);
+Logical PaperShadowInit(VECTOR *);
+void PaperShadowExit(void);
 Logical PaperContact(POINT *);
 
 ColorType PaperGetSpecular(void);
@@ -36,6 +46,12 @@ ColorType PaperGetDiffuse(void);
 ColorType PaperGetAmbient(void);
 
 double PaperGetSpecularBeta(POINT *);
+Logical PaperHasBetaMatrix(void);
+Logical PaperGetPeriod(double,int *,int *);
+unsigned long PaperGeometryKey(void);
+int PaperTexels(void);
+int PaperTexel(POINT *);
+Logical PaperTexelPoint(int,POINT *);
 double PaperGetSpecularScale(void);
 
 double PaperRoughness(POINT *);
@@ -15,6 +15,8 @@
 
 
 
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include "defs.h"
 #include "c_types.h"
@@ -24,7 +26,9 @@
 #include "paper.h"
 #include "ink.h"
 #include "light.h"
+#include "color.h"
 #include "access.h"
+#include "fileio.h"
 #include "message.h"
 
 
@@ -33,17 +37,36 @@
 
 /* structure and type definitions */
 
+#define MAX_VIEWS 32    /* View angles in the -V list */
+#define SWEEP_LINES 16  /* First size of the ink sweep table */
+
 typedef struct {
         double  sizeX,sizeY;  /* Size in millimeters */
         double  DotSize;      /* Resolution, size of pixel (um) */
-        double  ViewDirection;/* The view angle */
+        double  ViewDirection[MAX_VIEWS]; /* The view angles */
+        int     Views;        /* Number of view angles */
         int     PixX,PixY;    /* Size of the picture in pixels */
+        u_long  Pixels;       /* and the number of pixels */
         int     IllumModel;   /* Illumination model (PHONG/BLINN) */
         String  name;         /* Name of the picture file */
         String  light;        /* Name of the light file */
         String  paper;        /* Name of the paper file */
         String  ink;          /* Name of the ink file */
+        String  sweep;        /* Name of the ink sweep file */
+        Logical Statistics;   /* TRUE if only the sweep statistics */
+        double *Sweep;        /* Ink coefficients of the sweep, */
+        int     Sweeps;       /* three for each picture */
         Logical UseInk;       /* TRUE if ink is used */
+        int     Threads;      /* Number of render threads */
+        int     NormalMap;    /* Type of the paper normal map */
+        Logical Bilinear;     /* TRUE if the normals are interpolated */
+        Logical Linear;       /* TRUE if linear shading is used */
+        Logical GBuffer;      /* TRUE if the geometry is kept */
+        Logical Texture;      /* TRUE if the paper is shaded per texel */
+        int     Compression;  /* Compression scheme of the files */
+        int     TileSize;     /* Tile size of the files, 0 strips */
+        int     Sampling;     /* Spectral sampling method */
+        int     SampleStep;   /* and the width of samples (nm) */
         TIFF   *tif;          /* Pointer to TIFF structure */
         } PictureStruct;
 
@@ -66,6 +89,11 @@ static Logical init=FALSE;
 /* Internal functions */
 
 static String CheckExtension(String,String);
+static String CheckListExtension(String,String);
+static String PictureFileName(int,int,int);
+static String LightBaseName(int,int *);
+static int ReadSweep(void);
+static Logical SweepStatistics(void);
 
 static Logical InitExtStruct(void);
 static void    ExitExtStruct(void);
@@ -92,12 +120,27 @@ Logical PictureInit(void)
     picture.sizeX=PICTURE_X_SIZE;
     picture.sizeY=PICTURE_Y_SIZE;
     picture.DotSize=DOT_SIZE;
-    picture.ViewDirection=PICTURE_VIEW_DIRECTION;
+    picture.ViewDirection[0]=PICTURE_VIEW_DIRECTION;
+    picture.Views=1;
     picture.IllumModel=PHONG;
     picture.UseInk=FALSE;
+    picture.Threads=RENDER_THREADS;
+    picture.NormalMap=PAPER_NORMAL_FLOAT;
+    picture.Bilinear=FALSE;
+    picture.Linear=FALSE;
+    picture.GBuffer=FALSE;
+    picture.Texture=FALSE;
+    picture.Compression=COMPRESSION_NONE;
+    picture.TileSize=0;
+    picture.Sampling=COLOR_SAMPLE_NM;
+    picture.SampleStep=1;
     picture.paper=CheckExtension(PAPER_FILE,PAPER_EXTENSION);
     picture.ink=CheckExtension(INK_FILE,INK_EXTENSION);
     picture.light=CheckExtension(LIGHT_FILE,LIGHT_EXTENSION);
+    picture.sweep=NULL;
+    picture.Statistics=FALSE;
+    picture.Sweep=NULL;
+    picture.Sweeps=1;
     picture.name=CheckExtension(PICTURE_FILE,PICTURE_EXTENSION);;
     picture.tif=NULL;
     return TRUE;
@@ -139,6 +182,12 @@ Logical PictureExit(void)
         MemoryFree(picture.light);
         picture.light=NULL;
         }
+    if(picture.sweep!=NULL)
+        {
+        MemoryFree(picture.sweep);
+        picture.sweep=NULL;
+        }
+    RenderExit();
     return TRUE;
 }
 
@@ -148,7 +197,18 @@ Logical PictureExit(void)
 
     Logical PictureCreate(void)
 
-    This function creates and renders a picture file.
+    This function creates and renders a picture file. With a
+    list of lights or view angles a picture is made for each
+    illuminant and view angle, named by PictureFileName(). The
+    paper, ink and light files are read once for all of them.
+    Up to RENDER_MAX_LIGHTS illuminants are shaded in one render
+    pass from the same geometry, and the pictures of the others
+    are written after the first one.
+
+    With an ink sweep file a picture is made for each set of
+    ink coefficients of the file, shaded from the geometry
+    buffer, or with PictureSweepStatistics() only the ink
+    transfer statistics are printed.
 
 */
 
@@ -156,33 +216,90 @@ Logical PictureCreate(void)
 {
     double Resolution=RESOLUTION;
     RenderType pic;
+    String  name=NULL;
+    int     n,m,k,lights;
 
     if(init==FALSE)
         return FALSE;
     if(InitExtStruct()!=TRUE)
         goto error;
     Resolution=INCH*MICROMETER/picture.DotSize;
-    if((picture.tif=OpenForWriting(picture.name,RGB,picture.PixX,
-                                   picture.PixY,Resolution))==NULL)
-        goto error;
+    lights=LightCount();
+    if(picture.sweep!=NULL && picture.UseInk==TRUE)
+        {
+        if((picture.Sweeps=ReadSweep())<=0)
+            goto error;
+        if(picture.Statistics==TRUE)
+            {
+            if(SweepStatistics()==FALSE)
+                goto error;
+            MemoryFree(picture.Sweep);
+            picture.Sweep=NULL;
+            picture.Sweeps=1;
+            ExitExtStruct();
+            return TRUE;
+            }
+        }
 
-    /* Making of the picture */
+    /* Making of the pictures */
 
-    pic.Name=picture.name;
-    pic.Tif=picture.tif;
     pic.PixelSize=picture.DotSize;
     pic.X=picture.PixX;
     pic.Y=picture.PixY;
+    pic.Pixels=picture.Pixels;
     pic.Model=picture.IllumModel;
     pic.UseInk=picture.UseInk;
-    pic.ViewDir=picture.ViewDirection;
-
-    if(RenderImage(pic)==FALSE)
-        goto error;
-
+    pic.Threads=picture.Threads;
+    pic.Linear=picture.Linear;
+    pic.Texture=picture.Texture;
+    pic.GBuffer=(picture.GBuffer==TRUE || picture.Sweeps>1) ? TRUE : FALSE;
+    SetCompression(picture.Compression);
+    SetTileSize((u_long) picture.TileSize);
+
+    for(m=0;m<picture.Views;m++)
+        {
+        pic.ViewDir=picture.ViewDirection[m]*M_PI/180;
+        for(k=0;k<picture.Sweeps;k++)
+            {
+            for(n=0;n<lights;n++)
+                {
+                if(lights==1 && picture.Views==1 && picture.Sweeps==1)
+                    name=picture.name;
+                else if((name=PictureFileName(n,m,k))==NULL)
+                    goto error;
+                if(LightSelect(n)==FALSE)
+                    goto error;
+                pic.Light=n;
+                pic.Lights=0;
+                if(n%RENDER_MAX_LIGHTS==0)
+                    pic.Lights=(lights-n<RENDER_MAX_LIGHTS) ?
+                               lights-n : RENDER_MAX_LIGHTS;
+                if(picture.Sweep!=NULL)
+                    (void)InkSetCoefficients(picture.Sweep[3*k],
+                                             picture.Sweep[3*k+1],
+                                             picture.Sweep[3*k+2]);
+                if((picture.tif=OpenForWriting(name,RGB,picture.PixX,
+                                               picture.PixY,Resolution))==NULL)
+                    goto error;
+                pic.Name=name;
+                pic.Tif=picture.tif;
+                if(RenderImage(pic)==FALSE)
+                    goto error;
+                CloseImage(picture.tif);
+                picture.tif=NULL;
+                if(name!=picture.name)
+                    MemoryFree(name);
+                name=NULL;
+                }
+            }
+        }
 
-    CloseImage(picture.tif);
-    picture.tif=NULL;
+    if(picture.Sweep!=NULL)
+        MemoryFree(picture.Sweep);
+    picture.Sweep=NULL;
+    picture.Sweeps=1;
+    if(picture.GBuffer==FALSE)
+        RenderExit();
     ExitExtStruct();
     return TRUE;
 
@@ -192,6 +309,14 @@ error:
         CloseImage(picture.tif);
         picture.tif=NULL;
         }
+    if(name!=NULL && name!=picture.name)
+        MemoryFree(name);
+    if(picture.Sweep!=NULL)
+        MemoryFree(picture.Sweep);
+    picture.Sweep=NULL;
+    picture.Sweeps=1;
+    if(picture.GBuffer==FALSE)
+        RenderExit();
     ExitExtStruct();
     MessageWarning("Can't initialize picture");
     return FALSE;
@@ -239,7 +364,7 @@ Logical PictureChangeName(String name,int mode)
                 MemoryFree(picture.light);
                 picture.light=NULL;
                 }
-            picture.light=CheckExtension(name,LIGHT_EXTENSION);
+            picture.light=CheckListExtension(name,LIGHT_EXTENSION);
             break;
         case PICTURE:
             if(picture.name!=NULL)
@@ -358,7 +483,276 @@ Logical PictureViewDirection(double angle)
         return FALSE;
     if(angle>MAX_VIEW_DIR || angle<-MAX_VIEW_DIR)
         return FALSE;
-    picture.ViewDirection=angle*M_PI/180;
+    picture.ViewDirection[0]=angle;
+    picture.Views=1;
+    return TRUE;
+}
+
+
+
+/**************************************************************
+
+    Logical PictureViewList(String angles)
+
+    Sets the view directions from a list of angles separated by
+    commas. A picture is made for each view direction, one after
+    another; only the paper and ink precomputation is shared.
+
+*/
+
+Logical PictureViewList(String angles)
+{
+    double angle[MAX_VIEWS];
+    int    n=0;
+
+    if(init==FALSE || angles==NULL)
+        return FALSE;
+    while(n<MAX_VIEWS)
+        {
+        angle[n]=atof(angles);
+        if(angle[n]>MAX_VIEW_DIR || angle[n]<-MAX_VIEW_DIR)
+            return FALSE;
+        n++;
+        if((angles=strchr(angles,','))==NULL)
+            break;
+        angles++;
+        }
+    if(angles!=NULL)
+        return FALSE;
+    for(picture.Views=0;picture.Views<n;picture.Views++)
+        picture.ViewDirection[picture.Views]=angle[picture.Views];
+    return TRUE;
+}
+
+
+
+/**************************************************************
+
+    Logical PictureThreads(int threads)
+
+    Sets the number of threads used in rendering
+
+*/
+
+Logical PictureThreads(int threads)
+{
+    if(init==FALSE)
+        return FALSE;
+    if(threads<1 || threads>RENDER_MAX_THREADS)
+        return FALSE;
+    picture.Threads=threads;
+    return TRUE;
+}
+
+
+
+/**************************************************************
+
+    Logical PictureNormalMap(String type)
+
+    Selects the type of the paper normal map, 'n' for none,
+    'f' for floats and 'o' for octahedral coordinates. A 'b'
+    after the map type interpolates the normals of the map
+    bilinearly.
+
+*/
+
+Logical PictureNormalMap(String type)
+{
+    if(init==FALSE || type==NULL)
+        return FALSE;
+    switch(type[0])
+        {
+        case 'n':
+            picture.NormalMap=PAPER_NORMAL_NONE;
+            break;
+        case 'f':
+            picture.NormalMap=PAPER_NORMAL_FLOAT;
+            break;
+        case 'o':
+            picture.NormalMap=PAPER_NORMAL_OCTAHEDRAL;
+            break;
+        default:
+            return FALSE;
+        }
+    if(type[1]=='b' && type[2]=='\0' &&
+       picture.NormalMap!=PAPER_NORMAL_NONE)
+        picture.Bilinear=TRUE;
+    else if(type[1]=='\0')
+        picture.Bilinear=FALSE;
+    else
+        return FALSE;
+    return TRUE;
+}
+
+
+
+/**************************************************************
+
+    Logical PictureLinearShading(void)
+
+    Enables the linear shading mode, where the pixel color is
+    summed from spectral products converted to XYZ once.
+
+*/
+
+Logical PictureLinearShading(void)
+{
+    if(init==FALSE)
+        return FALSE;
+    picture.Linear=TRUE;
+    return TRUE;
+}
+
+
+
+/**************************************************************
+
+    Logical PictureGeometryBuffer(void)
+
+    Keeps the geometry of the pictures in a geometry buffer, so
+    a picture that differs from the previous one only by the
+    spectra or the illumination model is shaded from it.
+
+*/
+
+Logical PictureGeometryBuffer(void)
+{
+    if(init==FALSE)
+        return FALSE;
+    picture.GBuffer=TRUE;
+    return TRUE;
+}
+
+
+
+/**************************************************************
+
+    Logical PictureTextureShading(void)
+
+    Enables the texture space shading, where the paper is shaded
+    once for each pixel of the roughness matrix and the picture
+    pixels fetch the color of the nearest paper pixel to the
+    point they see. It is exact only if they all see a paper
+    grid point, see RenderImage().
+
+*/
+
+Logical PictureTextureShading(void)
+{
+    if(init==FALSE)
+        return FALSE;
+    picture.Texture=TRUE;
+    return TRUE;
+}
+
+
+
+/**************************************************************
+
+    Logical PictureCompression(String type)
+
+    Selects the compression of the picture files, 'n' for none,
+    'p' for PackBits and 'l' for LZW with horizontal differencing.
+
+*/
+
+Logical PictureCompression(String type)
+{
+    if(init==FALSE || type==NULL)
+        return FALSE;
+    switch(type[0])
+        {
+        case 'n':
+            picture.Compression=COMPRESSION_NONE;
+            break;
+        case 'p':
+            picture.Compression=COMPRESSION_PACKBITS;
+            break;
+        case 'l':
+            picture.Compression=COMPRESSION_LZW;
+            break;
+        default:
+            return FALSE;
+        }
+    return TRUE;
+}
+
+
+
+/**************************************************************
+
+    Logical PictureTileSize(int size)
+
+    Saves the picture files in tiles of size x size pixels,
+    which are written as soon as they are rendered. The size
+    must be a multiple of 16, 0 saves the files in strips.
+
+*/
+
+Logical PictureTileSize(int size)
+{
+    if(init==FALSE)
+        return FALSE;
+    if(size<0 || size%16!=0)
+        return FALSE;
+    picture.TileSize=size;
+    return TRUE;
+}
+
+
+
+/**************************************************************
+
+    Logical PictureInkSweep(String name,Logical statistics)
+
+    Sets the ink sweep file. Each line of the file has the
+    splitting, deposition and absorption coefficients of one
+    picture. If statistics is TRUE no pictures are made, but
+    the ink transfer statistics of each line are printed.
+
+*/
+
+Logical PictureInkSweep(String name,Logical statistics)
+{
+    if(init==FALSE || name==NULL)
+        return FALSE;
+    if(picture.sweep!=NULL)
+        MemoryFree(picture.sweep);
+    if((picture.sweep=MemoryAllocate(char,(strlen(name)+1)))==NULL)
+        return FALSE;
+    strcpy(picture.sweep,name);
+    picture.Statistics=statistics;
+    return TRUE;
+}
+
+
+
+/**************************************************************
+
+    Logical PictureSpectralSampling(String type)
+
+    Selects the spectral sampling, 'm' for the 4 samples of
+    Meyer or the width of a sample in nanometers. Widths over
+    one use the box samples of Hall.
+
+*/
+
+Logical PictureSpectralSampling(String type)
+{
+    int step;
+
+    if(init==FALSE || type==NULL)
+        return FALSE;
+    if(type[0]=='m')
+        {
+        picture.Sampling=COLOR_SAMPLE_MEYER;
+        return TRUE;
+        }
+    if((step=atoi(type))<1 || step>MAX_WAWE_LENGTH-MIN_WAWE_LENGTH)
+        return FALSE;
+    picture.Sampling=(step==1) ? COLOR_SAMPLE_NM : COLOR_SAMPLE_HALL;
+    picture.SampleStep=step;
     return TRUE;
 }
 
@@ -397,10 +791,13 @@ double PictureGetDotSize(void)
 
 static Logical InitExtStruct(void)
 {
-    if(ColorInit()==FALSE)
+    if(ColorInit(picture.Sampling,picture.SampleStep)==FALSE)
         return FALSE;
     if(PaperInit(picture.paper)==FALSE)
         return FALSE;
+    if(PaperNormalMapInit(picture.NormalMap,picture.DotSize,
+                          picture.Bilinear)==FALSE)
+        return FALSE;
     if(picture.UseInk==TRUE)
         if(InkInit(picture.ink)==FALSE)
             return FALSE;
@@ -410,6 +807,7 @@ static Logical InitExtStruct(void)
     /* size of the picture in pixels */
     picture.PixX=(int)(picture.sizeX*(MICROMETER/picture.DotSize));
     picture.PixY=(int)(picture.sizeY*(MICROMETER/picture.DotSize));
+    picture.Pixels=(u_long) picture.PixX*picture.PixY;
     return TRUE;
 }
 
@@ -467,3 +865,249 @@ static String CheckExtension(String name,String ext)
 }
 
 
+
+/**************************************************************
+
+    static String CheckListExtension(String names,String ext)
+
+    Checks the extension of each file name of a list separated
+    by commas, like CheckExtension(), and returns the list of
+    the checked names.
+
+*/
+
+static String CheckListExtension(String names,String ext)
+{
+    String  str=NULL,part,item,checked;
+    int     i=0,n=1;
+
+    while(names[i]!='\0')
+        if(names[i++]==',')
+            n++;
+    str=MemoryAllocate(char,(strlen(names)+n*strlen(ext)+1));
+    if(str==NULL)
+        return NULL;
+    str[0]='\0';
+    if((part=MemoryAllocate(char,(strlen(names)+1)))==NULL)
+        {
+        MemoryFree(str);
+        return NULL;
+        }
+    strcpy(part,names);
+    for(item=strtok(part,",");item!=NULL;item=strtok(NULL,","))
+        {
+        if((checked=CheckExtension(item,ext))==NULL)
+            break;
+        if(str[0]!='\0')
+            strcat(str,",");
+        strcat(str,checked);
+        MemoryFree(checked);
+        }
+    MemoryFree(part);
+    return str;
+}
+
+
+
+/**************************************************************
+
+    static String PictureFileName(int n,int m,int k)
+
+    Returns the name of the picture file of the illuminant n of
+    the light list, the view angle m of the view list and the
+    line k of the ink sweep. The base name of the light file is
+    added to the picture name if there are many lights, the
+    view angle if there are many angles and the line number if
+    there are many lines. So with lights 'd65.l,a.l' the picture
+    'proof.tif' is saved to 'proof_d65.tif' and 'proof_a.tif',
+    with the angles '0,45' to 'proof_V0.tif' and 'proof_V45.tif'
+    and with two ink sweep lines to 'proof_k1.tif' and
+    'proof_k2.tif'. If the base name of the light file is the
+    same as that of another light of the list, the number of
+    the light is added to it, so the lights 'a/d65.l,b/d65.l'
+    give 'proof_d65_1.tif' and 'proof_d65_2.tif'.
+
+*/
+
+static String PictureFileName(int n,int m,int k)
+{
+    String  str,light=NULL,other,ext;
+    char    view[96];
+    int     len,olen,pos,i;
+
+    view[0]='\0';
+    len=0;
+    if(LightCount()>1)
+        {
+        if((light=LightBaseName(n,&len))==NULL)
+            return NULL;
+        for(i=0;i<LightCount();i++)
+            if(i!=n && (other=LightBaseName(i,&olen))!=NULL &&
+               olen==len && strncmp(other,light,len)==0)
+                {
+                sprintf(view,"_%d",n+1);
+                break;
+                }
+        }
+    if(picture.Views>1)
+        sprintf(view+strlen(view),"_V%g",picture.ViewDirection[m]);
+    if(picture.Sweeps>1)
+        sprintf(view+strlen(view),"_k%d",k+1);
+
+    if((ext=strrchr(picture.name,'.'))==NULL ||
+       strchr(ext,'/')!=NULL)
+        ext=picture.name+strlen(picture.name);
+    str=MemoryAllocate(char,(strlen(picture.name)+len+strlen(view)+2));
+    if(str==NULL)
+        return NULL;
+    pos=ext-picture.name;
+    strncpy(str,picture.name,pos);
+    if(len>0)
+        {
+        str[pos++]='_';
+        strncpy(str+pos,light,len);
+        pos+=len;
+        }
+    strcpy(str+pos,view);
+    strcat(str,ext);
+    return str;
+}
+
+
+
+/**************************************************************
+
+    static String LightBaseName(int n,int *len)
+
+    Returns the base name of the light file n of the light list,
+    without the directory and the extension, and its length to
+    len. The name is not terminated. Returns NULL if there is
+    no light n.
+
+*/
+
+static String LightBaseName(int n,int *len)
+{
+    String  str,light,end;
+
+    light=picture.light;
+    while(n-->0 && light!=NULL)
+        if((light=strchr(light,','))!=NULL)
+            light++;
+    if(light==NULL)
+        return NULL;
+    if((end=strchr(light,','))==NULL)
+        end=light+strlen(light);
+    for(str=light;str<end;str++)
+        if(*str=='/')
+            light=str+1;
+    for(str=end;str>light;str--)
+        if(*str=='.')
+            {
+            end=str;
+            break;
+            }
+    *len=end-light;
+    return light;
+}
+
+
+
+/**************************************************************
+
+    static int ReadSweep(void)
+
+    Reads the ink coefficients of the ink sweep file to
+    picture.Sweep and returns the number of lines read, or
+    zero on error. Lines starting with '#' are comments.
+
+*/
+
+static int ReadSweep(void)
+{
+    cBuffer buf=NULL;
+    int     bSize=BUFFER_SIZE;
+    int     index,lines=0,size=0,i;
+    double  value[3],*sweep;
+
+    picture.Sweep=NULL;
+    if (FileIOOpen(picture.sweep,READ) == FALSE)
+        goto error;
+    if((buf=BufferAllocate(bSize))==NULL)
+        goto error;
+    while (FileIOReadLine(picture.sweep,buf,bSize)!=FALSE)
+        {
+        if(buf[0]=='#')
+            continue;
+        if((index=BufferReadDouble(buf,&value[0],0))<=0)
+            continue;       /* Empty line */
+        if((index=BufferReadDouble(buf,&value[1],index))<=0 ||
+           BufferReadDouble(buf,&value[2],index)<=0)
+            goto error;
+        if(lines==size)
+            {
+            size=(size==0) ? SWEEP_LINES : 2*size;
+            if((sweep=MemoryAllocate(double,(3*size)))==NULL)
+                goto error;
+            for(i=0;i<3*lines;i++)
+                sweep[i]=picture.Sweep[i];
+            if(picture.Sweep!=NULL)
+                MemoryFree(picture.Sweep);
+            picture.Sweep=sweep;
+            }
+        for(i=0;i<3;i++)
+            picture.Sweep[3*lines+i]=value[i];
+        lines++;
+        }
+    if(lines==0)
+        goto error;
+    (void)FileIOClose(picture.sweep);
+    BufferFree(buf);
+    return lines;
+
+error:
+    (void)FileIOClose(picture.sweep);
+    if(buf!=NULL)
+        BufferFree(buf);
+    if(picture.Sweep!=NULL)
+        MemoryFree(picture.Sweep);
+    picture.Sweep=NULL;
+    MessageWarning2("Can't read ink sweep file",picture.sweep);
+    return 0;
+}
+
+
+
+/**************************************************************
+
+    static Logical SweepStatistics(void)
+
+    Prints the ink transfer statistics of each line of the ink
+    sweep: the coefficients, the mean and maximum transfer and
+    the mean ink coverage. Only the transfer field is made, no
+    picture is rendered.
+
+*/
+
+static Logical SweepStatistics(void)
+{
+    char    line[BUFFER_SIZE];
+    double  mean,max,coverage,*k;
+    int     i;
+
+    if(InkFieldInit()==FALSE)
+        return FALSE;
+    MessagePrint("# splitting deposition absorption mean max coverage");
+    for(i=0;i<picture.Sweeps;i++)
+        {
+        k=picture.Sweep+3*i;
+        if(InkSetCoefficients(k[0],k[1],k[2])==FALSE ||
+           InkTransferStatistics(&mean,&max,&coverage)==FALSE)
+            return FALSE;
+        sprintf(line,"%g %g %g %g %g %g",k[0],k[1],k[2],mean,max,coverage);
+        MessagePrint(line);
+        }
+    return TRUE;
+}
+
+
@@ -35,6 +35,16 @@ Logical PictureChangeSize(double,double);
 Logical PictureIllumModel(int);
 Logical PictureUseInk(void);
 Logical PictureViewDirection(double);
+Logical PictureViewList(String);
+Logical PictureThreads(int);
+Logical PictureNormalMap(String);
+Logical PictureLinearShading(void);
+Logical PictureGeometryBuffer(void);
+Logical PictureTextureShading(void);
+Logical PictureCompression(String);
+Logical PictureTileSize(int);
+Logical PictureInkSweep(String,Logical);
+Logical PictureSpectralSampling(String);
 
 double PictureGetDotSize(void);
 
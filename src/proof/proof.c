@@ -41,7 +41,7 @@ String ProgramUsage;
 static Logical ReadOptionsFromFile=FALSE;
 
 /* Options which the program understands*/
-#define OPTIONS "fp:i:Il:t:o:x:y:d:PB?HV:"
+#define OPTIONS "fp:i:Il:t:o:x:y:d:PB?HV:j:n:Ls:gk:K:cz:T:"
 
 #define ERROR -1
 #define OK 0
@@ -206,8 +206,44 @@ static Logical AnalyzeOptions(int option_letter)
         case 'B':
             PictureIllumModel(BLINN);
             break;
-        case 'V':
-            PictureViewDirection(atof(optarg));
+        case 'V':       /* View angle or a list of them */
+            if(PictureViewList(optarg)==FALSE)
+                return FALSE;
+            break;
+        case 'j':       /* Number of render threads */
+            if(PictureThreads(atoi(optarg))==FALSE)
+                return FALSE;
+            break;
+        case 'n':       /* Type of the paper normal map */
+            if(PictureNormalMap(optarg)==FALSE)
+                return FALSE;
+            break;
+        case 'L':       /* Linear shading */
+            PictureLinearShading();
+            break;
+        case 's':       /* Spectral sampling */
+            if(PictureSpectralSampling(optarg)==FALSE)
+                return FALSE;
+            break;
+        case 'g':       /* Geometry buffer */
+            PictureGeometryBuffer();
+            break;
+        case 'c':       /* Texture space shading */
+            PictureTextureShading();
+            break;
+        case 'z':       /* Compression of the picture files */
+            if(PictureCompression(optarg)==FALSE)
+                return FALSE;
+            break;
+        case 'T':       /* Tile size of the picture files */
+            if(PictureTileSize(atoi(optarg))==FALSE)
+                return FALSE;
+            break;
+        case 'k':       /* Ink sweep */
+            PictureInkSweep(optarg,FALSE);
+            break;
+        case 'K':       /* Ink sweep statistics */
+            PictureInkSweep(optarg,TRUE);
             break;
         case 'H':
         case '?':
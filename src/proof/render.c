@@ -16,17 +16,23 @@
 
 
 #include <math.h>
+#include <string.h>
+#include <pthread.h>
 #include "c_types.h"
 #include "picture.h"
 #include "access.h"
 #include "message.h"
+#include "buffer.h"
 #include "vector.h"
 #include "mfacet.h"
 #include "color.h"
 #include "paper.h"
 #include "light.h"
 #include "ink.h"
+#include "spect.h"
 #include "render.h"
+#include "sched.h"
+#include "writer.h"
 
 
 
@@ -60,249 +66,1562 @@ typedef struct {
         } PICTURE;
 
 
+/* XYZ values of the spectral products a pixel color is made of,
+   used in the linear shading mode. With the Fresnel factor f the
+   Blinn reflectance is Specular+f*Fresnel, which is linear while
+   no sample is clipped to zero, that is for f in [MinFactor,
+   MaxFactor]. */
+
+typedef struct {
+        double Ambient[3];      /* lgt.Ambient*mtl.Ambient */
+        double Diffuse[3];      /* lgt.Specular*mtl.Diffuse */
+        double Specular[3];     /* lgt.Specular*mtl.Specular */
+        double Fresnel[3];      /* lgt.Specular*(1-mtl.Specular) */
+        double MinFactor;
+        double MaxFactor;
+        } BASIS;
+
+
+/* Render context. Everything a render thread writes while
+   shading a pixel is in here, so each thread has its own. */
+
+typedef struct {
+        MATERIAL mtl;
+        MATERIAL paper;     /* Paper and ink materials and the */
+        MATERIAL ink;       /* spectra for mixing them, used   */
+        ColorType specular; /* only when ink is rendered       */
+        ColorType diffuse;
+        ColorType ambient;
+        LIGHT lgt;
+        PICTURE pic;
+        Logical UseInk;
+        Logical Linear;     /* Shade with the XYZ basis below */
+        BASIS paperBasis;
+        BASIS inkBasis;
+        double light[3];    /* XYZ of lgt.Specular */
+        double papM;        /* Paper and ink weights of the */
+        double inkM;        /* mixed materials of the pixel */
+        Logical inked;      /* Ink specular material is used */
+        double absorption;  /* Ink absorption coefficient */
+        double conv;        /* Terms of the ink transfer of the */
+        double roughness;   /* pixel, see InkTransferTerms() */
+        } CONTEXT;
+
+
+/* Geometry of a pixel kept in the geometry buffer. The ink
+   transfer is kept as its terms, so the buffer serves any ink
+   coefficients. */
+
+typedef struct {
+        double Beta;        /* Specular beta of the seen point */
+        double Conv;        /* Ink transfer terms of the seen point */
+        double Roughness;
+        float Normal[3];    /* Normal of the seen point */
+        unsigned char Shadows;  /* Bit l is set if the seen point is
+                                   in self shadow of light l */
+        } GPIXEL;
+
+
+/* Geometry buffer of the last picture and what it was made of */
+
+typedef struct {
+        GPIXEL *Pixels;     /* Rows one after another */
+        Logical Valid;      /* All the pixels are made */
+        int X,Y;
+        double PixelSize;
+        double ViewDir;
+        int Lights;
+        VECTOR Light[RENDER_MAX_LIGHTS];
+        Logical UseInk;
+        unsigned long Paper;    /* PaperGeometryKey() */
+        unsigned long Ink;      /* InkGeometryKey() */
+        } GBUFFER;
+
+
+/* Pictures of the lights of a render pass after the first one.
+   They are shaded with the first one and kept until written. */
+
+typedef struct {
+        buffer_t Pixels;    /* RGB pictures one after another */
+        Logical Valid;      /* All the pixels are made */
+        int First;          /* First light of the pass */
+        int Lights;         /* Number of lights in the pass */
+        int X,Y;
+        } FRAMES;
+
+
+/* Read only data shared by all render threads. Light l of the
+   render pass is light first+l of the light list and is shaded
+   with render context l. */
+
+typedef struct scene {
+        RenderType *picture;
+        VECTOR light;       /* Direction of the first light */
+        int first;
+        int lights;         /* Lights shaded in one pass */
+        VECTOR lightDir[RENDER_MAX_LIGHTS];
+        buffer_t frames;    /* Pictures of the other lights or NULL */
+        VECTOR view;
+        double paperPower;  /* Specular powers for constant beta */
+        double inkPower;
+        double (*Power)(double);    /* Specular power of a beta */
+        GPIXEL *GBuffer;    /* Geometry buffer to fill or NULL */
+        RGBType *Texture;   /* Shaded paper texels or NULL */
+        void (*Span)(CONTEXT *,struct scene *,int,int,int,buffer_t);
+        void (*InkSpan)(CONTEXT *,struct scene *,int,int,int,buffer_t);
+        void (*PaperSpan)(CONTEXT *,struct scene *,int,int,int,buffer_t);
+        } SCENE;
+
+typedef void (*SPAN)(CONTEXT *,SCENE *,int,int,int,buffer_t);
+
+
+/* Tile queue for the render threads. The picture is divided to
+   bands of TILE_SIZE rows and each band to tiles of TILE_SIZE
+   columns. The tiles are shared to the threads by a work-stealing
+   scheduler and a band is written when all its tiles are ready. */
+
+typedef struct {
+        SCENE *scene;
+        SchedType sched;
+        pthread_mutex_t lock;
+        pthread_cond_t finished;    /* A band has been rendered */
+        buffer_t *rows;             /* Row buffers of the band slots */
+        int *left;                  /* Tiles left in a band slot */
+        int slots;                  /* Number of band slots */
+        int tiles;                  /* Tiles in one band */
+        int threads;
+        } QUEUE;
+
+typedef struct {
+        QUEUE *queue;
+        CONTEXT ctx[RENDER_MAX_LIGHTS];
+        int id;                     /* Worker number for the scheduler */
+        pthread_t thread;
+        } WORKER;
+
+
+/* Tiles of a tiled TIFF image. The tiles are given to the threads
+   by the scheduler, and each thread encodes and writes its tiles
+   as soon as they are ready. Only the writing is serialized. The
+   tiles of a mapped image are rendered straight to its rows. */
+
+typedef struct {
+        SCENE *scene;
+        SchedType sched;
+        buffer_t map;               /* Mapped rows of the file or NULL */
+        pthread_mutex_t lock;       /* Writing to the TIFF file */
+        int size;                   /* Tile width and height */
+        int tiles;                  /* Tiles in one tile row */
+        int done;                   /* Tiles written */
+        u_long code;                /* Encoded tile size, 0 if none */
+        coding_t coding;            /* Compression of the tiles */
+        Logical failed;             /* Writing a tile failed */
+        } TILES;
+
+typedef struct {
+        TILES *tiles;
+        CONTEXT ctx[RENDER_MAX_LIGHTS];
+        int id;
+        buffer_t row;               /* Row buffer of the picture width */
+        buffer_t tile;              /* Tile buffer */
+        buffer_t code;              /* Encoded tile or NULL */
+        pthread_t thread;
+        } TILER;
+
+#define TILE_SIZE 32            /* Tile width and height in pixels */
+#define CULL_SIZE 16            /* Pixels in an ink culling test */
+#define TILES_PER_THREAD 2      /* Tiles in work for each thread */
+#define WRITER_ROWS (2*TILE_SIZE)   /* Row buffers of the writer */
+
+
 /* Global variables for this file */
 
-static MATERIAL mtl={NULL,NULL,NULL,0.0,0.0,0.0};
-static MATERIAL *paper=NULL;
-static MATERIAL *ink=NULL;
-static LIGHT lgt={NULL,NULL};
-static PICTURE pic={NULL,NULL,0};
+static GBUFFER gbuffer={NULL,FALSE,0,0,0.0,0.0,0,{{0.0,0.0,0.0}},FALSE,0,0};
+static FRAMES frames={NULL,FALSE,0,0,0,0};
+
+
+/* Internal functions */
+
+static Logical InitContexts(CONTEXT *,SCENE *);
+static void ExitContexts(CONTEXT *,SCENE *);
+static void ClearContext(CONTEXT *);
+static Logical InitContext(CONTEXT *,Logical,Logical);
+static void ExitContext(CONTEXT *);
+static void ShareMaterial(CONTEXT *,CONTEXT *);
+static Logical InitBasis(CONTEXT *,BASIS *,ColorType,ColorType,ColorType);
+
+static void SelectSpan(SCENE *);
+static void CullSpan(CONTEXT *,SCENE *,int,int,int,buffer_t);
+static void ShadeSpan(CONTEXT *,SCENE *,int,int,int,buffer_t);
+static void TextureSpan(CONTEXT *,SCENE *,int,int,int,buffer_t);
+static void FrameSpan(CONTEXT *,SCENE *,int,int,int,buffer_t);
+static int ShadeLights(CONTEXT *,SCENE *,VECTOR *,POINT *,int,u_long);
+static Logical LightDirections(SCENE *);
+static Logical KeepFrames(SCENE *);
+static void FreeFrames(void);
+static Logical UseGBuffer(SCENE *);
+static Logical MakeTexture(SCENE *);
+static Logical RenderSerial(SCENE *);
+static Logical RenderParallel(SCENE *,int);
+static Logical RenderPeriodic(SCENE *,int,int);
+static void RepeatRow(buffer_t,int,int);
+static void QueueBand(QUEUE *,int);
+static void *RenderWorker(void *);
+static Logical RenderTiled(SCENE *,int,buffer_t);
+static void *TileWorker(void *);
+
+static RGBType *Phong(CONTEXT *,VECTOR *,VECTOR *,VECTOR *,Logical,RGBType *);
+static RGBType *Blinn(CONTEXT *,VECTOR *,VECTOR *,VECTOR *,Logical,RGBType *);
+
+static double GeometricTerm(VECTOR *,VECTOR *,VECTOR *,VECTOR *);
+static double FresnelApproxN(ColorType,double *,int);
+static double FresnelDR(VECTOR*,VECTOR*,VECTOR*,double,double);
+static void   FresnelApproxFr(VECTOR*,VECTOR*,VECTOR*,ColorType,
+                              ColorType,double,double,double,int);
+static void CalculateSpectralColors(CONTEXT *,POINT *);
+static void PaperColors(CONTEXT *);
+static void InkColors(CONTEXT *,double);
+static void MixSpectralColors(CONTEXT *);
+static RGBType *LinearColor(CONTEXT *,double,double,double,double,RGBType *);
+
+
+
+/**************************************************************/
+
+
+
+/**************************************************************
+
+    Logical RenderImage(RenderType picture)
+
+    A function for rendering a picture. The rows are shaded by
+    picture.Threads render threads and written to the TIFF file
+    in order. The light direction is the same for the whole
+    picture, so the self shadow mask of the paper is made once
+    before rendering. So is the ink transfer field. They are
+    kept for the next pictures until the paper and the ink are
+    exited, so a list of view angles makes them once. The render
+    kernel is picked once for the picture by SelectSpan().
+    A tiled TIFF file is rendered and written a tile at a time
+    by RenderTiled() in any order. So is an uncompressed file in
+    strips, whose rows are mapped to memory and rendered in place
+    without the writer thread.
+
+    Without ink and seen from the nadir a pixel depends only on
+    its place in the paper period, so if the period is a whole
+    number of pixels only one period is rendered and repeated.
+
+    With picture.GBuffer the geometry of the pixels is kept in a
+    geometry buffer. A later picture of the same paper and ink
+    geometry, light direction, view and size is shaded from the
+    buffer, so only the spectra and the illumination model may
+    change between them. A periodic picture is not kept, as its
+    period is rendered again faster.
+
+    With picture.Texture the paper is shaded once for each texel
+    of the paper by MakeTexture() and the paper pixels are
+    fetched from the texels, if there are fewer texels than
+    pixels. A pixel gets the color of the paper grid point
+    nearest to the point it sees, so it is an approximation
+    unless every pixel sees a grid point. With bilinear normals,
+    the geometry buffer or a periodic picture each pixel is
+    shaded.
+
+    If picture.Lights is over one, the lights Light.. of the
+    light list are shaded in one pass: the geometry and the
+    material of a pixel are found once and each light is shaded
+    with them. Only Light is written to picture.Tif, the other
+    pictures are kept in memory and written by the next calls,
+    whose picture.Lights is 0. The spectral shading is still
+    made for each light. A periodic picture is shaded one light
+    at a time.
+
+*/
+
+Logical RenderImage(RenderType picture)
+{
+    SCENE       scene;
+    VECTOR      view=VIEW_VECTOR;
+    Logical     ok,periodic,replay=FALSE,kept=FALSE;
+    buffer_t    map;
+    int         periodX,periodY;
+
+    if(picture.Model!=PHONG && picture.Model!=BLINN)
+        return FALSE;
+    scene.picture=&picture;
+    if(picture.ViewDir!=0)
+        {
+        view.i=sin(picture.ViewDir);
+        view.j=0;
+        view.k=cos(picture.ViewDir);
+        }
+    scene.view=view;
+    scene.GBuffer=NULL;
+    scene.Texture=NULL;
+    scene.frames=NULL;
+    scene.first=picture.Light;
+    scene.lights=1;
+    periodic=(picture.UseInk==FALSE && picture.ViewDir==0 &&
+              GetTileSize(picture.Tif)==0 &&
+              PaperGetPeriod(picture.PixelSize,&periodX,&periodY)==TRUE &&
+              (periodX<picture.X || periodY<picture.Y)) ? TRUE : FALSE;
+    if(picture.Lights<1 && frames.Valid==TRUE &&
+       frames.First<picture.Light &&
+       picture.Light<frames.First+frames.Lights &&
+       frames.X==picture.X && frames.Y==picture.Y)
+        {
+        scene.frames=frames.Pixels+
+            (u_long)(picture.Light-frames.First-1)*picture.Pixels*RGB;
+        scene.Span=FrameSpan;
+        kept=TRUE;
+        periodic=FALSE;
+        }
+    else
+        {
+        if(picture.Lights>1 && periodic==FALSE)
+            scene.lights=(picture.Lights<RENDER_MAX_LIGHTS) ?
+                         picture.Lights : RENDER_MAX_LIGHTS;
+        if(LightDirections(&scene)==FALSE)
+            return FALSE;
+        if(scene.lights>1 && KeepFrames(&scene)==FALSE)
+            {
+            scene.lights=1;
+            if(LightDirections(&scene)==FALSE)
+                return FALSE;
+            }
+        if(picture.GBuffer==TRUE && periodic==FALSE)
+            replay=UseGBuffer(&scene);
+        if(replay==FALSE)
+            {
+            (void)PaperShadowInit(&scene.light);
+            if(picture.UseInk==TRUE)
+                (void)InkFieldInit();
+            }
+        SelectSpan(&scene);
+        if(replay==TRUE)
+            scene.Span=ShadeSpan;
+        if(picture.Texture==TRUE && periodic==FALSE &&
+           picture.GBuffer==FALSE && scene.lights==1 &&
+           PaperTexels()>0 && (u_long) PaperTexels()<=picture.Pixels)
+            (void)MakeTexture(&scene);
+        }
+
+    if(GetTileSize(picture.Tif)>0)
+        ok=RenderTiled(&scene,picture.Threads,NULL);
+    else if(periodic==FALSE && (map=MapRows(picture.Tif))!=NULL)
+        {
+        ok=RenderTiled(&scene,picture.Threads,map);
+        if(UnmapRows(picture.Tif)==FALSE)
+            MessageError("Error in writing to TIFF file");
+        }
+    else if(periodic==TRUE)
+        ok=RenderPeriodic(&scene,periodX,periodY);
+    else if(picture.Threads>1 && picture.Y>1)
+        ok=RenderParallel(&scene,picture.Threads);
+    else
+        ok=RenderSerial(&scene);
+    if(scene.GBuffer!=NULL)
+        gbuffer.Valid=ok;
+    if(scene.Texture!=NULL)
+        MemoryFree(scene.Texture);
+    if(scene.lights>1)
+        frames.Valid=ok;
+    if(kept==TRUE && picture.Light==frames.First+frames.Lights-1)
+        FreeFrames();
+    return ok;
+}
+
+
+
+/**************************************************************
+
+    void RenderExit(void)
+
+    Frees the geometry buffer and the kept pictures of the
+    lights.
+
+*/
+
+void RenderExit(void)
+{
+    FreeFrames();
+    if(gbuffer.Pixels!=NULL)
+        MemoryFree(gbuffer.Pixels);
+    gbuffer.Pixels=NULL;
+    gbuffer.Valid=FALSE;
+    return;
+}
+
+
+
+
+/**************************************************************
+    Internal functions for this file
+***************************************************************/
+
+
+
+/*****************************************************************
+
+    static Logical RenderSerial(SCENE *scene)
+
+    Renders the picture row by row in the calling thread. The
+    rows are written by the writer thread.
+
+*/
+
+static Logical RenderSerial(SCENE *scene)
+{
+    RenderType *picture=scene->picture;
+    CONTEXT     ctx[RENDER_MAX_LIGHTS];
+    WriterType  writer;
+    int         row;
+
+    if((writer=WriterInit(picture->Tif,picture->Name,WRITER_ROWS,
+                          picture->Threads))==NULL)
+        return FALSE;
+    if(InitContexts(ctx,scene)==FALSE)
+        goto error;
+
+    for(row=0;row<picture->Y;row++)
+        {
+        (*scene->Span)(ctx,scene,row,0,picture->X,WriterBuffer(writer));
+        if(WriterWrite(writer,row)==FALSE)  /* Writes buffer to file */
+            MessageError("Error in writing to TIFF file");
+        }
+
+    ExitContexts(ctx,scene);
+    if(WriterExit(writer)==FALSE)
+        MessageError("Error in writing to TIFF file");
+    return TRUE;
+
+error:
+    ExitContexts(ctx,scene);
+    (void)WriterExit(writer);
+    return FALSE;
+}
+
+
+
+/*****************************************************************
+
+    static Logical RenderPeriodic(SCENE *scene,int periodX,
+                                  int periodY)
+
+    Renders a picture that repeats after periodX columns and
+    periodY rows. The first periodX columns of a row are rendered
+    and copied to the rest of the row. The first periodY rows are
+    kept and the later rows are copied from them.
+
+*/
+
+static Logical RenderPeriodic(SCENE *scene,int periodX,int periodY)
+{
+    RenderType *picture=scene->picture;
+    CONTEXT     ctx[RENDER_MAX_LIGHTS];
+    WriterType  writer;
+    buffer_t    buf,tile=NULL;
+    int         row,size,width;
+
+    if((writer=WriterInit(picture->Tif,picture->Name,WRITER_ROWS,
+                          picture->Threads))==NULL)
+        return FALSE;
+    if(InitContexts(ctx,scene)==FALSE)
+        goto error;
+    width=(periodX<picture->X) ? periodX : picture->X;
+    size=RGB*picture->X;
+    if(periodY<picture->Y &&
+       (tile=MemoryAllocate(char,(size*periodY)))==NULL)
+        goto error;
+
+    for(row=0;row<picture->Y;row++)
+        {
+        buf=WriterBuffer(writer);
+        if(tile!=NULL && row>=periodY)
+            memcpy(buf,tile+(row%periodY)*size,size);
+        else
+            {
+            (*scene->Span)(ctx,scene,row,0,width,buf);
+            RepeatRow(buf,width,picture->X);
+            if(tile!=NULL)
+                memcpy(tile+row*size,buf,size);
+            }
+        if(WriterWrite(writer,row)==FALSE)
+            MessageError("Error in writing to TIFF file");
+        }
+
+    if(tile!=NULL)
+        MemoryFree(tile);
+    ExitContexts(ctx,scene);
+    if(WriterExit(writer)==FALSE)
+        MessageError("Error in writing to TIFF file");
+    return TRUE;
+
+error:
+    ExitContexts(ctx,scene);
+    (void)WriterExit(writer);
+    return FALSE;
+}
+
+
+
+/*****************************************************************
+
+    static void RepeatRow(buffer_t buf,int period,int width)
+
+    Copies the first period pixels of the row buffer buf over
+    the rest of the row of width pixels. The copied part is
+    doubled on each round.
+
+*/
+
+static void RepeatRow(buffer_t buf,int period,int width)
+{
+    int done,n;
+
+    for(done=period;done<width;done+=n)
+        {
+        n=(done<width-done) ? done : width-done;
+        memcpy(buf+RGB*done,buf,RGB*n);
+        }
+    return;
+}
+
+
+
+/*****************************************************************
 
-/* Extra global variables for ink handling */
-static ColorType specular=NULL;
-static ColorType diffuse=NULL;
-static ColorType ambient=NULL;
+    static Logical RenderParallel(SCENE *scene,int threads)
+
+    Renders the picture with several render threads. The tiles of
+    a few bands are given to the scheduler at a time. The calling
+    thread waits for the bands in order, gives their rows to the
+    writer thread and gives the tiles of the next band to the
+    scheduler in the freed band slot.
+
+*/
+
+static Logical RenderParallel(SCENE *scene,int threads)
+{
+    RenderType *picture=scene->picture;
+    QUEUE       queue;
+    WORKER     *workers=NULL;
+    WriterType  writer=NULL;
+    int         i,band,bands,slot,row,started=0;
+
+    if(threads>RENDER_MAX_THREADS)
+        threads=RENDER_MAX_THREADS;
+    bands=(picture->Y+TILE_SIZE-1)/TILE_SIZE;
+    queue.scene=scene;
+    queue.threads=threads;
+    queue.tiles=(picture->X+TILE_SIZE-1)/TILE_SIZE;
+    queue.slots=1+(threads*TILES_PER_THREAD+queue.tiles-1)/queue.tiles;
+    if(queue.slots>bands)
+        queue.slots=bands;
+    queue.sched=NULL;
+    if((queue.rows=MemoryAllocate(buffer_t,queue.slots*TILE_SIZE))==NULL)
+        return FALSE;
+    if((queue.left=MemoryAllocate(int,queue.slots))==NULL)
+        {
+        MemoryFree(queue.rows);
+        return FALSE;
+        }
+    for(i=0;i<queue.slots*TILE_SIZE;i++)
+        queue.rows[i]=NULL;
+    for(i=0;i<queue.slots*TILE_SIZE;i++)
+        if((queue.rows[i]=AllocRowBuffer(picture->Tif))==NULL)
+            goto error;
+    if((queue.sched=SchedInit(threads,queue.slots*queue.tiles))==NULL)
+        goto error;
+    if((writer=WriterInit(picture->Tif,picture->Name,WRITER_ROWS,
+                          picture->Threads))==NULL)
+        goto error;
+    if((workers=MemoryAllocate(WORKER,threads))==NULL)
+        goto error;
+    for(i=0;i<threads;i++)
+        {
+        workers[i].queue=&queue;
+        workers[i].id=i;
+        if(InitContexts(workers[i].ctx,scene)==FALSE)
+            {
+            threads=i+1;
+            goto error;
+            }
+        }
+
+    pthread_mutex_init(&queue.lock,NULL);
+    pthread_cond_init(&queue.finished,NULL);
+    for(band=0;band<queue.slots;band++)
+        QueueBand(&queue,band);
+    for(started=0;started<threads;started++)
+        if(pthread_create(&workers[started].thread,NULL,
+                          RenderWorker,&workers[started])!=0)
+            break;
+    if(started==0)
+        {
+        MessageWarning("Can't start render threads");
+        goto error_sync;
+        }
 
+    for(band=0;band<bands;band++)
+        {
+        slot=band%queue.slots;
+        pthread_mutex_lock(&queue.lock);
+        while(queue.left[slot]>0)
+            pthread_cond_wait(&queue.finished,&queue.lock);
+        pthread_mutex_unlock(&queue.lock);
+
+        for(i=0;i<TILE_SIZE && (row=band*TILE_SIZE+i)<picture->Y;i++)
+            {
+            memcpy(WriterBuffer(writer),queue.rows[slot*TILE_SIZE+i],
+                   RGB*picture->X);
+            if(WriterWrite(writer,row)==FALSE)
+                MessageError("Error in writing to TIFF file");
+            }
+        if(band+queue.slots<bands)
+            QueueBand(&queue,band+queue.slots);
+        }
+
+    SchedClose(queue.sched);
+    for(i=0;i<started;i++)
+        pthread_join(workers[i].thread,NULL);
+    pthread_cond_destroy(&queue.finished);
+    pthread_mutex_destroy(&queue.lock);
+    for(i=0;i<threads;i++)
+        ExitContexts(workers[i].ctx,scene);
+    MemoryFree(workers);
+    SchedExit(queue.sched);
+    for(i=0;i<queue.slots*TILE_SIZE;i++)
+        FreeRowBuffer(queue.rows[i]);
+    MemoryFree(queue.rows);
+    MemoryFree(queue.left);
+    if(WriterExit(writer)==FALSE)
+        MessageError("Error in writing to TIFF file");
+    return TRUE;
+
+error_sync:
+    pthread_cond_destroy(&queue.finished);
+    pthread_mutex_destroy(&queue.lock);
+error:
+    if(workers!=NULL)
+        {
+        for(i=0;i<threads;i++)
+            ExitContexts(workers[i].ctx,scene);
+        MemoryFree(workers);
+        }
+    if(writer!=NULL)
+        (void)WriterExit(writer);
+    SchedExit(queue.sched);
+    for(i=0;i<queue.slots*TILE_SIZE;i++)
+        if(queue.rows[i]!=NULL)
+            FreeRowBuffer(queue.rows[i]);
+    MemoryFree(queue.rows);
+    MemoryFree(queue.left);
+    return FALSE;
+}
+
+
+
+/*****************************************************************
+
+    static void QueueBand(QUEUE *queue,int band)
+
+    Gives the tiles of a band to the scheduler. Neighbouring tiles
+    are given to the same thread, the idle threads steal the rest.
+
+*/
+
+static void QueueBand(QUEUE *queue,int band)
+{
+    int tile;
+
+    pthread_mutex_lock(&queue->lock);
+    queue->left[band%queue->slots]=queue->tiles;
+    pthread_mutex_unlock(&queue->lock);
+    for(tile=0;tile<queue->tiles;tile++)
+        (void)SchedPush(queue->sched,tile*queue->threads/queue->tiles,
+                        band*queue->tiles+tile);
+    return;
+}
+
+
+
+/*****************************************************************
+
+    static void *RenderWorker(void *arg)
+
+    Render thread. Renders the tiles given by the scheduler until
+    the scheduler is closed.
+
+*/
+
+static void *RenderWorker(void *arg)
+{
+    WORKER *worker=(WORKER *)arg;
+    QUEUE  *queue=worker->queue;
+    RenderType *picture=queue->scene->picture;
+    int     job,band,slot,first,last,i;
+
+    while((job=SchedGet(queue->sched,worker->id))!=SCHED_DONE)
+        {
+        band=job/queue->tiles;
+        slot=band%queue->slots;
+        first=(job%queue->tiles)*TILE_SIZE;
+        last=first+TILE_SIZE;
+        if(last>picture->X)
+            last=picture->X;
+        for(i=0;i<TILE_SIZE && band*TILE_SIZE+i<picture->Y;i++)
+            (*queue->scene->Span)(worker->ctx,queue->scene,
+                                  band*TILE_SIZE+i,first,last,
+                                  queue->rows[slot*TILE_SIZE+i]);
+
+        pthread_mutex_lock(&queue->lock);
+        if(--queue->left[slot]==0)
+            pthread_cond_broadcast(&queue->finished);
+        pthread_mutex_unlock(&queue->lock);
+        }
+    return NULL;
+}
+
+
+
+/*****************************************************************
+
+    static Logical RenderTiled(SCENE *scene,int threads,
+                               buffer_t map)
+
+    Renders a tiled TIFF picture with threads render threads.
+    All the tiles are given to the scheduler at once and every
+    thread writes its tiles itself, so the tiles are written in
+    the order they are finished. If no thread can be started
+    the tiles are rendered in the calling thread.
+
+    If map is not NULL it has the rows of the picture mapped
+    from the file by MapRows(). The picture is then rendered in
+    tiles of TILE_SIZE pixels straight to the rows.
+
+    Returns FALSE if a tile could not be written.
+
+*/
+
+static Logical RenderTiled(SCENE *scene,int threads,buffer_t map)
+{
+    RenderType *picture=scene->picture;
+    TILES       tiles;
+    TILER      *workers=NULL;
+    int         i,job,jobs,started=0;
+
+    if(threads<1)
+        threads=1;
+    if(threads>RENDER_MAX_THREADS)
+        threads=RENDER_MAX_THREADS;
+    tiles.scene=scene;
+    tiles.map=map;
+    tiles.size=(map!=NULL) ? TILE_SIZE : (int) GetTileSize(picture->Tif);
+    tiles.tiles=(picture->X+tiles.size-1)/tiles.size;
+    tiles.done=0;
+    tiles.code=(map!=NULL) ? 0 : EncodedTileSize(picture->Tif);
+    if(tiles.code>0 && GetTileCoding(picture->Tif,&tiles.coding)==FALSE)
+        tiles.code=0;
+    tiles.failed=FALSE;
+    jobs=tiles.tiles*((picture->Y+tiles.size-1)/tiles.size);
+    if((tiles.sched=SchedInit(threads,jobs))==NULL)
+        return FALSE;
+    if((workers=MemoryAllocate(TILER,threads))==NULL)
+        goto error;
+    for(i=0;i<threads;i++)
+        {
+        workers[i].tiles=&tiles;
+        workers[i].id=i;
+        workers[i].row=NULL;
+        workers[i].tile=NULL;
+        workers[i].code=NULL;
+        }
+    for(i=0;i<threads;i++)
+        {
+        if(InitContexts(workers[i].ctx,scene)==FALSE)
+            {
+            threads=i+1;
+            goto error;
+            }
+        if(map!=NULL)
+            continue;
+        if((workers[i].row=AllocRowBuffer(picture->Tif))==NULL ||
+           (workers[i].tile=AllocTileBuffer(picture->Tif))==NULL ||
+           (tiles.code>0 &&
+            (workers[i].code=MemoryAllocate(char,tiles.code))==NULL))
+            {
+            threads=i+1;
+            goto error;
+            }
+        }
+
+    for(job=0;job<jobs;job++)
+        (void)SchedPush(tiles.sched,job*threads/jobs,job);
+    SchedClose(tiles.sched);
+    pthread_mutex_init(&tiles.lock,NULL);
+    for(started=0;started<threads;started++)
+        if(pthread_create(&workers[started].thread,NULL,
+                          TileWorker,&workers[started])!=0)
+            break;
+    if(started==0)
+        (void)TileWorker(&workers[0]);
+    for(i=0;i<started;i++)
+        pthread_join(workers[i].thread,NULL);
+    pthread_mutex_destroy(&tiles.lock);
+    if(tiles.failed==TRUE)
+        {
+        MessageWarning("Error in writing to TIFF file");
+        goto error;
+        }
+
+    for(i=0;i<threads;i++)
+        {
+        ExitContexts(workers[i].ctx,scene);
+        if(workers[i].row!=NULL)
+            FreeRowBuffer(workers[i].row);
+        if(workers[i].tile!=NULL)
+            FreeRowBuffer(workers[i].tile);
+        if(workers[i].code!=NULL)
+            MemoryFree(workers[i].code);
+        }
+    MemoryFree(workers);
+    SchedExit(tiles.sched);
+    return TRUE;
+
+error:
+    if(workers!=NULL)
+        {
+        for(i=0;i<threads;i++)
+            {
+            ExitContexts(workers[i].ctx,scene);
+            if(workers[i].row!=NULL)
+                FreeRowBuffer(workers[i].row);
+            if(workers[i].tile!=NULL)
+                FreeRowBuffer(workers[i].tile);
+            if(workers[i].code!=NULL)
+                MemoryFree(workers[i].code);
+            }
+        MemoryFree(workers);
+        }
+    SchedExit(tiles.sched);
+    return FALSE;
+}
+
+
+
+/*****************************************************************
+
+    static void *TileWorker(void *arg)
+
+    Render thread of a tiled picture. Renders the rows of a tile
+    to the row buffer and copies them to the tile buffer. The
+    parts of the edge tiles outside the picture are white. The
+    tile is encoded by the thread and only the writing is done
+    under the lock. The encoding does not touch the TIFF
+    structure, whose compression was read by RenderTiled(). The tiles of a mapped picture are rendered
+    straight to the mapped rows.
+
+*/
+
+static void *TileWorker(void *arg)
+{
+    TILER  *worker=(TILER *)arg;
+    TILES  *tiles=worker->tiles;
+    RenderType *picture=tiles->scene->picture;
+    int     job,size=tiles->size,x,y,last,i;
+    u_long  n=0;
+    Logical ok;
+
+    while((job=SchedGet(tiles->sched,worker->id))!=SCHED_DONE)
+        {
+        x=(job%tiles->tiles)*size;
+        y=(job/tiles->tiles)*size;
+        last=(x+size<picture->X) ? x+size : picture->X;
+        if(tiles->map!=NULL)
+            {
+            for(i=0;i<size && y+i<picture->Y;i++)
+                (*tiles->scene->Span)(worker->ctx,tiles->scene,y+i,x,last,
+                                      tiles->map+(u_long) (y+i)*RGB*picture->X);
+            pthread_mutex_lock(&tiles->lock);
+            MessageNumber(picture->Name,tiles->done++);
+            pthread_mutex_unlock(&tiles->lock);
+            continue;
+            }
+        if(last-x<size || y+size>picture->Y)
+            memset(worker->tile,0xFF,RGB*size*size);
+        for(i=0;i<size && y+i<picture->Y;i++)
+            {
+            (*tiles->scene->Span)(worker->ctx,tiles->scene,y+i,x,last,
+                                  worker->row);
+            memcpy(worker->tile+RGB*size*i,worker->row+RGB*x,
+                   RGB*(last-x));
+            }
+        if(worker->code!=NULL)
+            n=EncodeTile(&tiles->coding,worker->tile,worker->code);
+
+        pthread_mutex_lock(&tiles->lock);
+        if(worker->code!=NULL)
+            ok=WriteEncodedTile(picture->Tif,worker->code,
+                                (u_long) x,(u_long) y,n);
+        else
+            ok=WriteTileBuffer(picture->Tif,worker->tile,
+                               (u_long) x,(u_long) y);
+        if(ok==FALSE)
+            tiles->failed=TRUE;
+        MessageNumber(picture->Name,tiles->done++);
+        pthread_mutex_unlock(&tiles->lock);
+        }
+    return NULL;
+}
+
+
+
+/*****************************************************************
+
+    Render kernels
+
+    SPAN_KERNEL makes a span renderer, which renders the columns
+    from first to last-1 of one row to the row buffer buf. The
+    pixel position is computed from the row and column numbers so
+    the tiles can be rendered in any order. The kernel is made for
+    one illumination model (shade and the specular power function
+    power) and the constant flags INK (ink is rendered), OBLIQUE
+    (the view is not from the nadir, so hidden pixels are
+    searched) and BETA (the paper has a beta matrix). The
+    branches of the flags that are off are left out by the
+    compiler. A constant specular beta gives a constant specular
+    power, which is computed once for the picture to the scene.
+    If the scene has a geometry buffer the geometry of the
+    pixels is stored to it. The other lights of a render pass
+    are shaded by ShadeLights() with the same geometry and
+    material.
+
+*/
+
+#define SPAN_KERNEL(name,shade,power,INK,OBLIQUE,BETA)                   \
+static void name(CONTEXT *ctx,SCENE *scene,int row,int first,            \
+                 int last,buffer_t buf)                                  \
+{                                                                        \
+    RenderType *picture=scene->picture;                                  \
+    int         i;                                                       \
+    RGBType     rgb;                                                     \
+    VECTOR      paper;                                                   \
+    POINT       px,seen_px;                                              \
+    Logical     shadow;                                                  \
+    int         shadows;                                                 \
+    GPIXEL     *g=NULL;                                                  \
+                                                                         \
+    if(scene->GBuffer!=NULL)                                             \
+        g=scene->GBuffer+(u_long) row*picture->X+first;                  \
+    px.y=row*picture->PixelSize;                                         \
+    px.z=0.0;                                                            \
+    seen_px=px;                                                          \
+    ctx->mtl.SpecularPower=scene->paperPower;                            \
+    for(i=first;i<last;i++)                                              \
+        {                                                                \
+        px.x=i*picture->PixelSize;                                       \
+        if(OBLIQUE)                                                      \
+            PaperHiddenPixel(&scene->view,&px,&seen_px);                 \
+        else                                                             \
+            seen_px.x=px.x;                                              \
+        PaperGetNormalVector(&paper,&seen_px);                           \
+        if(INK)                                                          \
+            CalculateSpectralColors(ctx,&seen_px);                       \
+        if(INK && ctx->inked==TRUE)                                      \
+            ctx->mtl.SpecularPower=scene->inkPower;                      \
+        else if(BETA)                                                    \
+            ctx->mtl.SpecularPower=power(PaperGetSpecularBeta(&seen_px));\
+        else if(INK)                                                     \
+            ctx->mtl.SpecularPower=scene->paperPower;                    \
+        shadow=PaperSelfShadow(&scene->light,&seen_px);                  \
+        (void)shade(ctx,&paper,&scene->light,&scene->view,shadow,&rgb);  \
+        shadows=(shadow==TRUE) ? 1 : 0;                                  \
+        if(scene->lights>1)                                              \
+            shadows=ShadeLights(ctx,scene,&paper,&seen_px,shadows,       \
+                                (u_long) row*picture->X+i);              \
+        if(g!=NULL)                                                      \
+            {                                                            \
+            g->Normal[0]=(float)paper.i;                                 \
+            g->Normal[1]=(float)paper.j;                                 \
+            g->Normal[2]=(float)paper.k;                                 \
+            g->Shadows=(unsigned char)shadows;                           \
+            g->Conv=(INK) ? ctx->conv : 0.0;                             \
+            g->Roughness=(INK) ? ctx->roughness : 0.0;                   \
+            g->Beta=(BETA) ? PaperGetSpecularBeta(&seen_px) : 0.0;       \
+            g++;                                                         \
+            }                                                            \
+        PutPixel(buf,RGB,RED,i,(value_t)rgb.r);                          \
+        PutPixel(buf,RGB,GREEN,i,(value_t)rgb.g);                        \
+        PutPixel(buf,RGB,BLUE,i,(value_t)rgb.b);                         \
+        }                                                                \
+    return;                                                              \
+}
+
+SPAN_KERNEL(PhongPaperNadir,      Phong,MFacetPhongInit,0,0,0)
+SPAN_KERNEL(PhongPaperNadirBeta,  Phong,MFacetPhongInit,0,0,1)
+SPAN_KERNEL(PhongPaperOblique,    Phong,MFacetPhongInit,0,1,0)
+SPAN_KERNEL(PhongPaperObliqueBeta,Phong,MFacetPhongInit,0,1,1)
+SPAN_KERNEL(PhongInkNadir,        Phong,MFacetPhongInit,1,0,0)
+SPAN_KERNEL(PhongInkNadirBeta,    Phong,MFacetPhongInit,1,0,1)
+SPAN_KERNEL(PhongInkOblique,      Phong,MFacetPhongInit,1,1,0)
+SPAN_KERNEL(PhongInkObliqueBeta,  Phong,MFacetPhongInit,1,1,1)
+SPAN_KERNEL(BlinnPaperNadir,      Blinn,MFacetBlinnInit,0,0,0)
+SPAN_KERNEL(BlinnPaperNadirBeta,  Blinn,MFacetBlinnInit,0,0,1)
+SPAN_KERNEL(BlinnPaperOblique,    Blinn,MFacetBlinnInit,0,1,0)
+SPAN_KERNEL(BlinnPaperObliqueBeta,Blinn,MFacetBlinnInit,0,1,1)
+SPAN_KERNEL(BlinnInkNadir,        Blinn,MFacetBlinnInit,1,0,0)
+SPAN_KERNEL(BlinnInkNadirBeta,    Blinn,MFacetBlinnInit,1,0,1)
+SPAN_KERNEL(BlinnInkOblique,      Blinn,MFacetBlinnInit,1,1,0)
+SPAN_KERNEL(BlinnInkObliqueBeta,  Blinn,MFacetBlinnInit,1,1,1)
+
+
+/* The kernels by model, ink, oblique view and beta matrix */
+
+static SPAN Spans[2][2][2][2]={
+    { { { PhongPaperNadir, PhongPaperNadirBeta },
+        { PhongPaperOblique, PhongPaperObliqueBeta } },
+      { { PhongInkNadir, PhongInkNadirBeta },
+        { PhongInkOblique, PhongInkObliqueBeta } } },
+    { { { BlinnPaperNadir, BlinnPaperNadirBeta },
+        { BlinnPaperOblique, BlinnPaperObliqueBeta } },
+      { { BlinnInkNadir, BlinnInkNadirBeta },
+        { BlinnInkOblique, BlinnInkObliqueBeta } } } };
+
+
+
+/*****************************************************************
+
+    static void SelectSpan(SCENE *scene)
+
+    Picks the render kernel of the picture of the scene and
+    computes the constant specular powers. With ink the spans
+    go through CullSpan(), which uses the ink kernel only near
+    the ink.
+
+*/
+
+static void SelectSpan(SCENE *scene)
+{
+    RenderType *picture=scene->picture;
+    int model,ink,oblique,beta;
+
+    model=(picture->Model==BLINN) ? 1 : 0;
+    ink=(picture->UseInk==TRUE) ? 1 : 0;
+    oblique=(picture->ViewDir!=0) ? 1 : 0;
+    beta=(PaperHasBetaMatrix()==TRUE) ? 1 : 0;
+    scene->InkSpan=Spans[model][1][oblique][beta];
+    scene->PaperSpan=Spans[model][0][oblique][beta];
+    scene->Span=(ink==1) ? CullSpan : scene->PaperSpan;
+    scene->Power=(model==1) ? MFacetBlinnInit : MFacetPhongInit;
+    if(model==1)
+        {
+        scene->paperPower=MFacetBlinnInit(PaperGetSpecularBeta(NULL));
+        scene->inkPower=MFacetBlinnInit(InkGetSpecularBeta());
+        }
+    else
+        {
+        scene->paperPower=MFacetPhongInit(PaperGetSpecularBeta(NULL));
+        scene->inkPower=MFacetPhongInit(InkGetSpecularBeta());
+        }
+    return;
+}
+
+
+
+/*****************************************************************
+
+    static Logical UseGBuffer(SCENE *scene)
+
+    Returns TRUE if the geometry buffer has been made for the
+    picture and the light directions of the scene. Else the
+    buffer is made ready for the picture and given to the scene
+    to be filled.
+
+*/
+
+static Logical UseGBuffer(SCENE *scene)
+{
+    RenderType *picture=scene->picture;
+    unsigned long paper,ink;
+    Logical same;
+    int l;
+
+    paper=PaperGeometryKey();
+    ink=(picture->UseInk==TRUE) ? InkGeometryKey() : 0;
+    same=(gbuffer.Lights==scene->lights) ? TRUE : FALSE;
+    for(l=0;l<scene->lights && same==TRUE;l++)
+        if(gbuffer.Light[l].i!=scene->lightDir[l].i ||
+           gbuffer.Light[l].j!=scene->lightDir[l].j ||
+           gbuffer.Light[l].k!=scene->lightDir[l].k)
+            same=FALSE;
+    if(gbuffer.Pixels!=NULL && gbuffer.Valid==TRUE && same==TRUE &&
+       gbuffer.X==picture->X && gbuffer.Y==picture->Y &&
+       gbuffer.PixelSize==picture->PixelSize &&
+       gbuffer.ViewDir==picture->ViewDir &&
+       gbuffer.UseInk==picture->UseInk &&
+       gbuffer.Paper==paper && gbuffer.Ink==ink)
+        return TRUE;
+
+    gbuffer.Valid=FALSE;
+    if(gbuffer.Pixels==NULL ||
+       (u_long) gbuffer.X*gbuffer.Y!=picture->Pixels)
+        {
+        if(gbuffer.Pixels!=NULL)
+            MemoryFree(gbuffer.Pixels);
+        gbuffer.Pixels=MemoryAllocate(GPIXEL,(picture->Pixels));
+        }
+    gbuffer.X=picture->X;
+    gbuffer.Y=picture->Y;
+    gbuffer.PixelSize=picture->PixelSize;
+    gbuffer.ViewDir=picture->ViewDir;
+    gbuffer.Lights=scene->lights;
+    for(l=0;l<scene->lights;l++)
+        gbuffer.Light[l]=scene->lightDir[l];
+    gbuffer.UseInk=picture->UseInk;
+    gbuffer.Paper=paper;
+    gbuffer.Ink=ink;
+    scene->GBuffer=gbuffer.Pixels;
+    return FALSE;
+}
+
+
+
+/*****************************************************************
+
+    static Logical LightDirections(SCENE *scene)
+
+    Gets the directions of the lights of the render pass of the
+    scene. The first light of the pass is left selected.
+
+*/
+
+static Logical LightDirections(SCENE *scene)
+{
+    POINT px;
+    int l;
+
+    px.x=0.0;
+    px.y=0.0;
+    px.z=0.0;
+    for(l=0;l<scene->lights;l++)
+        if(LightSelect(scene->first+l)==FALSE ||
+           LightVector(&scene->lightDir[l],&px)==FALSE)
+            return FALSE;
+    scene->light=scene->lightDir[0];
+    return LightSelect(scene->first);
+}
+
+
+
+/*****************************************************************
+
+    static Logical KeepFrames(SCENE *scene)
+
+    Allocates the pictures of the lights of the render pass
+    after the first one and gives them to the scene. Returns
+    FALSE if there is not memory for them.
+
+*/
+
+static Logical KeepFrames(SCENE *scene)
+{
+    RenderType *picture=scene->picture;
+    u_long size;
+
+    FreeFrames();
+    size=(u_long)(scene->lights-1)*picture->Pixels*RGB;
+    if((frames.Pixels=MemoryAllocate(char,size))==NULL)
+        return FALSE;
+    frames.First=scene->first;
+    frames.Lights=scene->lights;
+    frames.X=picture->X;
+    frames.Y=picture->Y;
+    scene->frames=frames.Pixels;
+    return TRUE;
+}
+
+
+
+/*****************************************************************
+
+    static void FreeFrames(void)
+
+    Frees the pictures of the lights of the last render pass.
+
+*/
+
+static void FreeFrames(void)
+{
+    if(frames.Pixels!=NULL)
+        MemoryFree(frames.Pixels);
+    frames.Pixels=NULL;
+    frames.Valid=FALSE;
+    frames.Lights=0;
+    return;
+}
 
-/* Internal functions */
 
-static Logical InitGlobals(void);
-static void ExitGlobals(void);
-static Logical InitExtraGlobals(void);
-static void ExitExtraGlobals(void);
 
-static RGBType *Phong(VECTOR *,VECTOR *,VECTOR *,POINT *);
-static RGBType *Blinn(VECTOR *,VECTOR *,VECTOR *,POINT *);
+/*****************************************************************
 
-static double GeometricTerm(VECTOR *,VECTOR *,VECTOR *,VECTOR *);
-static double FresnelApproxN(ColorType,double *,int);
-static double FresnelDR(VECTOR*,VECTOR*,VECTOR*,double,double);
-static void   FresnelApproxFr(VECTOR*,VECTOR*,VECTOR*,ColorType,
-                              ColorType,double,double,double,int);
-static double CalculateSpectralColors(POINT *);
+    static void ShadeSpan(CONTEXT *ctx,SCENE *scene,int row,
+                          int first,int last,buffer_t buf)
 
+    Span renderer of a picture shaded from the geometry buffer.
+    The normal, self shadows, ink transfer terms and beta of a
+    pixel are taken from the buffer and only the colors of the
+    lights are computed.
 
+*/
 
-/**************************************************************/
+static void ShadeSpan(CONTEXT *ctx,SCENE *scene,int row,int first,
+                      int last,buffer_t buf)
+{
+    RenderType *picture=scene->picture;
+    GPIXEL     *g=gbuffer.Pixels+(u_long) row*picture->X+first;
+    VECTOR      normal;
+    RGBType     rgb;
+    Logical     beta,shadow;
+    double      transfer;
+    int         i;
+
+    beta=PaperHasBetaMatrix();
+    for(i=first;i<last;i++,g++)
+        {
+        normal.i=g->Normal[0];
+        normal.j=g->Normal[1];
+        normal.k=g->Normal[2];
+        if(picture->UseInk==TRUE)
+            {
+            transfer=InkTransferOf(g->Conv,g->Roughness);
+            if(transfer==0.0)
+                PaperColors(ctx);
+            else
+                InkColors(ctx,transfer);
+            }
+        if(ctx->inked==TRUE)
+            ctx->mtl.SpecularPower=scene->inkPower;
+        else if(beta==TRUE)
+            ctx->mtl.SpecularPower=(*scene->Power)(g->Beta);
+        else
+            ctx->mtl.SpecularPower=scene->paperPower;
+        shadow=(g->Shadows&1) ? TRUE : FALSE;
+        if(picture->Model==BLINN)
+            (void)Blinn(ctx,&normal,&scene->light,&scene->view,shadow,&rgb);
+        else
+            (void)Phong(ctx,&normal,&scene->light,&scene->view,shadow,&rgb);
+        if(scene->lights>1)
+            (void)ShadeLights(ctx,scene,&normal,NULL,(int)g->Shadows,
+                              (u_long) row*picture->X+i);
+        PutPixel(buf,RGB,RED,i,(value_t)rgb.r);
+        PutPixel(buf,RGB,GREEN,i,(value_t)rgb.g);
+        PutPixel(buf,RGB,BLUE,i,(value_t)rgb.b);
+        }
+    return;
+}
 
 
 
-/**************************************************************
+/*****************************************************************
 
-    Logical RenderImage(String name,TIFF *tif,double PixelSize,
-                        int SzX,int SzY,int model)
+    static int ShadeLights(CONTEXT *ctx,SCENE *scene,
+                           VECTOR *normal,POINT *px,int shadows,
+                           u_long pixel)
 
-    A function for rendering a picture
+    Shades the lights of the render pass after the first one at
+    a pixel whose material is in ctx and normal in normal, and
+    stores the colors to the pictures of the lights. The self
+    shadow of light l is bit l of shadows. If px is NULL the
+    bits are given, else the shadows are searched at the point
+    px and the bits are returned.
 
 */
 
-Logical RenderImage(RenderType picture)
+static int ShadeLights(CONTEXT *ctx,SCENE *scene,VECTOR *normal,
+                       POINT *px,int shadows,u_long pixel)
 {
-    int         i,row;
+    RenderType *picture=scene->picture;
+    VECTOR     *light;
+    RGBType     rgb;
+    Logical     shadow;
     buffer_t    buf;
-    RGBType    *rgb;
-    VECTOR      light,paper,view=VIEW_VECTOR;
-    POINT       px,seen_px;
+    int         l;
 
-    if((buf=AllocRowBuffer(picture.Tif))==NULL)
-        goto error;
-    if(InitGlobals()==FALSE)
-        goto error;
-    if(picture.UseInk==TRUE)
-        if(InitExtraGlobals()==FALSE)
-            goto error;
-    if(picture.ViewDir!=0)
+    for(l=1;l<scene->lights;l++)
         {
-        view.i=sin(picture.ViewDir);
-        view.j=0;
-        view.k=cos(picture.ViewDir);
+        light=scene->lightDir+l;
+        if(px==NULL)
+            shadow=(shadows&(1<<l)) ? TRUE : FALSE;
+        else
+            {
+            if(light->i==scene->light.i && light->j==scene->light.j &&
+               light->k==scene->light.k)
+                shadow=(shadows&1) ? TRUE : FALSE;
+            else
+                shadow=PaperSelfShadow(light,px);
+            if(shadow==TRUE)
+                shadows|=1<<l;
+            }
+        ShareMaterial(ctx,ctx+l);
+        if(picture->Model==BLINN)
+            (void)Blinn(ctx+l,normal,light,&scene->view,shadow,&rgb);
+        else
+            (void)Phong(ctx+l,normal,light,&scene->view,shadow,&rgb);
+        buf=scene->frames+(u_long)(l-1)*picture->Pixels*RGB;
+        PutPixel(buf,RGB,RED,pixel,(value_t)rgb.r);
+        PutPixel(buf,RGB,GREEN,pixel,(value_t)rgb.g);
+        PutPixel(buf,RGB,BLUE,pixel,(value_t)rgb.b);
         }
-    px.x=0.0;
-    px.y=0.0;
-    px.z=0.0;
-    LightVector(&light,&px);
-
-    switch(picture.Model)
-        {
-
-
-        /* uses Phong illumination model */
-
-        case PHONG:
-
-            for(row=0;row<picture.Y;row++)   /* This for loop does the actual making */
-                {                      /* of the TIFF test file */
-                px.x=0.0;
-                for(i=0;i<picture.X;i++)     /* This for loop makes data for a RGB row */
-                        {
-                        PaperHiddenPixel(&view,&px,&seen_px);
-                        PaperGetNormalVector(&paper,&seen_px);
-                        if(picture.UseInk==TRUE)
-                            mtl.SpecularPower=MFacetPhongInit(
-                                              CalculateSpectralColors(&seen_px));
-                        else
-                            mtl.SpecularPower=MFacetPhongInit(
-                                              PaperGetSpecularBeta(&seen_px));
-                        rgb=Phong(&paper,&light,&view,&seen_px);
-                        PutPixel(buf,RGB,RED,i,(value_t)rgb->r);
-                        PutPixel(buf,RGB,GREEN,i,(value_t)rgb->g);
-                        PutPixel(buf,RGB,BLUE,i,(value_t)rgb->b);
-                        px.x+=picture.PixelSize;
-                        }
-                if(WriteRowBuffer(picture.Tif,buf,row)==FALSE)  /* Writes buffer to file */
-                    MessageError("Error in writing to TIFF file");
-                px.y+=picture.PixelSize;
-                MessageNumber(picture.Name,row);
-                }
-            break;
+    return shadows;
+}
 
 
-        /* uses Blinn illumination model */
-
-        case BLINN:
-
-            for(row=0;row<picture.Y;row++)   /* This for loop does the actual making */
-                {                      /* of the TIFF test file */
-                px.x=0.0;
-                for(i=0;i<picture.X;i++)     /* This for loop makes data for a RGB row */
-                        {
-                        PaperHiddenPixel(&view,&px,&seen_px);
-                        PaperGetNormalVector(&paper,&seen_px);
-                        if(picture.UseInk==TRUE)
-                            mtl.SpecularPower=MFacetBlinnInit(
-                                              CalculateSpectralColors(&seen_px));
-                        else
-                            mtl.SpecularPower=MFacetBlinnInit(
-                                              PaperGetSpecularBeta(&seen_px));
-                        rgb=Blinn(&paper,&light,&view,&seen_px);
-                        PutPixel(buf,RGB,RED,i,(value_t)rgb->r);
-                        PutPixel(buf,RGB,GREEN,i,(value_t)rgb->g);
-                        PutPixel(buf,RGB,BLUE,i,(value_t)rgb->b);
-                        px.x+=picture.PixelSize;
-                        }
-                if(WriteRowBuffer(picture.Tif,buf,row)==FALSE)  /* Writes buffer to file */
-                    MessageError("Error in writing to TIFF file");
-                px.y+=picture.PixelSize;
-                MessageNumber(picture.Name,row);
-                }
-            break;
 
-        /* Wrong illumination model */
+/*****************************************************************
 
-        default:
-            goto error;
-        }
+    static void FrameSpan(CONTEXT *ctx,SCENE *scene,int row,
+                          int first,int last,buffer_t buf)
 
+    Span renderer of a light shaded by an earlier render pass.
+    The pixels are copied from the picture of the light in the
+    scene.
 
-    ExitGlobals();
-    ExitExtraGlobals();
-    FreeRowBuffer(buf);
+*/
 
-    return TRUE;
+static void FrameSpan(CONTEXT *ctx,SCENE *scene,int row,int first,
+                      int last,buffer_t buf)
+{
+    RenderType *picture=scene->picture;
 
-error:
-    ExitGlobals();
-    ExitExtraGlobals();
-    FreeRowBuffer(buf);
+    (void)ctx;
+    memcpy(buf+RGB*first,
+           scene->frames+((u_long) row*picture->X+first)*RGB,
+           (size_t)(RGB*(last-first)));
+    return;
+}
 
-    return FALSE;
+
+
+/*****************************************************************
+
+    static Logical MakeTexture(SCENE *scene)
+
+    Shades the paper without ink at every texel of the paper,
+    seen from the view of the scene, to the texture of
+    the scene and makes TextureSpan() the paper span renderer.
+    The pixels of ink are still shaded by the ink kernel.
+
+*/
+
+static Logical MakeTexture(SCENE *scene)
+{
+    RenderType *picture=scene->picture;
+    CONTEXT     ctx;
+    VECTOR      normal;
+    POINT       px;
+    RGBType     rgb;
+    Logical     shadow,beta;
+    int         i,n;
+
+    n=PaperTexels();
+    if((scene->Texture=MemoryAllocate(RGBType,n))==NULL)
+        return FALSE;
+    if(InitContext(&ctx,picture->UseInk,picture->Linear)==FALSE)
+        {
+        ExitContext(&ctx);
+        MemoryFree(scene->Texture);
+        scene->Texture=NULL;
+        return FALSE;
+        }
+    beta=PaperHasBetaMatrix();
+    PaperColors(&ctx);
+    ctx.mtl.SpecularPower=scene->paperPower;
+    for(i=0;i<n;i++)
+        {
+        (void)PaperTexelPoint(i,&px);
+        PaperGetNormalVector(&normal,&px);
+        if(beta==TRUE)
+            ctx.mtl.SpecularPower=(*scene->Power)(PaperGetSpecularBeta(&px));
+        shadow=PaperSelfShadow(&scene->light,&px);
+        if(picture->Model==BLINN)
+            (void)Blinn(&ctx,&normal,&scene->light,&scene->view,shadow,&rgb);
+        else
+            (void)Phong(&ctx,&normal,&scene->light,&scene->view,shadow,&rgb);
+        scene->Texture[i]=rgb;
+        }
+    ExitContext(&ctx);
+    scene->PaperSpan=TextureSpan;
+    if(picture->UseInk==FALSE)
+        scene->Span=TextureSpan;
+    return TRUE;
 }
 
 
 
+/*****************************************************************
 
-/**************************************************************
-    Internal functions for this file
-***************************************************************/
+    static void TextureSpan(CONTEXT *ctx,SCENE *scene,int row,
+                            int first,int last,buffer_t buf)
+
+    Span renderer of the paper from the texture of the scene.
+    The point a pixel sees is found as in the other kernels and
+    its color is fetched from the nearest texel, given by
+    PaperTexel(). The self shadow is that of the texel, so a
+    point between the paper grid points may get the wrong one.
+
+*/
+
+static void TextureSpan(CONTEXT *ctx,SCENE *scene,int row,int first,
+                        int last,buffer_t buf)
+{
+    RenderType *picture=scene->picture;
+    POINT       px,seen_px;
+    RGBType    *t;
+    int         i;
+
+    (void)ctx;
+    px.y=row*picture->PixelSize;
+    px.z=0.0;
+    seen_px=px;
+    for(i=first;i<last;i++)
+        {
+        px.x=i*picture->PixelSize;
+        if(picture->ViewDir!=0)
+            PaperHiddenPixel(&scene->view,&px,&seen_px);
+        else
+            seen_px.x=px.x;
+        t=scene->Texture+PaperTexel(&seen_px);
+        PutPixel(buf,RGB,RED,i,(value_t)t->r);
+        PutPixel(buf,RGB,GREEN,i,(value_t)t->g);
+        PutPixel(buf,RGB,BLUE,i,(value_t)t->b);
+        }
+    return;
+}
 
 
 
 /*****************************************************************
 
-    static Logical InitGlobals(void)
+    static void CullSpan(CONTEXT *ctx,SCENE *scene,int row,
+                         int first,int last,buffer_t buf)
 
-    Initializes the global variables.
+    Span renderer of the pictures with ink. The parts of the span
+    where InkCovered() tells there is no ink transfer are
+    rendered with the paper kernel, the rest with the ink
+    kernel. From the nadir the span is tested in parts of
+    CULL_SIZE pixels. In an oblique view the seen pixels are on
+    the same row, so only the row is tested.
 
 */
 
-static Logical InitGlobals(void)
+static void CullSpan(CONTEXT *ctx,SCENE *scene,int row,int first,
+                     int last,buffer_t buf)
 {
-    int ct;
+    RenderType *picture=scene->picture;
+    POINT       min,max;
+    int         i,end;
+
+    min.y=max.y=row*picture->PixelSize;
+    min.z=max.z=0.0;
+    min.x=-HUGE_VAL;
+    max.x=HUGE_VAL;
+    if(InkCovered(&min,&max)==FALSE)
+        {
+        PaperColors(ctx);
+        (*scene->PaperSpan)(ctx,scene,row,first,last,buf);
+        return;
+        }
+    if(picture->ViewDir!=0)
+        {
+        (*scene->InkSpan)(ctx,scene,row,first,last,buf);
+        return;
+        }
+    for(i=first;i<last;i=end)
+        {
+        end=(i+CULL_SIZE<last) ? i+CULL_SIZE : last;
+        min.x=i*picture->PixelSize;
+        max.x=(end-1)*picture->PixelSize;
+        if(InkCovered(&min,&max)==TRUE)
+            (*scene->InkSpan)(ctx,scene,row,i,end,buf);
+        else
+            {
+            PaperColors(ctx);
+            (*scene->PaperSpan)(ctx,scene,row,i,end,buf);
+            }
+        }
+    return;
+}
 
-    /* Init pic */
 
-    if((pic.Color=ColorVectorInit())==NULL)
-        return FALSE;
-    if((pic.Fresnell=ColorVectorInit())==NULL)
-        return FALSE;
-    pic.Samples=ColorGetSize();
 
-    /* Init material data mtl */
+/*****************************************************************
 
-    if((mtl.Diffuse=PaperGetDiffuse())==NULL)
-        return FALSE;
-    if((mtl.Specular=PaperGetSpecular())==NULL)
-        return FALSE;
-    if((mtl.Ambient=PaperGetAmbient())==NULL)
-        return FALSE;
-    mtl.Ni=FresnelApproxN(mtl.Specular,&mtl.AveRefl,pic.Samples);
+    static Logical InitContexts(CONTEXT *ctx,SCENE *scene)
 
-    /* Init light data lgt */
+    Initializes a render context for each light of the render
+    pass of the scene, each with the spectrum of its light. The
+    first light of the pass is left selected. The contexts are
+    freed by ExitContexts() also if this fails.
 
-    if((lgt.Ambient=LightAmbientColor())==NULL)
-        return FALSE;
-    if((lgt.Specular=LightSpecColor())==NULL)
-        return FALSE;
+*/
 
-    return TRUE;
+static Logical InitContexts(CONTEXT *ctx,SCENE *scene)
+{
+    RenderType *picture=scene->picture;
+    Logical ok=TRUE;
+    int l;
+
+    for(l=0;l<scene->lights;l++)
+        ClearContext(ctx+l);
+    for(l=0;l<scene->lights && ok==TRUE;l++)
+        {
+        if(scene->lights>1)
+            (void)LightSelect(scene->first+l);
+        ok=InitContext(ctx+l,picture->UseInk,picture->Linear);
+        }
+    if(scene->lights>1)
+        (void)LightSelect(scene->first);
+    return ok;
 }
 
 
 
 /*****************************************************************
 
-    static void ExitGlobals(void)
+    static void ExitContexts(CONTEXT *ctx,SCENE *scene)
 
-    Exits the global variables.
+    Frees the render contexts of the lights of the render pass.
 
 */
 
-static void ExitGlobals(void)
+static void ExitContexts(CONTEXT *ctx,SCENE *scene)
 {
+    int l;
+
+    for(l=0;l<scene->lights;l++)
+        ExitContext(ctx+l);
+    return;
+}
 
-    /* Exit pic */
 
-    if(pic.Color!=NULL)
-        ColorVectorExit(pic.Color);
-    if(pic.Fresnell!=NULL)
-        ColorVectorExit(pic.Fresnell);
-    pic.Color=NULL;
-    pic.Fresnell=NULL;
-    pic.Samples=0;
 
-    /* Exit material data mtl */
+/*****************************************************************
 
-    mtl.Diffuse=NULL;
-    mtl.Specular=NULL;
-    mtl.Ambient=NULL;
-    mtl.AveRefl=0.0;
-    mtl.Ni=0.0;
+    static void ClearContext(CONTEXT *ctx)
 
-    /* Exit Light data lgt */
+    Clears the work vectors of a render context, so that it can
+    be given to ExitContext() before it is initialized.
 
-    lgt.Ambient=NULL;
-    lgt.Specular=NULL;
+*/
 
+static void ClearContext(CONTEXT *ctx)
+{
+    ctx->pic.Color=NULL;
+    ctx->pic.Fresnell=NULL;
+    ctx->specular=NULL;
+    ctx->diffuse=NULL;
+    ctx->ambient=NULL;
     return;
 }
 
@@ -310,40 +1629,95 @@ static void ExitGlobals(void)
 
 /*****************************************************************
 
-    static Logical InitExtraGlobals(void)
+    static Logical InitContext(CONTEXT *ctx,Logical UseInk,
+                               Logical Linear)
 
-    Initializes the global variables.
+    Initializes a render context. The spectra of the paper, ink
+    and light are shared, the work vectors are allocated for
+    each context. In the linear shading mode the XYZ basis of
+    the paper and ink is made too.
 
 */
 
-static Logical InitExtraGlobals(void)
+static Logical InitContext(CONTEXT *ctx,Logical UseInk,Logical Linear)
 {
-    if((specular=ColorVectorInit())==NULL)
+    ClearContext(ctx);
+    ctx->UseInk=UseInk;
+    ctx->Linear=Linear;
+    ctx->papM=1.0;
+    ctx->inkM=0.0;
+    ctx->inked=FALSE;
+    ctx->conv=0.0;
+    ctx->roughness=0.0;
+    ctx->absorption=InkAbsorptionCoefficient();
+
+    /* Init pic */
+
+    if((ctx->pic.Color=ColorVectorInit())==NULL)
+        return FALSE;
+    if((ctx->pic.Fresnell=ColorVectorInit())==NULL)
+        return FALSE;
+    ctx->pic.Samples=ColorGetSize();
+
+    /* Init material data mtl */
+
+    if((ctx->mtl.Diffuse=PaperGetDiffuse())==NULL)
         return FALSE;
-    if((diffuse=ColorVectorInit())==NULL)
+    if((ctx->mtl.Specular=PaperGetSpecular())==NULL)
         return FALSE;
-    if((ambient=ColorVectorInit())==NULL)
+    if((ctx->mtl.Ambient=PaperGetAmbient())==NULL)
         return FALSE;
+    ctx->mtl.SpecularPower=0.0;
+    ctx->mtl.Ni=FresnelApproxN(ctx->mtl.Specular,&ctx->mtl.AveRefl,
+                               ctx->pic.Samples);
 
-    if((ink=MemoryAllocate(MATERIAL,1))==NULL)
+    /* Init light data lgt */
+
+    if((ctx->lgt.Ambient=LightAmbientColor())==NULL)
+        return FALSE;
+    if((ctx->lgt.Specular=LightSpecColor())==NULL)
+        return FALSE;
+
+    if(Linear==TRUE)
+        {
+        if(ColorGetXYZ(ctx->lgt.Specular,ctx->light)==FALSE)
+            return FALSE;
+        if(InitBasis(ctx,&ctx->paperBasis,ctx->mtl.Ambient,
+                     ctx->mtl.Diffuse,ctx->mtl.Specular)==FALSE)
+            return FALSE;
+        }
+
+    if(UseInk==FALSE)
+        return TRUE;
+
+    /* Init ink and paper materials and the mixing vectors */
+
+    if((ctx->specular=ColorVectorInit())==NULL)
         return FALSE;
-    if((paper=MemoryAllocate(MATERIAL,1))==NULL)
+    if((ctx->diffuse=ColorVectorInit())==NULL)
+        return FALSE;
+    if((ctx->ambient=ColorVectorInit())==NULL)
         return FALSE;
 
-    if((ink->Diffuse=InkGetDiffuse())==NULL)
+    if((ctx->ink.Diffuse=InkGetDiffuse())==NULL)
         return FALSE;
-    if((ink->Specular=InkGetSpecular())==NULL)
+    if((ctx->ink.Specular=InkGetSpecular())==NULL)
         return FALSE;
-    if((ink->Ambient=InkGetAmbient())==NULL)
+    if((ctx->ink.Ambient=InkGetAmbient())==NULL)
         return FALSE;
 
-    paper->Diffuse=mtl.Diffuse;
-    paper->Specular=mtl.Specular;
-    paper->Ambient=mtl.Ambient;
+    ctx->paper.Diffuse=ctx->mtl.Diffuse;
+    ctx->paper.Specular=ctx->mtl.Specular;
+    ctx->paper.Ambient=ctx->mtl.Ambient;
+
+    ctx->mtl.Diffuse=ctx->diffuse;
+    ctx->mtl.Specular=ctx->specular;
+    ctx->mtl.Ambient=ctx->ambient;
 
-    mtl.Diffuse=diffuse;
-    mtl.Specular=specular;
-    mtl.Ambient=ambient;
+    if(Linear==TRUE)
+        if(InitBasis(ctx,&ctx->inkBasis,ctx->ink.Ambient,
+                     ctx->ink.Diffuse,ctx->ink.Specular)==FALSE)
+            return FALSE;
     return TRUE;
 }
 
@@ -351,39 +1725,109 @@ static Logical InitExtraGlobals(void)
 
 /*****************************************************************
 
-    static void ExitExtraGlobals(void)
+    static Logical InitBasis(CONTEXT *ctx,BASIS *basis,
+                             ColorType Ambient,ColorType Diffuse,
+                             ColorType Specular)
 
-    Exits the extra global variables.
+    Converts the products of the light and material spectra to
+    XYZ once, using pic.Color as work vector. Also finds the
+    range of the Fresnel factor where no sample of the Blinn
+    reflectance is clipped.
 
 */
 
-static void ExitExtraGlobals(void)
+static Logical InitBasis(CONTEXT *ctx,BASIS *basis,ColorType Ambient,
+                         ColorType Diffuse,ColorType Specular)
 {
-    if(specular!=NULL)
-        {
-        ColorVectorExit(specular);
-        specular=NULL;
-        }
-    if(diffuse!=NULL)
-        {
-        ColorVectorExit(diffuse);
-        diffuse=NULL;
-        }
-    if(ambient!=NULL)
-        {
-        ColorVectorExit(ambient);
-        ambient=NULL;
-        }
-    if(ink!=NULL)
-        {
-        MemoryFree(ink);
-        ink=NULL;
-        }
-    if(paper!=NULL)
-        {
-        MemoryFree(paper);
-        paper=NULL;
-        }
+    ColorType tmp=ctx->pic.Color;
+    LIGHT *lgt=&ctx->lgt;
+    int ct;
+
+    for(ct=0;ct<ctx->pic.Samples;ct++)
+        tmp[ct]=lgt->Ambient[ct]*Ambient[ct];
+    if(ColorGetXYZ(tmp,basis->Ambient)==FALSE)
+        return FALSE;
+    for(ct=0;ct<ctx->pic.Samples;ct++)
+        tmp[ct]=lgt->Specular[ct]*Diffuse[ct];
+    if(ColorGetXYZ(tmp,basis->Diffuse)==FALSE)
+        return FALSE;
+    for(ct=0;ct<ctx->pic.Samples;ct++)
+        tmp[ct]=lgt->Specular[ct]*Specular[ct];
+    if(ColorGetXYZ(tmp,basis->Specular)==FALSE)
+        return FALSE;
+    for(ct=0;ct<ctx->pic.Samples;ct++)
+        tmp[ct]=lgt->Specular[ct]*(1.0-Specular[ct]);
+    if(ColorGetXYZ(tmp,basis->Fresnel)==FALSE)
+        return FALSE;
+
+    /* Specular+(1-Specular)*f>=0 */
+
+    basis->MinFactor=-HUGE_VAL;
+    basis->MaxFactor=HUGE_VAL;
+    for(ct=0;ct<ctx->pic.Samples;ct++)
+        if(Specular[ct]<1.0)
+            {
+            if(-Specular[ct]/(1.0-Specular[ct])>basis->MinFactor)
+                basis->MinFactor=-Specular[ct]/(1.0-Specular[ct]);
+            }
+        else if(Specular[ct]>1.0)
+            {
+            if(Specular[ct]/(Specular[ct]-1.0)<basis->MaxFactor)
+                basis->MaxFactor=Specular[ct]/(Specular[ct]-1.0);
+            }
+    return TRUE;
+}
+
+
+
+/*****************************************************************
+
+    static void ExitContext(CONTEXT *ctx)
+
+    Frees the work vectors of a render context.
+
+*/
+
+static void ExitContext(CONTEXT *ctx)
+{
+    if(ctx->pic.Color!=NULL)
+        ColorVectorExit(ctx->pic.Color);
+    if(ctx->pic.Fresnell!=NULL)
+        ColorVectorExit(ctx->pic.Fresnell);
+    ctx->pic.Color=NULL;
+    ctx->pic.Fresnell=NULL;
+    ctx->pic.Samples=0;
+
+    if(ctx->specular!=NULL)
+        ColorVectorExit(ctx->specular);
+    if(ctx->diffuse!=NULL)
+        ColorVectorExit(ctx->diffuse);
+    if(ctx->ambient!=NULL)
+        ColorVectorExit(ctx->ambient);
+    ctx->specular=NULL;
+    ctx->diffuse=NULL;
+    ctx->ambient=NULL;
+    return;
+}
+
+
+
+/*****************************************************************
+
+    static void ShareMaterial(CONTEXT *from,CONTEXT *to)
+
+    Gives the material of the pixel shaded with the context from
+    to the context to of another light. The mixed spectra are
+    not copied but shared, so both must be used by one thread.
+
+*/
+
+static void ShareMaterial(CONTEXT *from,CONTEXT *to)
+{
+    to->mtl=from->mtl;
+    to->papM=from->papM;
+    to->inkM=from->inkM;
+    to->inked=from->inked;
     return;
 }
 
@@ -391,125 +1835,255 @@ static void ExitExtraGlobals(void)
 
 /*****************************************************************
 
-    static RGBType *Phong(VECTOR *,VECTOR *,VECTOR *,POINT *);
+    static RGBType *Phong(CONTEXT *ctx,VECTOR *Normal,VECTOR *Light,
+                          VECTOR *View,Logical shadow,RGBType *rgb)
 
     Evaluates the color using the Phong (1975) Illumination
-    model. Returns TRUE upon success.
+    model. The color is stored to rgb. Only the ambient light
+    is seen if shadow is TRUE.
 
 */
 
-static RGBType *Phong(VECTOR *Normal,VECTOR *Light,VECTOR *View,POINT *px)
+static RGBType *Phong(CONTEXT *ctx,VECTOR *Normal,VECTOR *Light,
+                      VECTOR *View,Logical shadow,RGBType *rgb)
 {
-    int         ct;
     double      N_dot_L,D;
+    MATERIAL   *mtl=&ctx->mtl;
+    LIGHT      *lgt=&ctx->lgt;
+    PICTURE    *pic=&ctx->pic;
 
-    if(PaperSelfShadow(Light,px)==TRUE)
-        for (ct=0; ct<pic.Samples; ct++)
-            pic.Color[ct]=lgt.Ambient[ct]*mtl.Ambient[ct];
+    if(shadow==TRUE)
+        {
+        if(ctx->Linear==TRUE)
+            return LinearColor(ctx,0.0,0.0,0.0,0.0,rgb);
+        SpectMult(pic->Color,lgt->Ambient,mtl->Ambient,pic->Samples);
+        }
     else
         {
         N_dot_L=VectorDot(Normal,Light);
-        D=MFacetPhong(Normal,Light,View,mtl.SpecularPower);
-        for (ct=0; ct<pic.Samples; ct++)
-            pic.Color[ct]=lgt.Ambient[ct]*mtl.Ambient[ct]+
-                      lgt.Specular[ct]*
-                      (mtl.Diffuse[ct]*N_dot_L+mtl.Specular[ct]*D);
+        D=MFacetPhong(Normal,Light,View,mtl->SpecularPower);
+        if(ctx->Linear==TRUE)
+            return LinearColor(ctx,N_dot_L,D,0.0,0.0,rgb);
+        SpectShade(pic->Color,lgt->Ambient,mtl->Ambient,lgt->Specular,
+                   mtl->Diffuse,N_dot_L,mtl->Specular,D,pic->Samples);
         }
-    return ColorGetRGB(pic.Color);
+    return ColorGetRGB(pic->Color,rgb);
 }
 
 
 
 /*****************************************************************
 
-    static RGBType *Blinn(VECTOR *,VECTOR *,VECTOR *,POINT *)
+    static RGBType *Blinn(CONTEXT *ctx,VECTOR *Normal,VECTOR *Light,
+                          VECTOR *View,Logical shadow,RGBType *rgb)
 
     Evaluates the color using the Blinn illumination model.
+    The color is stored to rgb. Only the ambient light is seen
+    if shadow is TRUE.
 
 */
 
-static RGBType *Blinn(VECTOR *Normal,VECTOR *Light,VECTOR *View,POINT *px)
+static RGBType *Blinn(CONTEXT *ctx,VECTOR *Normal,VECTOR *Light,
+                      VECTOR *View,Logical shadow,RGBType *rgb)
 {
-    int   ct;
-    double N_dot_L, N_dot_V, D, G;
-    VECTOR *T,*H;
-
-    if(PaperSelfShadow(Light,px)==TRUE)
-        for (ct=0; ct<pic.Samples; ct++)
-            pic.Color[ct]=lgt.Ambient[ct]*mtl.Ambient[ct];
+    double N_dot_L, N_dot_V, D, G, factor;
+    VECTOR *T,*H,T_buf,H_buf;
+    MATERIAL   *mtl=&ctx->mtl;
+    LIGHT      *lgt=&ctx->lgt;
+    PICTURE    *pic=&ctx->pic;
+    BASIS      *spec;
+
+    if(shadow==TRUE)
+        {
+        if(ctx->Linear==TRUE)
+            return LinearColor(ctx,0.0,0.0,0.0,0.0,rgb);
+        SpectMult(pic->Color,lgt->Ambient,mtl->Ambient,pic->Samples);
+        }
     else
         {
         /* Calculate micro facet normal vector H
            and refracted vector T */
 
-        H=VectorH(Light,View);
-        T=VectorRefracted(Light,Normal,N_AIR,mtl.Ni);
+        H=VectorH(Light,View,&H_buf);
+        T=VectorRefracted(Light,Normal,N_AIR,mtl->Ni,&T_buf);
 
         /* Calculate nicro facet distribution D
            and geometric attenuation G
            and Fresnell reflection pic.Fressnell */
 
-        D=MFacetBlinn(Normal,Light,View,mtl.SpecularPower);
+        D=MFacetBlinn(Normal,Light,View,mtl->SpecularPower);
         G=GeometricTerm(Normal,Light,View,H);
-        FresnelApproxFr(Normal,Light,T,mtl.Specular,pic.Fresnell,N_AIR,
-                    mtl.Ni,mtl.AveRefl,pic.Samples);
-
         N_dot_L=VectorDot(Normal,Light);
         N_dot_V=VectorDot(Normal,View);
 
+        /* In the linear mode the spectral path is used only when
+           the Fresnel reflectance of some sample is clipped. */
+
+        if(ctx->Linear==TRUE)
+            {
+            spec=(ctx->inked==TRUE) ? &ctx->inkBasis : &ctx->paperBasis;
+            if(N_dot_V <= 0.0001)
+                return LinearColor(ctx,0.0,0.0,0.0,1.0,rgb);
+            if(T==NULL)
+                return LinearColor(ctx,N_dot_L,0.0,0.0,D*G/N_dot_V,rgb);
+            factor=(FresnelDR(Normal,Light,T,N_AIR,mtl->Ni)-mtl->AveRefl)/
+                   (1.0-mtl->AveRefl);
+            if(factor>=spec->MinFactor && factor<=spec->MaxFactor)
+                return LinearColor(ctx,N_dot_L,D*G/N_dot_V,
+                                   D*G/N_dot_V*factor,0.0,rgb);
+            MixSpectralColors(ctx);
+            }
+        FresnelApproxFr(Normal,Light,T,mtl->Specular,pic->Fresnell,N_AIR,
+                    mtl->Ni,mtl->AveRefl,pic->Samples);
+
         if(N_dot_V > 0.0001)
-            for(ct=0; ct<pic.Samples; ct++)
-                pic.Color[ct]=lgt.Ambient[ct]*mtl.Ambient[ct]
-                      +(N_dot_L*mtl.Diffuse[ct]
-                      +(D*G*pic.Fresnell[ct])/N_dot_V)
-                      *lgt.Specular[ct];
-        else
-            for(ct=0; ct<pic.Samples; ct++)  /* Full grazing angle */
-                pic.Color[ct]=lgt.Ambient[ct]*mtl.Ambient[ct]+lgt.Specular[ct];
+            SpectShade(pic->Color,lgt->Ambient,mtl->Ambient,lgt->Specular,
+                       mtl->Diffuse,N_dot_L,pic->Fresnell,D*G/N_dot_V,
+                       pic->Samples);
+        else                                  /* Full grazing angle */
+            SpectMultAdd(pic->Color,lgt->Ambient,mtl->Ambient,
+                         lgt->Specular,pic->Samples);
         }
-    return ColorGetRGB(pic.Color);
+    return ColorGetRGB(pic->Color,rgb);
 }
 
 
 
 /*****************************************************************
 
-    static double CalculateSpectralColors(POINT *px)
+    static void CalculateSpectralColors(CONTEXT *ctx,POINT *px)
 
-    Returns specular beta value.
+    Finds the paper and ink weights of the context for point px
+    and, unless the linear shading mode is used, mixes the
+    spectra. The specular beta of the pixel is the ink one if
+    ctx->inked is set, else the paper one. The terms of the ink
+    transfer are left to the context for the geometry buffer.
 
 */
 
-static double CalculateSpectralColors(POINT *px)
+static void CalculateSpectralColors(CONTEXT *ctx,POINT *px)
 {
-    double inkM,beta=0.0;
+    double inkM;
 
-    inkM=InkTransfer(px);
+    ctx->conv=InkTransferTerms(px,&ctx->roughness);
+    inkM=InkTransferOf(ctx->conv,ctx->roughness);
     if(inkM==0.0)
+        PaperColors(ctx);
+    else
+        InkColors(ctx,inkM);
+    return;
+}
+
+
+
+/*****************************************************************
+
+    static void PaperColors(CONTEXT *ctx)
+
+    Sets the materials of the context to those of the paper
+    without ink.
+
+*/
+
+static void PaperColors(CONTEXT *ctx)
+{
+    ctx->papM=1.0;
+    ctx->inkM=0.0;
+    ctx->inked=FALSE;
+    if(ctx->Linear==FALSE)
+        MixSpectralColors(ctx);
+    return;
+}
+
+
+
+/*****************************************************************
+
+    static void InkColors(CONTEXT *ctx,double transfer)
+
+    Sets the materials of the context to those of the paper
+    with ink transfer transfer, which is not zero.
+
+*/
+
+static void InkColors(CONTEXT *ctx,double transfer)
+{
+    ctx->papM=exp(-2*transfer*ctx->absorption);
+    ctx->inkM=1-ctx->papM;
+    ctx->inked=TRUE;
+    if(ctx->Linear==FALSE)
+        MixSpectralColors(ctx);
+    return;
+}
+
+
+
+/*****************************************************************
+
+    static void MixSpectralColors(CONTEXT *ctx)
+
+    Mixes the paper and ink spectra of the context with the
+    weights found by CalculateSpectralColors().
+
+*/
+
+static void MixSpectralColors(CONTEXT *ctx)
+{
+    MATERIAL *mtl=&ctx->mtl;
+
+    if(ctx->UseInk==FALSE)
+        return;
+    if(ctx->inked==FALSE)
         {
-        mtl.Specular=paper->Specular;
-        mtl.Diffuse=paper->Diffuse;
-        mtl.Ambient=paper->Ambient;
-        beta=PaperGetSpecularBeta(px);
+        mtl->Specular=ctx->paper.Specular;
+        mtl->Diffuse=ctx->paper.Diffuse;
+        mtl->Ambient=ctx->paper.Ambient;
         }
     else
         {
-        double papM;
-        int ct;
+        mtl->Specular=ctx->ink.Specular;
+        SpectMix(ctx->diffuse,ctx->paper.Diffuse,ctx->papM,
+                 ctx->ink.Diffuse,ctx->inkM,ctx->pic.Samples);
+        SpectMix(ctx->ambient,ctx->paper.Ambient,ctx->papM,
+                 ctx->ink.Ambient,ctx->inkM,ctx->pic.Samples);
+        mtl->Diffuse=ctx->diffuse;
+        mtl->Ambient=ctx->ambient;
+        }
+    return;
+}
 
-        papM=exp(-2*inkM*InkAbsorptionCoefficient());
-        inkM=1-papM;
-        beta=InkGetSpecularBeta();
-        mtl.Specular=ink->Specular;
-        for(ct=0;ct<pic.Samples;ct++)
-            {
-            diffuse[ct]=papM*paper->Diffuse[ct]+inkM*ink->Diffuse[ct];
-            ambient[ct]=papM*paper->Ambient[ct]+inkM*ink->Ambient[ct];
-            }
-        mtl.Diffuse=diffuse;
-        mtl.Ambient=ambient;
+
+
+/*****************************************************************
+
+    static RGBType *LinearColor(CONTEXT *ctx,double diffuse,
+                                double specular,double fresnel,
+                                double light,RGBType *rgb)
+
+    Makes the color in the linear shading mode as the sum of
+    the XYZ basis of the context, the ambient term with weight
+    one and the others with the weights given, and stores it to
+    rgb.
+
+*/
+
+static RGBType *LinearColor(CONTEXT *ctx,double diffuse,double specular,
+                            double fresnel,double light,RGBType *rgb)
+{
+    BASIS *pap=&ctx->paperBasis,*ink=&ctx->inkBasis,*spec;
+    double xyz[3];
+    int i;
+
+    spec=(ctx->inked==TRUE) ? ink : pap;
+    for(i=0;i<3;i++)
+        {
+        xyz[i]=ctx->papM*(pap->Ambient[i]+diffuse*pap->Diffuse[i])+
+               specular*spec->Specular[i]+fresnel*spec->Fresnel[i]+
+               light*ctx->light[i];
+        if(ctx->inkM!=0.0)
+            xyz[i]+=ctx->inkM*(ink->Ambient[i]+diffuse*ink->Diffuse[i]);
         }
-    return beta;
+    return ColorXYZGetRGB(xyz,rgb);
 }
 
 
@@ -594,11 +2168,7 @@ static void FresnelApproxFr(VECTOR *N,VECTOR *L,VECTOR *T,ColorType mtl,ColorTyp
     else
         {
          factor=(FresnelDR(N,L,T,ni,nt)-Ro)/(1.0-Ro);
-         for(ct=0;ct<samples;ct++)
-            {
-            if ((Fr[ct] = mtl[ct] + ((1.0-mtl[ct])*factor))<0.0)
-                Fr[ct] = 0.0;
-            }
+         SpectFresnel(Fr,mtl,factor,samples);
         }
     return;
 }
@@ -626,6 +2196,3 @@ static double FresnelDR(VECTOR *N,VECTOR *L,VECTOR *T,
     Rpl=((nt*N_dot_L)+(ni*N_dot_T))/((nt*N_dot_L)-(ni*N_dot_T));
     return (Rpl*Rpl+Rpp*Rpp)/2.0;
 }
-
-
-
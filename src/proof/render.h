@@ -21,17 +21,30 @@
 #include "c_types.h"
 #include "access.h"
 
+
+#define RENDER_MAX_THREADS 256
+#define RENDER_MAX_LIGHTS 8    /* Lights shaded in one render pass */
+
 typedef struct  {
     String      Name;
     TIFF *      Tif;
     double      PixelSize;
     int         X,Y;
+    u_long      Pixels;     /* X*Y, 64 bits on LP64 hosts */
     int         Model;
     double      ViewDir;
     Logical     UseInk;
+    int         Threads;
+    Logical     Linear;
+    Logical     GBuffer;
+    Logical     Texture;
+    int         Light;      /* Light written to Tif */
+    int         Lights;     /* Lights Light.. shaded in one pass, 0 if
+                               Light was shaded by an earlier pass */
                 } RenderType;
 
 Logical RenderImage(RenderType);
+void RenderExit(void);
 
 
 
@@ -0,0 +1,279 @@
+/**************************************************************/
+/* This software was made by Oskar Lnnberg                   */
+/*                                                            */
+/* Copyright (c) by Oskar Lnnberg                            */
+/*                                                            */
+/* Permission to use, copy, modify, distribute, and sell this */
+/* software and its documentation for any purpose is not      */
+/* granted without permission from the copyright owner.       */
+/**************************************************************/
+
+
+/*
+    Sched.c - Work-stealing job scheduler for the render threads
+
+    Every worker has a queue of its own. A worker takes jobs from
+    the head of its own queue and, when that is empty, steals from
+    the tail of the other queues. Jobs are plain integers, the
+    caller decides what they mean.
+
+    ASSUMPTIONS:
+        A worker number given to SchedPush and SchedGet is between
+        0 and the number of workers given to SchedInit.
+*/
+
+
+
+#include <pthread.h>
+#include "c_types.h"
+#include "buffer.h"
+#include "sched.h"
+
+
+
+/**************************************************************/
+
+/* structure and type definitions */
+
+typedef struct {
+        pthread_mutex_t lock;
+        int *jobs;          /* Ring of queued jobs */
+        int head;           /* Index of the first job */
+        int count;          /* Number of queued jobs */
+        } DEQUE;
+
+struct SchedStruct {
+        DEQUE *deques;      /* One queue for each worker */
+        int workers;
+        int size;           /* Size of one queue */
+        pthread_mutex_t lock;
+        pthread_cond_t work;    /* Jobs pushed or scheduler closed */
+        int queued;         /* Jobs in all queues */
+        Logical closed;     /* No more jobs will be pushed */
+        };
+
+
+/* Internal functions */
+
+static int SchedTake(SchedType,int);
+
+
+
+/**************************************************************/
+
+
+
+/**************************************************************
+
+    SchedType SchedInit(int workers,int size)
+
+    Creates a scheduler for workers threads. Each worker queue
+    holds at most size jobs. Returns NULL on error.
+
+*/
+
+SchedType SchedInit(int workers,int size)
+{
+    SchedType s;
+    int i;
+
+    if(workers<1 || size<1)
+        return NULL;
+    if((s=MemoryAllocate(struct SchedStruct,1))==NULL)
+        return NULL;
+    if((s->deques=MemoryAllocate(DEQUE,workers))==NULL)
+        goto error;
+    for(i=0;i<workers;i++)
+        s->deques[i].jobs=NULL;
+    for(i=0;i<workers;i++)
+        {
+        if((s->deques[i].jobs=MemoryAllocate(int,size))==NULL)
+            goto error;
+        s->deques[i].head=0;
+        s->deques[i].count=0;
+        pthread_mutex_init(&s->deques[i].lock,NULL);
+        }
+    s->workers=workers;
+    s->size=size;
+    s->queued=0;
+    s->closed=FALSE;
+    pthread_mutex_init(&s->lock,NULL);
+    pthread_cond_init(&s->work,NULL);
+    return s;
+
+error:
+    if(s->deques!=NULL)
+        {
+        for(i=0;i<workers && s->deques[i].jobs!=NULL;i++)
+            {
+            pthread_mutex_destroy(&s->deques[i].lock);
+            MemoryFree(s->deques[i].jobs);
+            }
+        MemoryFree(s->deques);
+        }
+    MemoryFree(s);
+    return NULL;
+}
+
+
+
+/**************************************************************
+
+    void SchedExit(SchedType s)
+
+    Frees the scheduler. No thread may use it any more.
+
+*/
+
+void SchedExit(SchedType s)
+{
+    int i;
+
+    if(s==NULL)
+        return;
+    for(i=0;i<s->workers;i++)
+        {
+        pthread_mutex_destroy(&s->deques[i].lock);
+        MemoryFree(s->deques[i].jobs);
+        }
+    MemoryFree(s->deques);
+    pthread_cond_destroy(&s->work);
+    pthread_mutex_destroy(&s->lock);
+    MemoryFree(s);
+    return;
+}
+
+
+
+/**************************************************************
+
+    Logical SchedPush(SchedType s,int worker,int job)
+
+    Adds job to the tail of the queue of worker. Returns FALSE
+    if the queue is full or the scheduler is closed.
+
+*/
+
+Logical SchedPush(SchedType s,int worker,int job)
+{
+    DEQUE *d=&s->deques[worker];
+
+    if(s->closed==TRUE || job<0)
+        return FALSE;
+    pthread_mutex_lock(&d->lock);
+    if(d->count==s->size)
+        {
+        pthread_mutex_unlock(&d->lock);
+        return FALSE;
+        }
+    d->jobs[(d->head+d->count)%s->size]=job;
+    d->count++;
+    pthread_mutex_unlock(&d->lock);
+
+    pthread_mutex_lock(&s->lock);
+    s->queued++;
+    pthread_cond_signal(&s->work);
+    pthread_mutex_unlock(&s->lock);
+    return TRUE;
+}
+
+
+
+/**************************************************************
+
+    int SchedGet(SchedType s,int worker)
+
+    Returns the next job for worker. Waits while all queues are
+    empty. Returns SCHED_DONE when the scheduler is closed and
+    all jobs have been taken.
+
+*/
+
+int SchedGet(SchedType s,int worker)
+{
+    int job;
+
+    for(;;)
+        {
+        if((job=SchedTake(s,worker))!=SCHED_DONE)
+            return job;
+        pthread_mutex_lock(&s->lock);
+        while(s->queued==0 && s->closed==FALSE)
+            pthread_cond_wait(&s->work,&s->lock);
+        if(s->queued==0)
+            {
+            pthread_mutex_unlock(&s->lock);
+            return SCHED_DONE;
+            }
+        pthread_mutex_unlock(&s->lock);
+        }
+}
+
+
+
+/**************************************************************
+
+    void SchedClose(SchedType s)
+
+    Tells the workers that no more jobs will be pushed.
+
+*/
+
+void SchedClose(SchedType s)
+{
+    pthread_mutex_lock(&s->lock);
+    s->closed=TRUE;
+    pthread_cond_broadcast(&s->work);
+    pthread_mutex_unlock(&s->lock);
+    return;
+}
+
+
+
+
+/**************************************************************
+    Internal functions for this file
+***************************************************************/
+
+
+
+/**************************************************************
+
+    static int SchedTake(SchedType s,int worker)
+
+    Takes a job from the head of the own queue or steals one from
+    the tail of another queue. Returns SCHED_DONE if all queues
+    are empty.
+
+*/
+
+static int SchedTake(SchedType s,int worker)
+{
+    DEQUE *d;
+    int i,job=SCHED_DONE;
+
+    for(i=0;i<s->workers && job==SCHED_DONE;i++)
+        {
+        d=&s->deques[(worker+i)%s->workers];
+        pthread_mutex_lock(&d->lock);
+        if(d->count>0)
+            {
+            d->count--;
+            if(i==0)
+                {
+                job=d->jobs[d->head];
+                d->head=(d->head+1)%s->size;
+                }
+            else
+                job=d->jobs[(d->head+d->count)%s->size];
+            }
+        pthread_mutex_unlock(&d->lock);
+        }
+    if(job!=SCHED_DONE)
+        {
+        pthread_mutex_lock(&s->lock);
+        s->queued--;
+        pthread_mutex_unlock(&s->lock);
+        }
+    return job;
+}
@@ -0,0 +1,35 @@
+/**************************************************************/
+/* This software was made by Oskar Lnnberg                   */
+/*                                                            */
+/* Copyright (c) by Oskar Lnnberg                            */
+/*                                                            */
+/* Permission to use, copy, modify, distribute, and sell this */
+/* software and its documentation for any purpose is not      */
+/* granted without permission from the copyright owner.       */
+/**************************************************************/
+
+
+/*
+    Sched.h - Headerfile for Sched.c
+*/
+
+
+#ifndef __SCHED__
+#define __SCHED__
+
+
+#include "c_types.h"
+
+
+#define SCHED_DONE -1      /* SchedGet: no more jobs will come */
+
+typedef struct SchedStruct *SchedType;
+
+SchedType SchedInit(int,int);
+void SchedExit(SchedType);
+Logical SchedPush(SchedType,int,int);
+int SchedGet(SchedType,int);
+void SchedClose(SchedType);
+
+
+#endif /* __SCHED__ */
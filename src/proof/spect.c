@@ -0,0 +1,821 @@
+/**************************************************************/
+/* This software was made by Oskar Lnnberg                   */
+/*                                                            */
+/* Copyright (c) by Oskar Lnnberg                            */
+/*                                                            */
+/* Permission to use, copy, modify, distribute, and sell this */
+/* software and its documentation for any purpose is not      */
+/* granted without permission from the copyright owner.       */
+/**************************************************************/
+
+
+/*
+    Spect.c - Kernels for the arithmetic of spectral vectors
+
+    Every kernel has a portable scalar version and, when compiled
+    with gcc for x86, SSE2, AVX2 and AVX-512 versions. SpectInit
+    picks the widest set the processor supports. The element wise
+    kernels of the scalar and SSE2 sets give the same results; the
+    AVX2 and AVX-512 sets use fused multiply-add and all vector
+    sets sum the reductions in a different order, so their results
+    differ from the scalar ones by rounding only.
+
+    With SINGLE_PRECISION the color type is float. The element wise
+    kernels then compute in float, a few roundings of 2^-24 each,
+    and the reductions still sum in double. A color differs from
+    the double build by less than 1e-6 relatively, against the
+    1/255 step of the 8 bit output, so a channel can change by one
+    step only next to a rounding boundary.
+
+    ASSUMPTIONS:
+        The vectors of one call do not overlap, except that the
+        result may be one of the arguments.
+*/
+
+
+
+#include "c_types.h"
+#include "color.h"
+#include "spect.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SPECT_X86
+#include <immintrin.h>
+#endif /* __GNUC__ && x86 */
+
+
+
+/**************************************************************/
+
+/* structure and type definitions */
+
+typedef struct {
+        void (*Mult)(ColorType,ColorType,ColorType,int);
+        void (*MultAdd)(ColorType,ColorType,ColorType,ColorType,int);
+        void (*Shade)(ColorType,ColorType,ColorType,ColorType,
+                      ColorType,double,ColorType,double,int);
+        void (*Mix)(ColorType,ColorType,double,ColorType,double,int);
+        void (*Fresnel)(ColorType,ColorType,double,int);
+        double (*Dot)(ColorType,ColorType,int);
+        double (*Sum)(ColorType,int);
+        } KERNELS;
+
+
+/* Internal functions */
+
+static void MultScalar(ColorType,ColorType,ColorType,int);
+static void MultAddScalar(ColorType,ColorType,ColorType,ColorType,int);
+static void ShadeScalar(ColorType,ColorType,ColorType,ColorType,
+                        ColorType,double,ColorType,double,int);
+static void MixScalar(ColorType,ColorType,double,ColorType,double,int);
+static void FresnelScalar(ColorType,ColorType,double,int);
+static double DotScalar(ColorType,ColorType,int);
+static double SumScalar(ColorType,int);
+
+#ifdef SPECT_X86
+
+#define SSE2   __attribute__((target("sse2")))
+#define AVX2   __attribute__((target("avx2,fma")))
+#define AVX512 __attribute__((target("avx512f")))
+
+/* The element wise kernels work on the color type, the
+   reductions load it as doubles */
+
+#ifdef SINGLE_PRECISION
+
+#define SSE_N            4
+#define SSE_T            __m128
+#define SSE_LOAD         _mm_loadu_ps
+#define SSE_STORE        _mm_storeu_ps
+#define SSE_SET1         _mm_set1_ps
+#define SSE_ZERO         _mm_setzero_ps
+#define SSE_ADD          _mm_add_ps
+#define SSE_SUB          _mm_sub_ps
+#define SSE_MUL          _mm_mul_ps
+#define SSE_MAX          _mm_max_ps
+#define SSE_WIDEN(p)     _mm_cvtps_pd(_mm_castsi128_ps( \
+                                      _mm_loadl_epi64((__m128i *)(p))))
+
+#define AVX_N            8
+#define AVX_T            __m256
+#define AVX_LOAD         _mm256_loadu_ps
+#define AVX_STORE        _mm256_storeu_ps
+#define AVX_SET1         _mm256_set1_ps
+#define AVX_ZERO         _mm256_setzero_ps
+#define AVX_SUB          _mm256_sub_ps
+#define AVX_MUL          _mm256_mul_ps
+#define AVX_MAX          _mm256_max_ps
+#define AVX_FMADD        _mm256_fmadd_ps
+#define AVX_WIDEN(p)     _mm256_cvtps_pd(_mm_loadu_ps(p))
+
+#define AVX512_N         16
+#define AVX512_T         __m512
+#define AVX512_LOAD      _mm512_loadu_ps
+#define AVX512_STORE     _mm512_storeu_ps
+#define AVX512_SET1      _mm512_set1_ps
+#define AVX512_ZERO      _mm512_setzero_ps
+#define AVX512_SUB       _mm512_sub_ps
+#define AVX512_MUL       _mm512_mul_ps
+#define AVX512_MAX       _mm512_max_ps
+#define AVX512_FMADD     _mm512_fmadd_ps
+#define AVX512_WIDEN(p)  _mm512_cvtps_pd(_mm256_loadu_ps(p))
+
+#else /* SINGLE_PRECISION */
+
+#define SSE_N            2
+#define SSE_T            __m128d
+#define SSE_LOAD         _mm_loadu_pd
+#define SSE_STORE        _mm_storeu_pd
+#define SSE_SET1         _mm_set1_pd
+#define SSE_ZERO         _mm_setzero_pd
+#define SSE_ADD          _mm_add_pd
+#define SSE_SUB          _mm_sub_pd
+#define SSE_MUL          _mm_mul_pd
+#define SSE_MAX          _mm_max_pd
+#define SSE_WIDEN(p)     _mm_loadu_pd(p)
+
+#define AVX_N            4
+#define AVX_T            __m256d
+#define AVX_LOAD         _mm256_loadu_pd
+#define AVX_STORE        _mm256_storeu_pd
+#define AVX_SET1         _mm256_set1_pd
+#define AVX_ZERO         _mm256_setzero_pd
+#define AVX_SUB          _mm256_sub_pd
+#define AVX_MUL          _mm256_mul_pd
+#define AVX_MAX          _mm256_max_pd
+#define AVX_FMADD        _mm256_fmadd_pd
+#define AVX_WIDEN(p)     _mm256_loadu_pd(p)
+
+#define AVX512_N         8
+#define AVX512_T         __m512d
+#define AVX512_LOAD      _mm512_loadu_pd
+#define AVX512_STORE     _mm512_storeu_pd
+#define AVX512_SET1      _mm512_set1_pd
+#define AVX512_ZERO      _mm512_setzero_pd
+#define AVX512_SUB       _mm512_sub_pd
+#define AVX512_MUL       _mm512_mul_pd
+#define AVX512_MAX       _mm512_max_pd
+#define AVX512_FMADD     _mm512_fmadd_pd
+#define AVX512_WIDEN(p)  _mm512_loadu_pd(p)
+
+#endif /* SINGLE_PRECISION */
+
+static SSE2 void MultSSE2(ColorType,ColorType,ColorType,int);
+static SSE2 void MultAddSSE2(ColorType,ColorType,ColorType,ColorType,int);
+static SSE2 void ShadeSSE2(ColorType,ColorType,ColorType,ColorType,
+                           ColorType,double,ColorType,double,int);
+static SSE2 void MixSSE2(ColorType,ColorType,double,ColorType,double,int);
+static SSE2 void FresnelSSE2(ColorType,ColorType,double,int);
+static SSE2 double DotSSE2(ColorType,ColorType,int);
+static SSE2 double SumSSE2(ColorType,int);
+
+static AVX2 void MultAVX2(ColorType,ColorType,ColorType,int);
+static AVX2 void MultAddAVX2(ColorType,ColorType,ColorType,ColorType,int);
+static AVX2 void ShadeAVX2(ColorType,ColorType,ColorType,ColorType,
+                           ColorType,double,ColorType,double,int);
+static AVX2 void MixAVX2(ColorType,ColorType,double,ColorType,double,int);
+static AVX2 void FresnelAVX2(ColorType,ColorType,double,int);
+static AVX2 double DotAVX2(ColorType,ColorType,int);
+static AVX2 double SumAVX2(ColorType,int);
+
+static AVX512 void MultAVX512(ColorType,ColorType,ColorType,int);
+static AVX512 void MultAddAVX512(ColorType,ColorType,ColorType,ColorType,int);
+static AVX512 void ShadeAVX512(ColorType,ColorType,ColorType,ColorType,
+                               ColorType,double,ColorType,double,int);
+static AVX512 void MixAVX512(ColorType,ColorType,double,ColorType,double,int);
+static AVX512 void FresnelAVX512(ColorType,ColorType,double,int);
+static AVX512 double DotAVX512(ColorType,ColorType,int);
+static AVX512 double SumAVX512(ColorType,int);
+
+#endif /* SPECT_X86 */
+
+
+/* Global variables for this file */
+
+static KERNELS kernels={ MultScalar, MultAddScalar, ShadeScalar,
+                         MixScalar, FresnelScalar, DotScalar, SumScalar };
+
+
+
+/**************************************************************/
+
+
+
+/**************************************************************
+
+    int SpectInit(int max)
+
+    Selects the widest kernel set up to max that the processor
+    supports. Returns the set selected.
+
+*/
+
+int SpectInit(int max)
+{
+    int level=SPECT_SCALAR;
+
+#ifdef SPECT_X86
+    __builtin_cpu_init();
+    if(max>=SPECT_AVX512 && __builtin_cpu_supports("avx512f"))
+        level=SPECT_AVX512;
+    else if(max>=SPECT_AVX2 && __builtin_cpu_supports("avx2") &&
+            __builtin_cpu_supports("fma"))
+        level=SPECT_AVX2;
+    else if(max>=SPECT_SSE2 && __builtin_cpu_supports("sse2"))
+        level=SPECT_SSE2;
+
+    switch(level)
+        {
+        case SPECT_AVX512:
+            kernels.Mult=MultAVX512;
+            kernels.MultAdd=MultAddAVX512;
+            kernels.Shade=ShadeAVX512;
+            kernels.Mix=MixAVX512;
+            kernels.Fresnel=FresnelAVX512;
+            kernels.Dot=DotAVX512;
+            kernels.Sum=SumAVX512;
+            return level;
+        case SPECT_AVX2:
+            kernels.Mult=MultAVX2;
+            kernels.MultAdd=MultAddAVX2;
+            kernels.Shade=ShadeAVX2;
+            kernels.Mix=MixAVX2;
+            kernels.Fresnel=FresnelAVX2;
+            kernels.Dot=DotAVX2;
+            kernels.Sum=SumAVX2;
+            return level;
+        case SPECT_SSE2:
+            kernels.Mult=MultSSE2;
+            kernels.MultAdd=MultAddSSE2;
+            kernels.Shade=ShadeSSE2;
+            kernels.Mix=MixSSE2;
+            kernels.Fresnel=FresnelSSE2;
+            kernels.Dot=DotSSE2;
+            kernels.Sum=SumSSE2;
+            return level;
+        }
+#endif /* SPECT_X86 */
+
+    kernels.Mult=MultScalar;
+    kernels.MultAdd=MultAddScalar;
+    kernels.Shade=ShadeScalar;
+    kernels.Mix=MixScalar;
+    kernels.Fresnel=FresnelScalar;
+    kernels.Dot=DotScalar;
+    kernels.Sum=SumScalar;
+    return level;
+}
+
+
+
+/**************************************************************
+
+    void SpectMult(ColorType c,ColorType a,ColorType b,int n)
+
+    c=a*b
+
+*/
+
+void SpectMult(ColorType c,ColorType a,ColorType b,int n)
+{
+    (*kernels.Mult)(c,a,b,n);
+    return;
+}
+
+
+
+/**************************************************************
+
+    void SpectMultAdd(ColorType c,ColorType a,ColorType b,
+                      ColorType d,int n)
+
+    c=a*b+d
+
+*/
+
+void SpectMultAdd(ColorType c,ColorType a,ColorType b,ColorType d,int n)
+{
+    (*kernels.MultAdd)(c,a,b,d,n);
+    return;
+}
+
+
+
+/**************************************************************
+
+    void SpectShade(ColorType c,ColorType la,ColorType ma,
+                    ColorType ls,ColorType md,double kd,
+                    ColorType ms,double ks,int n)
+
+    c=la*ma+ls*(md*kd+ms*ks), the color of the illumination
+    models.
+
+*/
+
+void SpectShade(ColorType c,ColorType la,ColorType ma,ColorType ls,
+                ColorType md,double kd,ColorType ms,double ks,int n)
+{
+    (*kernels.Shade)(c,la,ma,ls,md,kd,ms,ks,n);
+    return;
+}
+
+
+
+/**************************************************************
+
+    void SpectMix(ColorType c,ColorType a,double ka,
+                  ColorType b,double kb,int n)
+
+    c=ka*a+kb*b
+
+*/
+
+void SpectMix(ColorType c,ColorType a,double ka,ColorType b,double kb,int n)
+{
+    (*kernels.Mix)(c,a,ka,b,kb,n);
+    return;
+}
+
+
+
+/**************************************************************
+
+    void SpectFresnel(ColorType fr,ColorType ms,double f,int n)
+
+    fr=ms+(1-ms)*f clipped to zero, the approximate Fresnel
+    reflectance.
+
+*/
+
+void SpectFresnel(ColorType fr,ColorType ms,double f,int n)
+{
+    (*kernels.Fresnel)(fr,ms,f,n);
+    return;
+}
+
+
+
+/**************************************************************
+
+    double SpectDot(ColorType a,ColorType b,int n)
+
+    Returns the sum of a*b.
+
+*/
+
+double SpectDot(ColorType a,ColorType b,int n)
+{
+    return (*kernels.Dot)(a,b,n);
+}
+
+
+
+/**************************************************************
+
+    double SpectSum(ColorType a,int n)
+
+    Returns the sum of a.
+
+*/
+
+double SpectSum(ColorType a,int n)
+{
+    return (*kernels.Sum)(a,n);
+}
+
+
+
+
+/**************************************************************
+    Internal functions for this file
+***************************************************************/
+
+
+
+/**************************************************************
+
+    Scalar kernels
+
+*/
+
+static void MultScalar(ColorType c,ColorType a,ColorType b,int n)
+{
+    int i;
+
+    for(i=0;i<n;i++)
+        c[i]=a[i]*b[i];
+    return;
+}
+
+
+static void MultAddScalar(ColorType c,ColorType a,ColorType b,ColorType d,
+                          int n)
+{
+    int i;
+
+    for(i=0;i<n;i++)
+        c[i]=a[i]*b[i]+d[i];
+    return;
+}
+
+
+static void ShadeScalar(ColorType c,ColorType la,ColorType ma,ColorType ls,
+                        ColorType md,double kd,ColorType ms,double ks,int n)
+{
+    int i;
+
+    for(i=0;i<n;i++)
+        c[i]=la[i]*ma[i]+ls[i]*(md[i]*kd+ms[i]*ks);
+    return;
+}
+
+
+static void MixScalar(ColorType c,ColorType a,double ka,ColorType b,
+                      double kb,int n)
+{
+    int i;
+
+    for(i=0;i<n;i++)
+        c[i]=ka*a[i]+kb*b[i];
+    return;
+}
+
+
+static void FresnelScalar(ColorType fr,ColorType ms,double f,int n)
+{
+    int i;
+
+    for(i=0;i<n;i++)
+        if((fr[i]=ms[i]+((1.0-ms[i])*f))<0.0)
+            fr[i]=0.0;
+    return;
+}
+
+
+static double DotScalar(ColorType a,ColorType b,int n)
+{
+    double sum=0.0;
+    int i;
+
+    for(i=0;i<n;i++)
+        sum+=(double)a[i]*b[i];
+    return sum;
+}
+
+
+static double SumScalar(ColorType a,int n)
+{
+    double sum=0.0;
+    int i;
+
+    for(i=0;i<n;i++)
+        sum+=a[i];
+    return sum;
+}
+
+
+
+#ifdef SPECT_X86
+
+/**************************************************************
+
+    SSE2 kernels, SSE_N samples at a time
+
+*/
+
+static SSE2 void MultSSE2(ColorType c,ColorType a,ColorType b,int n)
+{
+    int i;
+
+    for(i=0;i+SSE_N<=n;i+=SSE_N)
+        SSE_STORE(c+i,SSE_MUL(SSE_LOAD(a+i),SSE_LOAD(b+i)));
+    for(;i<n;i++)
+        c[i]=a[i]*b[i];
+    return;
+}
+
+
+static SSE2 void MultAddSSE2(ColorType c,ColorType a,ColorType b,
+                             ColorType d,int n)
+{
+    int i;
+
+    for(i=0;i+SSE_N<=n;i+=SSE_N)
+        SSE_STORE(c+i,SSE_ADD(SSE_MUL(SSE_LOAD(a+i),SSE_LOAD(b+i)),
+                              SSE_LOAD(d+i)));
+    for(;i<n;i++)
+        c[i]=a[i]*b[i]+d[i];
+    return;
+}
+
+
+static SSE2 void ShadeSSE2(ColorType c,ColorType la,ColorType ma,
+                           ColorType ls,ColorType md,double kd,
+                           ColorType ms,double ks,int n)
+{
+    SSE_T vkd=SSE_SET1(kd),vks=SSE_SET1(ks),t;
+    int i;
+
+    for(i=0;i+SSE_N<=n;i+=SSE_N)
+        {
+        t=SSE_ADD(SSE_MUL(SSE_LOAD(md+i),vkd),SSE_MUL(SSE_LOAD(ms+i),vks));
+        SSE_STORE(c+i,SSE_ADD(SSE_MUL(SSE_LOAD(la+i),SSE_LOAD(ma+i)),
+                              SSE_MUL(SSE_LOAD(ls+i),t)));
+        }
+    for(;i<n;i++)
+        c[i]=la[i]*ma[i]+ls[i]*(md[i]*kd+ms[i]*ks);
+    return;
+}
+
+
+static SSE2 void MixSSE2(ColorType c,ColorType a,double ka,ColorType b,
+                         double kb,int n)
+{
+    SSE_T vka=SSE_SET1(ka),vkb=SSE_SET1(kb);
+    int i;
+
+    for(i=0;i+SSE_N<=n;i+=SSE_N)
+        SSE_STORE(c+i,SSE_ADD(SSE_MUL(vka,SSE_LOAD(a+i)),
+                              SSE_MUL(vkb,SSE_LOAD(b+i))));
+    for(;i<n;i++)
+        c[i]=ka*a[i]+kb*b[i];
+    return;
+}
+
+
+static SSE2 void FresnelSSE2(ColorType fr,ColorType ms,double f,int n)
+{
+    SSE_T vf=SSE_SET1(f),one=SSE_SET1(1.0),zero=SSE_ZERO(),m;
+    int i;
+
+    for(i=0;i+SSE_N<=n;i+=SSE_N)
+        {
+        m=SSE_LOAD(ms+i);
+        SSE_STORE(fr+i,SSE_MAX(SSE_ADD(m,SSE_MUL(SSE_SUB(one,m),vf)),zero));
+        }
+    for(;i<n;i++)
+        if((fr[i]=ms[i]+((1.0-ms[i])*f))<0.0)
+            fr[i]=0.0;
+    return;
+}
+
+
+static SSE2 double DotSSE2(ColorType a,ColorType b,int n)
+{
+    __m128d acc=_mm_setzero_pd();
+    double lane[2],sum;
+    int i;
+
+    for(i=0;i+2<=n;i+=2)
+        acc=_mm_add_pd(acc,_mm_mul_pd(SSE_WIDEN(a+i),SSE_WIDEN(b+i)));
+    _mm_storeu_pd(lane,acc);
+    for(sum=lane[0]+lane[1];i<n;i++)
+        sum+=(double)a[i]*b[i];
+    return sum;
+}
+
+
+static SSE2 double SumSSE2(ColorType a,int n)
+{
+    __m128d acc=_mm_setzero_pd();
+    double lane[2],sum;
+    int i;
+
+    for(i=0;i+2<=n;i+=2)
+        acc=_mm_add_pd(acc,SSE_WIDEN(a+i));
+    _mm_storeu_pd(lane,acc);
+    for(sum=lane[0]+lane[1];i<n;i++)
+        sum+=a[i];
+    return sum;
+}
+
+
+
+/**************************************************************
+
+    AVX2 kernels, AVX_N samples at a time with fused
+    multiply-add
+
+*/
+
+static AVX2 void MultAVX2(ColorType c,ColorType a,ColorType b,int n)
+{
+    int i;
+
+    for(i=0;i+AVX_N<=n;i+=AVX_N)
+        AVX_STORE(c+i,AVX_MUL(AVX_LOAD(a+i),AVX_LOAD(b+i)));
+    for(;i<n;i++)
+        c[i]=a[i]*b[i];
+    return;
+}
+
+
+static AVX2 void MultAddAVX2(ColorType c,ColorType a,ColorType b,
+                             ColorType d,int n)
+{
+    int i;
+
+    for(i=0;i+AVX_N<=n;i+=AVX_N)
+        AVX_STORE(c+i,AVX_FMADD(AVX_LOAD(a+i),AVX_LOAD(b+i),AVX_LOAD(d+i)));
+    for(;i<n;i++)
+        c[i]=a[i]*b[i]+d[i];
+    return;
+}
+
+
+static AVX2 void ShadeAVX2(ColorType c,ColorType la,ColorType ma,
+                           ColorType ls,ColorType md,double kd,
+                           ColorType ms,double ks,int n)
+{
+    AVX_T vkd=AVX_SET1(kd),vks=AVX_SET1(ks),t;
+    int i;
+
+    for(i=0;i+AVX_N<=n;i+=AVX_N)
+        {
+        t=AVX_FMADD(AVX_LOAD(md+i),vkd,AVX_MUL(AVX_LOAD(ms+i),vks));
+        AVX_STORE(c+i,AVX_FMADD(AVX_LOAD(ls+i),t,
+                                AVX_MUL(AVX_LOAD(la+i),AVX_LOAD(ma+i))));
+        }
+    for(;i<n;i++)
+        c[i]=la[i]*ma[i]+ls[i]*(md[i]*kd+ms[i]*ks);
+    return;
+}
+
+
+static AVX2 void MixAVX2(ColorType c,ColorType a,double ka,ColorType b,
+                         double kb,int n)
+{
+    AVX_T vka=AVX_SET1(ka),vkb=AVX_SET1(kb);
+    int i;
+
+    for(i=0;i+AVX_N<=n;i+=AVX_N)
+        AVX_STORE(c+i,AVX_FMADD(vka,AVX_LOAD(a+i),
+                                AVX_MUL(vkb,AVX_LOAD(b+i))));
+    for(;i<n;i++)
+        c[i]=ka*a[i]+kb*b[i];
+    return;
+}
+
+
+static AVX2 void FresnelAVX2(ColorType fr,ColorType ms,double f,int n)
+{
+    AVX_T vf=AVX_SET1(f),one=AVX_SET1(1.0),zero=AVX_ZERO(),m;
+    int i;
+
+    for(i=0;i+AVX_N<=n;i+=AVX_N)
+        {
+        m=AVX_LOAD(ms+i);
+        AVX_STORE(fr+i,AVX_MAX(AVX_FMADD(AVX_SUB(one,m),vf,m),zero));
+        }
+    for(;i<n;i++)
+        if((fr[i]=ms[i]+((1.0-ms[i])*f))<0.0)
+            fr[i]=0.0;
+    return;
+}
+
+
+static AVX2 double DotAVX2(ColorType a,ColorType b,int n)
+{
+    __m256d acc=_mm256_setzero_pd();
+    double lane[4],sum;
+    int i;
+
+    for(i=0;i+4<=n;i+=4)
+        acc=_mm256_fmadd_pd(AVX_WIDEN(a+i),AVX_WIDEN(b+i),acc);
+    _mm256_storeu_pd(lane,acc);
+    for(sum=(lane[0]+lane[1])+(lane[2]+lane[3]);i<n;i++)
+        sum+=(double)a[i]*b[i];
+    return sum;
+}
+
+
+static AVX2 double SumAVX2(ColorType a,int n)
+{
+    __m256d acc=_mm256_setzero_pd();
+    double lane[4],sum;
+    int i;
+
+    for(i=0;i+4<=n;i+=4)
+        acc=_mm256_add_pd(acc,AVX_WIDEN(a+i));
+    _mm256_storeu_pd(lane,acc);
+    for(sum=(lane[0]+lane[1])+(lane[2]+lane[3]);i<n;i++)
+        sum+=a[i];
+    return sum;
+}
+
+
+
+/**************************************************************
+
+    AVX-512 kernels, AVX512_N samples at a time with fused
+    multiply-add
+
+*/
+
+static AVX512 void MultAVX512(ColorType c,ColorType a,ColorType b,int n)
+{
+    int i;
+
+    for(i=0;i+AVX512_N<=n;i+=AVX512_N)
+        AVX512_STORE(c+i,AVX512_MUL(AVX512_LOAD(a+i),AVX512_LOAD(b+i)));
+    for(;i<n;i++)
+        c[i]=a[i]*b[i];
+    return;
+}
+
+
+static AVX512 void MultAddAVX512(ColorType c,ColorType a,ColorType b,
+                                 ColorType d,int n)
+{
+    int i;
+
+    for(i=0;i+AVX512_N<=n;i+=AVX512_N)
+        AVX512_STORE(c+i,AVX512_FMADD(AVX512_LOAD(a+i),AVX512_LOAD(b+i),
+                                      AVX512_LOAD(d+i)));
+    for(;i<n;i++)
+        c[i]=a[i]*b[i]+d[i];
+    return;
+}
+
+
+static AVX512 void ShadeAVX512(ColorType c,ColorType la,ColorType ma,
+                               ColorType ls,ColorType md,double kd,
+                               ColorType ms,double ks,int n)
+{
+    AVX512_T vkd=AVX512_SET1(kd),vks=AVX512_SET1(ks),t;
+    int i;
+
+    for(i=0;i+AVX512_N<=n;i+=AVX512_N)
+        {
+        t=AVX512_FMADD(AVX512_LOAD(md+i),vkd,
+                       AVX512_MUL(AVX512_LOAD(ms+i),vks));
+        AVX512_STORE(c+i,AVX512_FMADD(AVX512_LOAD(ls+i),t,
+                         AVX512_MUL(AVX512_LOAD(la+i),AVX512_LOAD(ma+i))));
+        }
+    for(;i<n;i++)
+        c[i]=la[i]*ma[i]+ls[i]*(md[i]*kd+ms[i]*ks);
+    return;
+}
+
+
+static AVX512 void MixAVX512(ColorType c,ColorType a,double ka,ColorType b,
+                             double kb,int n)
+{
+    AVX512_T vka=AVX512_SET1(ka),vkb=AVX512_SET1(kb);
+    int i;
+
+    for(i=0;i+AVX512_N<=n;i+=AVX512_N)
+        AVX512_STORE(c+i,AVX512_FMADD(vka,AVX512_LOAD(a+i),
+                                      AVX512_MUL(vkb,AVX512_LOAD(b+i))));
+    for(;i<n;i++)
+        c[i]=ka*a[i]+kb*b[i];
+    return;
+}
+
+
+static AVX512 void FresnelAVX512(ColorType fr,ColorType ms,double f,int n)
+{
+    AVX512_T vf=AVX512_SET1(f),one=AVX512_SET1(1.0),zero=AVX512_ZERO(),m;
+    int i;
+
+    for(i=0;i+AVX512_N<=n;i+=AVX512_N)
+        {
+        m=AVX512_LOAD(ms+i);
+        AVX512_STORE(fr+i,AVX512_MAX(AVX512_FMADD(AVX512_SUB(one,m),vf,m),
+                                     zero));
+        }
+    for(;i<n;i++)
+        if((fr[i]=ms[i]+((1.0-ms[i])*f))<0.0)
+            fr[i]=0.0;
+    return;
+}
+
+
+static AVX512 double DotAVX512(ColorType a,ColorType b,int n)
+{
+    __m512d acc=_mm512_setzero_pd();
+    double sum;
+    int i;
+
+    for(i=0;i+8<=n;i+=8)
+        acc=_mm512_fmadd_pd(AVX512_WIDEN(a+i),AVX512_WIDEN(b+i),acc);
+    for(sum=_mm512_reduce_add_pd(acc);i<n;i++)
+        sum+=(double)a[i]*b[i];
+    return sum;
+}
+
+
+static AVX512 double SumAVX512(ColorType a,int n)
+{
+    __m512d acc=_mm512_setzero_pd();
+    double sum;
+    int i;
+
+    for(i=0;i+8<=n;i+=8)
+        acc=_mm512_add_pd(acc,AVX512_WIDEN(a+i));
+    for(sum=_mm512_reduce_add_pd(acc);i<n;i++)
+        sum+=a[i];
+    return sum;
+}
+
+#endif /* SPECT_X86 */
@@ -0,0 +1,43 @@
+/**************************************************************/
+/* This software was made by Oskar Lnnberg                   */
+/*                                                            */
+/* Copyright (c) by Oskar Lnnberg                            */
+/*                                                            */
+/* Permission to use, copy, modify, distribute, and sell this */
+/* software and its documentation for any purpose is not      */
+/* granted without permission from the copyright owner.       */
+/**************************************************************/
+
+
+/*
+    Spect.h - Headerfile for Spect.c
+*/
+
+
+#ifndef __SPECT__
+#define __SPECT__
+
+
+#include "c_types.h"
+#include "color.h"
+
+
+#define SPECT_SCALAR 0      /* Kernel sets, SpectInit */
+#define SPECT_SSE2   1
+#define SPECT_AVX2   2
+#define SPECT_AVX512 3
+#define SPECT_BEST   SPECT_AVX512
+
+int SpectInit(int);
+
+void SpectMult(ColorType,ColorType,ColorType,int);
+void SpectMultAdd(ColorType,ColorType,ColorType,ColorType,int);
+void SpectShade(ColorType,ColorType,ColorType,ColorType,
+                ColorType,double,ColorType,double,int);
+void SpectMix(ColorType,ColorType,double,ColorType,double,int);
+void SpectFresnel(ColorType,ColorType,double,int);
+double SpectDot(ColorType,ColorType,int);
+double SpectSum(ColorType,int);
+
+
+#endif /* __SPECT__ */
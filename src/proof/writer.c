@@ -0,0 +1,512 @@
+/**************************************************************/
+/* This software was made by Oskar Lnnberg                   */
+/*                                                            */
+/* Copyright (c) by Oskar Lnnberg                            */
+/*                                                            */
+/* Permission to use, copy, modify, distribute, and sell this */
+/* software and its documentation for any purpose is not      */
+/* granted without permission from the copyright owner.       */
+/**************************************************************/
+
+
+/*
+    Writer.c - Writer thread for the rows of a picture
+
+    The rows of a picture are written to the TIFF file by a
+    writer thread, so that rendering and writing overlap. The
+    renderer fills the free buffers of a ring of row buffers and
+    the writer thread writes them to the file in order. The
+    renderer waits for a free buffer when the writer falls behind.
+
+    If the file is compressed, the strips in the ring are encoded
+    by a pool of encoder threads and the writer thread writes the
+    encoded strips in order.
+
+    ASSUMPTIONS:
+        Only one thread gives rows to a writer and the rows are
+        given in the order of the file, starting from the first
+        row. The TIFF file is not used by other threads before
+        WriterExit.
+*/
+
+
+
+#include <pthread.h>
+#include "c_types.h"
+#include "access.h"
+#include "message.h"
+#include "buffer.h"
+#include "writer.h"
+
+
+
+/**************************************************************/
+
+/* structure and type definitions */
+
+typedef struct {
+        buffer_t data;      /* Encoded strip */
+        u_long size;        /* Size of the encoded strip, 0 on error */
+        Logical done;       /* Strip is encoded */
+        } STRIP;
+
+struct WriterStruct {
+        TIFF *tif;
+        String name;        /* Name for the progress messages */
+        buffer_t block;     /* Memory of the row buffers */
+        buffer_t *rows;     /* Ring of row buffers */
+        int *numbers;       /* Row numbers of the queued buffers */
+        int size;           /* Buffers in the ring */
+        int head;           /* Index of the first queued buffer */
+        int count;          /* Number of queued buffers */
+        Logical closed;     /* No more rows will be queued */
+        Logical failed;     /* A row could not be written */
+        Logical threaded;   /* Writer thread is running */
+        pthread_mutex_t lock;
+        pthread_cond_t queued;  /* A row queued or writer closed */
+        pthread_cond_t written; /* A row written */
+        pthread_cond_t encoded; /* A strip encoded */
+        pthread_t thread;
+
+        int strip;          /* Rows in a strip, 0 without encoders */
+        coding_t coding;    /* Compression of the strips */
+        int length;         /* Rows in the picture */
+        STRIP *strips;      /* Encoded strips of the ring */
+        int slots;          /* Strips in the ring */
+        pthread_t *pool;    /* Encoder threads */
+        int encoders;       /* Number of encoder threads */
+        int ready;          /* Strips with all rows queued */
+        int taken;          /* Strips taken by the encoders */
+        };
+
+
+/* Internal functions */
+
+static Logical InitStrips(WriterType,int);
+static void ExitEncoders(WriterType);
+static Logical WriteRow(WriterType,buffer_t,int);
+static void *WriterThread(void *);
+static void *StripThread(void *);
+static void *EncoderThread(void *);
+
+
+
+/**************************************************************/
+
+
+
+/**************************************************************
+
+    WriterType WriterInit(TIFF *tif,String name,int size,
+                          int threads)
+
+    Creates a writer with a ring of size row buffers for the
+    TIFF file tif and starts its thread. If the file is
+    compressed, the strips are encoded by threads encoder
+    threads and the ring is rounded up to whole strips. If the
+    threads can not be started the rows are written in
+    WriterWrite. Returns NULL on error.
+
+*/
+
+WriterType WriterInit(TIFF *tif,String name,int size,int threads)
+{
+    WriterType w;
+    ImageSize *image;
+    u_long line;
+    int i;
+
+    if(size<1 || (line=TIFFScanlineSize(tif))==0)
+        return NULL;
+    if((w=MemoryAllocate(struct WriterStruct,1))==NULL)
+        return NULL;
+    w->tif=tif;
+    w->name=name;
+    w->block=NULL;
+    w->rows=NULL;
+    w->numbers=NULL;
+    w->strips=NULL;
+    w->pool=NULL;
+    w->strip=0;
+    w->slots=0;
+    w->encoders=0;
+    if(threads>0 && EncodedStripSize(tif)>0 &&
+       GetStripCoding(tif,&w->coding)==TRUE &&
+       (image=GetImageSize(tif))!=NULL)
+        {
+        w->strip=(int)StripRows(tif);
+        w->length=(int)image->length;
+        size=(size+w->strip-1)/w->strip*w->strip;
+        }
+    if((w->block=MemoryAllocate(char,(size*line)))==NULL)
+        goto error;
+    if((w->rows=MemoryAllocate(buffer_t,size))==NULL)
+        goto error;
+    for(i=0;i<size;i++)
+        w->rows[i]=w->block+i*line;
+    if((w->numbers=MemoryAllocate(int,size))==NULL)
+        goto error;
+    w->size=size;
+    w->head=0;
+    w->count=0;
+    w->closed=FALSE;
+    w->failed=FALSE;
+    w->ready=0;
+    w->taken=0;
+    if(w->strip>0 && InitStrips(w,threads)==FALSE)
+        w->strip=0;
+    pthread_mutex_init(&w->lock,NULL);
+    pthread_cond_init(&w->queued,NULL);
+    pthread_cond_init(&w->written,NULL);
+    pthread_cond_init(&w->encoded,NULL);
+
+    for(i=0;i<w->encoders;i++)
+        if(pthread_create(&w->pool[i],NULL,EncoderThread,w)!=0)
+            break;
+    w->encoders=i;
+    if(w->encoders==0)
+        w->strip=0;
+    w->threaded=(pthread_create(&w->thread,NULL,
+                 (w->strip>0) ? StripThread : WriterThread,w)==0) ?
+                TRUE : FALSE;
+    if(w->threaded==FALSE)
+        ExitEncoders(w);
+    return w;
+
+error:
+    if(w->block!=NULL)
+        MemoryFree(w->block);
+    if(w->rows!=NULL)
+        MemoryFree(w->rows);
+    if(w->numbers!=NULL)
+        MemoryFree(w->numbers);
+    MemoryFree(w);
+    return NULL;
+}
+
+
+
+/**************************************************************
+
+    Logical WriterExit(WriterType w)
+
+    Waits until the queued rows are written and frees the
+    writer. Returns FALSE if a row could not be written.
+
+*/
+
+Logical WriterExit(WriterType w)
+{
+    Logical ok;
+    int i;
+
+    if(w==NULL)
+        return FALSE;
+    if(w->threaded==TRUE)
+        {
+        pthread_mutex_lock(&w->lock);
+        w->closed=TRUE;
+        pthread_cond_broadcast(&w->queued);
+        pthread_cond_broadcast(&w->encoded);
+        pthread_mutex_unlock(&w->lock);
+        pthread_join(w->thread,NULL);
+        ExitEncoders(w);
+        }
+    ok=(w->failed==TRUE) ? FALSE : TRUE;
+    pthread_cond_destroy(&w->encoded);
+    pthread_cond_destroy(&w->written);
+    pthread_cond_destroy(&w->queued);
+    pthread_mutex_destroy(&w->lock);
+    for(i=0;i<w->slots;i++)
+        MemoryFree(w->strips[i].data);
+    if(w->strips!=NULL)
+        MemoryFree(w->strips);
+    if(w->pool!=NULL)
+        MemoryFree(w->pool);
+    MemoryFree(w->block);
+    MemoryFree(w->rows);
+    MemoryFree(w->numbers);
+    MemoryFree(w);
+    return ok;
+}
+
+
+
+/**************************************************************
+
+    buffer_t WriterBuffer(WriterType w)
+
+    Returns the buffer for the next row. Waits while all buffers
+    are queued for writing.
+
+*/
+
+buffer_t WriterBuffer(WriterType w)
+{
+    buffer_t buf;
+
+    if(w->threaded==FALSE)
+        return w->rows[0];
+    pthread_mutex_lock(&w->lock);
+    while(w->count==w->size)
+        pthread_cond_wait(&w->written,&w->lock);
+    buf=w->rows[(w->head+w->count)%w->size];
+    pthread_mutex_unlock(&w->lock);
+    return buf;
+}
+
+
+
+/**************************************************************
+
+    Logical WriterWrite(WriterType w,int row)
+
+    Queues the buffer given by the last WriterBuffer as row of
+    the file. A strip is given to the encoders when its last row
+    is queued. Returns FALSE if a row could not be written.
+
+*/
+
+Logical WriterWrite(WriterType w,int row)
+{
+    Logical ok;
+
+    if(w->threaded==FALSE)
+        return WriteRow(w,w->rows[0],row);
+    pthread_mutex_lock(&w->lock);
+    w->numbers[(w->head+w->count)%w->size]=row;
+    w->count++;
+    if(w->strip>0 && ((row+1)%w->strip==0 || row+1==w->length))
+        w->ready++;
+    pthread_cond_broadcast(&w->queued);
+    ok=(w->failed==TRUE) ? FALSE : TRUE;
+    pthread_mutex_unlock(&w->lock);
+    return ok;
+}
+
+
+
+
+/**************************************************************
+    Internal functions for this file
+***************************************************************/
+
+
+
+/**************************************************************
+
+    static Logical InitStrips(WriterType w,int threads)
+
+    Allocates a buffer for each strip in the ring and the pool
+    of threads encoder threads. Returns FALSE on error.
+
+*/
+
+static Logical InitStrips(WriterType w,int threads)
+{
+    u_long size=EncodedStripSize(w->tif);
+    int i;
+
+    if((w->strips=MemoryAllocate(STRIP,(w->size/w->strip)))==NULL)
+        return FALSE;
+    for(w->slots=0;w->slots<w->size/w->strip;w->slots++)
+        {
+        w->strips[w->slots].done=FALSE;
+        if((w->strips[w->slots].data=MemoryAllocate(char,size))==NULL)
+            goto error;
+        }
+    if((w->pool=MemoryAllocate(pthread_t,threads))==NULL)
+        goto error;
+    w->encoders=threads;
+    return TRUE;
+
+error:
+    for(i=0;i<w->slots;i++)
+        MemoryFree(w->strips[i].data);
+    MemoryFree(w->strips);
+    w->strips=NULL;
+    w->slots=0;
+    return FALSE;
+}
+
+
+
+/**************************************************************
+
+    static void ExitEncoders(WriterType w)
+
+    Stops the encoder threads after the strips given to them.
+    The rows are then written as scanlines.
+
+*/
+
+static void ExitEncoders(WriterType w)
+{
+    int i;
+
+    pthread_mutex_lock(&w->lock);
+    w->closed=TRUE;
+    pthread_cond_broadcast(&w->queued);
+    pthread_mutex_unlock(&w->lock);
+    for(i=0;i<w->encoders;i++)
+        pthread_join(w->pool[i],NULL);
+    w->encoders=0;
+    w->strip=0;
+    w->closed=FALSE;
+    return;
+}
+
+
+
+/**************************************************************
+
+    static Logical WriteRow(WriterType w,buffer_t buf,int row)
+
+    Writes buf as row of the file. After an error the later rows
+    are not written.
+
+*/
+
+static Logical WriteRow(WriterType w,buffer_t buf,int row)
+{
+    if(w->failed==TRUE)
+        return FALSE;
+    if(WriteRowBuffer(w->tif,buf,row)==FALSE)
+        {
+        pthread_mutex_lock(&w->lock);
+        w->failed=TRUE;
+        pthread_mutex_unlock(&w->lock);
+        return FALSE;
+        }
+    MessageNumber(w->name,row);
+    return TRUE;
+}
+
+
+
+/**************************************************************
+
+    static void *WriterThread(void *arg)
+
+    Writer thread. Writes the queued rows in order until the
+    writer is closed and all rows are written.
+
+*/
+
+static void *WriterThread(void *arg)
+{
+    WriterType w=(WriterType)arg;
+    buffer_t buf;
+    int row;
+
+    pthread_mutex_lock(&w->lock);
+    for(;;)
+        {
+        while(w->count==0 && w->closed==FALSE)
+            pthread_cond_wait(&w->queued,&w->lock);
+        if(w->count==0)
+            break;
+        buf=w->rows[w->head];
+        row=w->numbers[w->head];
+        pthread_mutex_unlock(&w->lock);
+        (void)WriteRow(w,buf,row);
+        pthread_mutex_lock(&w->lock);
+        w->head=(w->head+1)%w->size;
+        w->count--;
+        pthread_cond_signal(&w->written);
+        }
+    pthread_mutex_unlock(&w->lock);
+    return NULL;
+}
+
+
+
+/**************************************************************
+
+    static void *StripThread(void *arg)
+
+    Writer thread for encoded strips. Writes the strips in order
+    as they are encoded, until the writer is closed and all the
+    strips given to the encoders are written.
+
+*/
+
+static void *StripThread(void *arg)
+{
+    WriterType w=(WriterType)arg;
+    STRIP  *strip;
+    int     s,i,rows;
+
+    pthread_mutex_lock(&w->lock);
+    for(s=0;;s++)
+        {
+        strip=&w->strips[s%w->slots];
+        while(strip->done==FALSE && (w->closed==FALSE || s<w->ready))
+            pthread_cond_wait(&w->encoded,&w->lock);
+        if(strip->done==FALSE)
+            break;
+        pthread_mutex_unlock(&w->lock);
+        rows=w->length-s*w->strip;
+        if(rows>w->strip)
+            rows=w->strip;
+        if(w->failed==FALSE &&
+           (strip->size==0 ||
+            WriteEncodedStrip(w->tif,strip->data,s,strip->size)==FALSE))
+            {
+            pthread_mutex_lock(&w->lock);
+            w->failed=TRUE;
+            pthread_mutex_unlock(&w->lock);
+            }
+        for(i=0;i<rows && w->failed==FALSE;i++)
+            MessageNumber(w->name,s*w->strip+i);
+        pthread_mutex_lock(&w->lock);
+        strip->done=FALSE;
+        w->head=(w->head+rows)%w->size;
+        w->count-=rows;
+        pthread_cond_signal(&w->written);
+        }
+    pthread_mutex_unlock(&w->lock);
+    return NULL;
+}
+
+
+
+/**************************************************************
+
+    static void *EncoderThread(void *arg)
+
+    Encoder thread. Encodes the strips whose rows are queued
+    until the writer is closed. The compression was read from
+    the TIFF structure by WriterInit(), as the structure is
+    changed by the writer thread while the strips are encoded.
+
+*/
+
+static void *EncoderThread(void *arg)
+{
+    WriterType w=(WriterType)arg;
+    STRIP  *strip;
+    int     s,rows;
+
+    pthread_mutex_lock(&w->lock);
+    for(;;)
+        {
+        while(w->taken==w->ready && w->closed==FALSE)
+            pthread_cond_wait(&w->queued,&w->lock);
+        if(w->taken==w->ready)
+            break;
+        s=w->taken++;
+        pthread_mutex_unlock(&w->lock);
+        rows=w->length-s*w->strip;
+        if(rows>w->strip)
+            rows=w->strip;
+        strip=&w->strips[s%w->slots];
+        strip->size=EncodeStrip(&w->coding,w->rows[(s*w->strip)%w->size],
+                                rows,strip->data);
+        pthread_mutex_lock(&w->lock);
+        strip->done=TRUE;
+        pthread_cond_broadcast(&w->encoded);
+        }
+    pthread_mutex_unlock(&w->lock);
+    return NULL;
+}
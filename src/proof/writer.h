@@ -0,0 +1,33 @@
+/**************************************************************/
+/* This software was made by Oskar Lnnberg                   */
+/*                                                            */
+/* Copyright (c) by Oskar Lnnberg                            */
+/*                                                            */
+/* Permission to use, copy, modify, distribute, and sell this */
+/* software and its documentation for any purpose is not      */
+/* granted without permission from the copyright owner.       */
+/**************************************************************/
+
+
+/*
+    Writer.h - Headerfile for Writer.c
+*/
+
+
+#ifndef __WRITER__
+#define __WRITER__
+
+
+#include "c_types.h"
+#include "access.h"
+
+
+typedef struct WriterStruct *WriterType;
+
+WriterType WriterInit(TIFF *,String,int,int);
+Logical WriterExit(WriterType);
+buffer_t WriterBuffer(WriterType);
+Logical WriterWrite(WriterType,int);
+
+
+#endif /* __WRITER__ */
@@ -37,9 +37,9 @@ double GeomTorrance (VECTOR *N,VECTOR *L,VECTOR *E,double dummy)
     double N_dot_H, E_dot_H;
     double N_dot_E, N_dot_L;
     double g1, g2;
-    VECTOR *H;
+    VECTOR *H, H_buf;
 
-    H = VectorH(E,L);
+    H = VectorH(E,L,&H_buf);
     N_dot_H = VectorDot(N,H);
     E_dot_H = VectorDot(E,H);
     N_dot_E = VectorDot(N,E);
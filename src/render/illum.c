@@ -275,7 +275,7 @@ double *IllumBlinn(LINE *surface,LINE *E,ILLUM_MATL *matl,
     int   ct;
     double N_dot_L, N_dot_E, D, G, *Fr;
     LINE  L;
-    VECTOR *T, *H;
+    VECTOR *T, *H, T_buf, H_buf;
 
     /* load the ambient illumination */
 
@@ -311,7 +311,7 @@ double *IllumBlinn(LINE *surface,LINE *E,ILLUM_MATL *matl,
             else
                 G = (*(matl->G))(&(surface->dir), &(L.dir),
                     &(E->dir), matl->G_coeff);
-            H = VectorH(&(L.dir), &(E->dir));
+            H = VectorH(&(L.dir), &(E->dir), &H_buf);
             if (matl->conductor)
                 {
                 Fr = FresnelApproxFr(H, &(L.dir), matl->Ro, matl->nt,
@@ -319,7 +319,7 @@ double *IllumBlinn(LINE *surface,LINE *E,ILLUM_MATL *matl,
                 }
             else
                 {
-                T = VectorRefracted(&(E->dir),H, matl->nr, matl->nt);
+                T = VectorRefracted(&(E->dir),H, matl->nr, matl->nt, &T_buf);
                 Fr = FresnelApproxFrFt(H, &(L.dir), T,
                               matl->Ro, matl->nr, matl->nt, num_samples,
                               matl->Ks_spectral, Fr_buffer, Ft_buffer);
@@ -465,7 +465,7 @@ rfl_rfr:
         {
         double      *Ir_or_It;
         LINE        V_new;
-        VECTOR      *T;
+        VECTOR      *T, T_buf;
 
         if((Ir_or_It = (double *)malloc((unsigned)(num_samples *
                         sizeof(double)))) == NULL)
@@ -478,7 +478,7 @@ rfl_rfr:
     */
 
         V_new.start = surface->start;
-        V_new.dir = *(VectorReflected(&(V->dir),&(surface->dir)));
+        (void)VectorReflected(&(V->dir),&(surface->dir),&(V_new.dir));
         if ((*get_color)(&V_new, Ir_or_It)!= NULL)
             for (ct=0; ct<num_samples; ct++)
                 color[ct]+=Ir_or_It[ct]*matl->Ks_scale*matl->Ks_spectral[ct];
@@ -495,10 +495,10 @@ rfl_rfr:
             V_new.start = surface->start;
             if (inside)
                 T = VectorRefracted(&(V->dir),&(surface->dir),
-                                    matl->nt, matl->nr);
+                                    matl->nt, matl->nr, &T_buf);
             else
                 T = VectorRefracted(&(V->dir),&(surface->dir),
-                                    matl->nr, matl->nt);
+                                    matl->nr, matl->nt, &T_buf);
             if (T != NULL)
                 {
                 V_new.dir = *T;
@@ -543,7 +543,7 @@ double *IllumHall(LINE *surface,LINE *V,ILLUM_MATL *matl,
     int      ct;
     double   N_dot_L, D, G, *Fr;
     LINE     L;
-    VECTOR   *T, *H, *Ht, pseudo_V;
+    VECTOR   *T, *H, *Ht, pseudo_V, T_buf, H_buf, Ht_buf;
 
     /*
         figure out whether we are on the reflected or transmitted
@@ -609,7 +609,7 @@ double *IllumHall(LINE *surface,LINE *V,ILLUM_MATL *matl,
             else
                 G = (*(matl->G))(&(surface->dir),&(L.dir),
                              &(V->dir), matl->G_coeff);
-            H = VectorH(&(L.dir), &(V->dir));
+            H = VectorH(&(L.dir), &(V->dir), &H_buf);
             if (matl->conductor)
                 {
                 Fr = FresnelApproxFr(H, &(L.dir), matl->Ro, matl->nt,
@@ -617,7 +617,7 @@ double *IllumHall(LINE *surface,LINE *V,ILLUM_MATL *matl,
                 }
             else
                 {
-                T = VectorRefracted(&(L.dir), H, matl->nr, matl->nt);
+                T = VectorRefracted(&(L.dir), H, matl->nr, matl->nt, &T_buf);
                 Fr = FresnelApproxFrFt(H, &(L.dir), T,
                          matl->Ro, matl->nr, matl->nt, num_samples,
                          matl->Ks_spectral, Fr_buffer, Ft_buffer);
@@ -644,7 +644,7 @@ double *IllumHall(LINE *surface,LINE *V,ILLUM_MATL *matl,
     */
 
             if ((Ht = VectorHt(&(L.dir),&(V->dir),matl->nr,
-                                        matl->nt)) != NULL)
+                                        matl->nt,&Ht_buf)) != NULL)
                 {
 
     /*
@@ -658,7 +658,7 @@ double *IllumHall(LINE *surface,LINE *V,ILLUM_MATL *matl,
         text for details.
     */
 
-                pseudo_V = *(VectorReflected(&(L.dir), Ht));
+                (void)VectorReflected(&(L.dir), Ht, &pseudo_V);
                 D = (*(matl->D))(&(surface->dir), &(L.dir),
                                  &pseudo_V,matl->D_coeff);
                 Fr = FresnelApproxFrFt(Ht, &(L.dir), &(V->dir),
@@ -727,7 +727,7 @@ rfl_rfr:
          else if (inside)
             {
             T = VectorRefracted(&(V->dir),&(surface->dir),
-                                matl->nt, matl->nr);
+                                matl->nt, matl->nr, &T_buf);
             pseudo_N.i = -surface->dir.i;
             pseudo_N.j = -surface->dir.j;
             pseudo_N.k = -surface->dir.k;
@@ -738,7 +738,7 @@ rfl_rfr:
          else
             {
             T = VectorRefracted(&(V->dir),&(surface->dir),
-                                     matl->nr, matl->nt);
+                                     matl->nr, matl->nt, &T_buf);
             Fr = FresnelApproxFrFt(&(surface->dir), &(V->dir),
                             T, matl->Ro, matl->nr, matl->nt, num_samples,
                             matl->Ks_spectral, Fr_buffer, Ft_buffer);
@@ -751,7 +751,7 @@ rfl_rfr:
     */
 
         V_new.start = surface->start;
-        V_new.dir = *(VectorReflected(&(V->dir),&(surface->dir)));
+        (void)VectorReflected(&(V->dir),&(surface->dir),&(V_new.dir));
         if ((*get_color)(&V_new, Ir_or_It) != NULL)
             {
             for (ct=0; ct<num_samples; ct++)
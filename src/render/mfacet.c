@@ -114,8 +114,9 @@ double MFacetPhongInit(double beta)
 double MFacetPhong (VECTOR *N,VECTOR *L,VECTOR *E,double Ns)
 {
     double      Re_dot_L;
+    VECTOR      Re;
 
-    if ((Re_dot_L=VectorDot(VectorReflected(E,N),L))<0.0)
+    if ((Re_dot_L=VectorDot(VectorReflected(E,N,&Re),L))<0.0)
         return 0.0;
     return pow(Re_dot_L,Ns);
 }
@@ -158,8 +159,9 @@ double MFacetBlinnInit(double beta)
 double MFacetBlinn (VECTOR *N,VECTOR *L,VECTOR *E,double Ns)
 {
     double N_dot_H;
+    VECTOR H;
 
-    if ((N_dot_H=VectorDot(N,VectorH(E,L))) < 0.0)
+    if ((N_dot_H=VectorDot(N,VectorH(E,L,&H))) < 0.0)
         return 0.0;
     return pow (N_dot_H, Ns);
 }
@@ -201,8 +203,9 @@ double MFacetGaussian (VECTOR *N,VECTOR *L,VECTOR *E,double C1)
 {
     double      tmp;
     double      N_dot_H;
+    VECTOR      H;
 
-    if ((N_dot_H = VectorDot (N, VectorH(E,L))) < 0.0)
+    if ((N_dot_H = VectorDot (N, VectorH(E,L,&H))) < 0.0)
         return 0.0;
     tmp = acos(N_dot_H)*C1;
     return exp(-(tmp*tmp));
@@ -249,8 +252,9 @@ double MFacetReitz (VECTOR *N,VECTOR *L,VECTOR *E,double C2_2)
 {
     double      tmp;
     double      N_dot_H;
+    VECTOR      H;
 
-    if ((N_dot_H = VectorDot(N,VectorH(E,L))) < 0.0)
+    if ((N_dot_H = VectorDot(N,VectorH(E,L,&H))) < 0.0)
         return 0.0;
     tmp = C2_2/((N_dot_H*N_dot_H*(C2_2-1.0))+1.0);
     return tmp * tmp;
@@ -298,8 +302,9 @@ double MFacetCook (VECTOR *N,VECTOR *L,VECTOR *E,double m2)
 {
     double      tmp;
     double      N_dot_H;
+    VECTOR      H;
 
-    if((N_dot_H=VectorDot(N,VectorH(E,L)))<0.0)
+    if((N_dot_H=VectorDot(N,VectorH(E,L,&H)))<0.0)
         return 0.0;
     tmp = -(1.0-(N_dot_H*N_dot_H))/(N_dot_H*N_dot_H*m2);
     return exp(tmp)/(4.0*M_PI*m2*pow(N_dot_H,4.0));
@@ -419,14 +424,14 @@ double MFacetCoherent(double g)
 double MFacetIncoherent (VECTOR *N,VECTOR *L,VECTOR *E,
                     double m,double g,double lambda,double tau)
 {
-    VECTOR     *H;
+    VECTOR     *H, H_buf;
     double     D1, D2;
     double     denom;
     double     N_dot_H, N_dot_H2;
 
     if (g <= 0.0)
         return 0.0;
-    if ((H = VectorH(E,L)) == NULL)
+    if ((H = VectorH(E,L,&H_buf)) == NULL)
         return 0.0;
     if ((N_dot_H = VectorDot(N,H))<=0.0)
         return 0.0;
@@ -16,6 +16,11 @@
       VectorRefracted   - compute the refracted vector
       VectorH           - compute H vector
       VectorHt          - compute the H' vector
+
+   ASSUMPTIONS:
+      Routines returning a vector store it to a vector given by
+      the caller. No static storage is used, so the routines may
+      be called from several threads at the same time.
 */
 
 #include <stdio.h>
@@ -46,21 +51,21 @@ double VectorDot (VECTOR *v0,VECTOR *v1)
 
 /***************************************************************
 
-         VECTOR VectorCross (VECTOR *v0,VECTOR *vl)
+         VECTOR *VectorCross (VECTOR *v0,VECTOR *vl,VECTOR *v2)
          v0, vl normalised direction vectors
+         v2 (out) cross product
 
-         Returns the cross product of two direction vectors.
+         Returns the cross product of two direction vectors. The
+         result is stored to v2 and a pointer to it is returned.
 
 */
 
-VECTOR *VectorCross (VECTOR *v0,VECTOR *v1)
+VECTOR *VectorCross (VECTOR *v0,VECTOR *v1,VECTOR *v2)
 {
-    static VECTOR   v2;
-
-    v2.i = (v0->j * v1->k) - (v0->k * v1->j);
-    v2.j = (v0->k * v1->i) - (v0->i * v1->k);
-    v2.k = (v0->i * v1->j) - (v0->j * v1->i);
-    return &v2;
+    v2->i = (v0->j * v1->k) - (v0->k * v1->j);
+    v2->j = (v0->k * v1->i) - (v0->i * v1->k);
+    v2->k = (v0->i * v1->j) - (v0->j * v1->i);
+    return v2;
 }
 
 
@@ -117,9 +122,10 @@ double VectorLine (POINT *p0,POINT *p1,LINE *v)
 
 /***************************************************************
 
-         VECTOR *VectorReflected (VECTOR *L,VECTOR *N)
+         VECTOR *VectorReflected (VECTOR *L,VECTOR *N,VECTOR *rfl)
          L (in) incident vector
          N (in) surface normal
+         rfl (out) reflected vector
 
          Returns the reflected direction vector. The reflected
          direction is computed using the method given by Whitted
@@ -127,23 +133,23 @@ double VectorLine (POINT *p0,POINT *p1,LINE *v)
 
 */
 
-VECTOR *VectorReflected (VECTOR *L,VECTOR *N)
+VECTOR *VectorReflected (VECTOR *L,VECTOR *N,VECTOR *rfl)
 {
     double          N_dot_L;
-    static VECTOR   rfl;
 
     N_dot_L = VectorDot (N,L);
-    rfl.i = (2.0 * N_dot_L * N->i) - L->i;
-    rfl.j = (2.0 * N_dot_L * N->j) - L->j;
-    rfl.k = (2.0 * N_dot_L * N->k) - L->k;
-    return &rfl;
+    rfl->i = (2.0 * N_dot_L * N->i) - L->i;
+    rfl->j = (2.0 * N_dot_L * N->j) - L->j;
+    rfl->k = (2.0 * N_dot_L * N->k) - L->k;
+    return rfl;
 }
 
 
 
 /***************************************************************
 
-         VECTOR *VectorRefracted (VECTOR *L,VECTOR *N,double ni,double nt)
+         VECTOR *VectorRefracted (VECTOR *L,VECTOR *N,double ni,
+                                  double nt,VECTOR *T)
          L (in) incident vector
          N (in) surface normal
          ni (in) index of refraction for the
@@ -152,6 +158,7 @@ VECTOR *VectorReflected (VECTOR *L,VECTOR *N)
          nt (in) index of refraction for the
                  material on the back of the
                  interface (opposite size as N)
+         T (out) refracted vector
 
          Returns the refracted vector, if thereis  complete internal
          refracted vector otherwise a NULL vector is returned. The
@@ -159,9 +166,9 @@ VECTOR *VectorReflected (VECTOR *L,VECTOR *N)
 
 */
 
-VECTOR *VectorRefracted (VECTOR *L,VECTOR *N,double ni,double nt)
+VECTOR *VectorRefracted (VECTOR *L,VECTOR *N,double ni,double nt,
+                         VECTOR *T)
 {
-    static VECTOR   T;  /* the refracted vector */
     VECTOR  sin_T;      /* sin vector of the refracted vector */
     VECTOR  cos_L;      /* cos vector of the incident vector */
     double  len_sin_T;  /* length of sin T squared */
@@ -184,45 +191,46 @@ VECTOR *VectorRefracted (VECTOR *L,VECTOR *N,double ni,double nt)
     N_dot_T=sqrt(1.0-len_sin_T);
     if(N_dot_L<0.0)
         N_dot_T=-N_dot_T;
-    T.i = sin_T.i - (N->i * N_dot_T);
-    T.j = sin_T.j - (N->j * N_dot_T);
-    T.k = sin_T.k - (N->k * N_dot_T);
-    return &T;
+    T->i = sin_T.i - (N->i * N_dot_T);
+    T->j = sin_T.j - (N->j * N_dot_T);
+    T->k = sin_T.k - (N->k * N_dot_T);
+    return T;
 }
 
 
 
 /***************************************************************
 
-         VECTOR *VectorH (VECTOR *L,VECTOR *E)
+         VECTOR *VectorH (VECTOR *L,VECTOR *E,VECTOR *H)
          L (in) incident vector
          E (in) reflected vector
+         H (out) H vector
 
          Returns H, NULL on error (if L+H = 0).
 
 */
 
-VECTOR *VectorH (VECTOR *L,VECTOR *E)
+VECTOR *VectorH (VECTOR *L,VECTOR *E,VECTOR *H)
 {
-    static VECTOR   H;
-
-    H.i = L->i + E->i;
-    H.j = L->j + E->j;
-    H.k = L->k + E->k;
-    if (VectorNorm(&H))
+    H->i = L->i + E->i;
+    H->j = L->j + E->j;
+    H->k = L->k + E->k;
+    if (!VectorNorm(H))
         return NULL;
-    return &H;
+    return H;
 }
 
 
 
 /***************************************************************
 
-        VECTOR *VectorHt(VECTOR *L,VECTOR *T,double ni,double nt)
+        VECTOR *VectorHt(VECTOR *L,VECTOR *T,double ni,double nt,
+                         VECTOR *Ht)
         L (in) incident vector
         T (in) transmitted hector
         ni (in) incident index
         nt (in) transmitted index
+        Ht (out) H' vector
 
         Returns H' oriented to the same side of the surface
         as L computed using the method suggested by
@@ -230,11 +238,10 @@ VECTOR *VectorH (VECTOR *L,VECTOR *E)
         between V and L is less than the critical angle).
 */
 
-VECTOR *VectorHt(VECTOR *L,VECTOR *T,double ni,double nt)
+VECTOR *VectorHt(VECTOR *L,VECTOR *T,double ni,double nt,VECTOR *Ht)
 {
     double      L_dot_T;
     double      divisor;
-    static VECTOR     Ht;
 
     L_dot_T = -(VectorDot(L,T));
     /* check for special cases */
@@ -248,21 +255,21 @@ VECTOR *VectorHt(VECTOR *L,VECTOR *T,double ni,double nt)
         if (L_dot_T < ni/nt)
             return NULL;
         divisor = (nt / ni) - 1.0;
-        Ht.i = -(((L->i + T->i) / divisor) + T->i);
-        Ht.j = -(((L->j + T->j) / divisor) + T->j);
-        Ht.k = -(((L->k + T->k) / divisor) + T->k);
+        Ht->i = -(((L->i + T->i) / divisor) + T->i);
+        Ht->j = -(((L->j + T->j) / divisor) + T->j);
+        Ht->k = -(((L->k + T->k) / divisor) + T->k);
         }
     else
         {
         if (L_dot_T < nt/ni)
             return NULL;
         divisor = (ni / nt) - 1.0;
-        Ht.i = ((L->i + T->i) / divisor) + L->i;
-        Ht.j = ((L->j + T->j) / divisor) + L->j;
-        Ht.k = ((L->k + T->k) / divisor) + L->k;
+        Ht->i = ((L->i + T->i) / divisor) + L->i;
+        Ht->j = ((L->j + T->j) / divisor) + L->j;
+        Ht->k = ((L->k + T->k) / divisor) + L->k;
         }
-    (void)VectorNorm(&Ht);
-    return &Ht;
+    (void)VectorNorm(Ht);
+    return Ht;
 }
 
 
@@ -31,15 +31,17 @@ typedef struct {POINT start;
 /* geometric manipulation routines */
 
 double  VectorDot(VECTOR *,VECTOR *);       /* vector dot product */
-VECTOR  *VectorCross(VECTOR *,VECTOR *);    /* vector cross product */
+VECTOR  *VectorCross(VECTOR *,VECTOR *,VECTOR *);
+                                            /* vector cross product */
 double  VectorNorm(VECTOR *);               /* vector normalize */
 double  VectorLine(POINT *,POINT *,LINE *); /* vector between two points */
-VECTOR  *VectorReflected(VECTOR *,VECTOR *);
+VECTOR  *VectorReflected(VECTOR *,VECTOR *,VECTOR *);
                                             /* reflected vector */
-VECTOR  *VectorRefracted(VECTOR *,VECTOR *,double,double);
+VECTOR  *VectorRefracted(VECTOR *,VECTOR *,double,double,VECTOR *);
                                             /* refracted vector */
-VECTOR  *VectorH(VECTOR *,VECTOR *);        /* H vector */
-VECTOR  *VectorHt(VECTOR *,VECTOR *,double,double);
+VECTOR  *VectorH(VECTOR *,VECTOR *,VECTOR *);
+                                            /* H vector */
+VECTOR  *VectorHt(VECTOR *,VECTOR *,double,double,VECTOR *);
                                             /* H' vector */
 
 
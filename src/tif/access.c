@@ -7,12 +7,16 @@
 #include <stdarg.h>
 #include <time.h>
 #include <string.h>
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <unistd.h>
 #include "access.h"
 
 
 #define BITSPERSAMPLE           8
 #define ROWSPERSTRIP            8
 #define RESOLUTIONUNIT          2
+#define CLASSIC_TIFF_SIZE       4294967295.0   /* Largest classic TIFF file */
 
 typedef struct {                   /* Control structure for TIFF files. */
                TIFF *tif;
@@ -22,11 +26,18 @@ typedef struct {                   /* Control structure for TIFF files. */
 static control_t output={NULL,0};
 static control_t input={NULL,0};
 static u_short CompressionFlag=COMPRESSION_NONE;
+static u_long TileSize=0;
+static char *MapBase=NULL;         /* Mapped strips of the output file */
+static size_t MapSize=0;
 
 
 
 void InitTIFF(int,TIFF *,u_long,u_long,double); /* Initializes tif image for writing */
 int CheckImage(TIFF *);                    /* Checks if the TIFF file is RGB or CMYK */
+static u_long EncodedSize(TIFF *,u_long,u_long); /* Largest size of encoded rows */
+static logical GetCoding(TIFF *,u_long,u_long,coding_t *); /* Compression of rows */
+static u_long EncodeRows(coding_t *,buffer_t,u_long,buffer_t); /* Encodes rows */
+static double ProjectedSize(int,u_long,u_long); /* Largest size of a new file */
 
 
 
@@ -39,29 +50,35 @@ int CheckImage(TIFF *);                    /* Checks if the TIFF file is RGB or
    file and opening mode (READ or WRITE). If the opening mode is WRITE
    the function expects to find the width, length and resolution of the
    new file on the argument line. The data types are u_long, u_long and
-   double. */
+   double. A new file that may grow over 4 GB is written as BigTIFF. */
 
 TIFF *OpenImage(char *name,char *mode,...)
 {
     TIFF *tif;
     va_list ap;
+    u_long width=0,length=0;  /* If mode is WRITE search for file type */
+    double resolution=0.0;    /* width, length and resolution of the file */
+    int filetype=0;
+    logical writing;
 
-    tif = TIFFOpen(name,mode);
-    if(!tif)
-        Error("Can't open file: %s\n",name,tif,(TIFF *)0);
-    if(strcmp(mode,WRITE)==0)
+    writing=(strcmp(mode,WRITE)==0) ? TRUE : FALSE;
+    if(writing==TRUE)
         {
-        u_long width,length;  /* If mode is WRITE search for file type */
-        double resolution;    /* width, length and resolution of the file */
-        int filetype;
-
         va_start(ap,mode);
         filetype=va_arg(ap,int);
         width=va_arg(ap,u_long);
         length=va_arg(ap,u_long);
         resolution=va_arg(ap,double);
-        InitTIFF(filetype,tif,width,length,resolution);
         va_end(ap);
+        if(ProjectedSize(filetype,width,length)>CLASSIC_TIFF_SIZE)
+            mode=WRITE_BIGTIFF;
+        }
+    tif = TIFFOpen(name,mode);
+    if(!tif)
+        Error("Can't open file: %s\n",name,tif,(TIFF *)0);
+    if(writing==TRUE)
+        {
+        InitTIFF(filetype,tif,width,length,resolution);
         output.tif=tif;
         output.type=filetype;
         }
@@ -80,6 +97,8 @@ TIFF *OpenImage(char *name,char *mode,...)
 
 void CloseImage(TIFF *tif)
 {
+    if(MapBase!=NULL && tif==output.tif)
+        (void)UnmapRows(tif);
     TIFFClose(tif);
     return;
 }
@@ -172,6 +191,235 @@ void FreeRowBuffer(buffer_t buffer)
 
 
 
+/* ------------------------------------------------------------------- */
+/* Functions for encoding strips                                       */
+/* ------------------------------------------------------------------- */
+
+
+/* Strips can be encoded separately of the TIFF structure and written
+   as they are, so that several threads can encode them at the same
+   time. StripRows returns the number of rows in a strip and
+   EncodedStripSize the largest size of an encoded strip, which is 0
+   if the strips are not compressed. The compression scheme and the
+   predictor are those set to the TIFF structure. */
+
+u_long StripRows(TIFF *tif)
+{
+    u_long rows;
+
+    if(!TIFFGetField(tif,TIFFTAG_ROWSPERSTRIP,&rows))
+        return (u_long) ROWSPERSTRIP;
+    return rows;
+}
+
+
+
+u_long EncodedStripSize(TIFF *tif)
+{
+    return EncodedSize(tif,StripRows(tif),TIFFScanlineSize(tif));
+}
+
+
+
+/* GetStripCoding reads the compression of the strips to coding. It
+   must be called before the strips are encoded in other threads, as
+   the TIFF structure is changed when strips are written. */
+
+logical GetStripCoding(TIFF *tif,coding_t *coding)
+{
+    return GetCoding(tif,StripRows(tif),TIFFScanlineSize(tif),coding);
+}
+
+
+
+/* EncodeStrip encodes rows scanlines from buffer to the strip buffer,
+   which must have EncodedStripSize bytes, with the compression given
+   by GetStripCoding. Returns the size of the encoded strip, 0 on
+   error. */
+
+u_long EncodeStrip(coding_t *coding,buffer_t buffer,u_long rows,buffer_t strip)
+{
+    return EncodeRows(coding,buffer,rows,strip);
+}
+
+
+
+/* This function writes an encoded strip to TIFF image structure. The
+   strips must be written in order. */
+
+logical WriteEncodedStrip(TIFF *tif,buffer_t strip,u_long number,u_long size)
+{
+    if(TIFFWriteRawStrip(tif,(u_int) number,(u_char *) strip,size)!=(int) size)
+        return FALSE;
+    return TRUE;
+}
+
+
+
+/* ------------------------------------------------------------------- */
+/* Functions for tiled images                                          */
+/* ------------------------------------------------------------------- */
+
+
+/* Sets the width and length of the tiles for the output TIFF image.
+   The size must be a multiple of 16, 0 saves the image in strips. */
+
+void SetTileSize(u_long size)
+{
+    TileSize=size;
+    return;
+}
+
+
+
+/* Returns the width and length of the tiles, 0 if the image is saved
+   in strips. */
+
+u_long GetTileSize(TIFF *tif)
+{
+    u_long size;
+
+    if(!isTiled(tif) || !TIFFGetField(tif,TIFFTAG_TILEWIDTH,&size))
+        return 0;
+    return size;
+}
+
+
+
+/* Allocate memory for a tile buffer. It is freed with FreeRowBuffer. */
+
+buffer_t AllocTileBuffer(TIFF *tif)
+{
+    buffer_t buffer = NULL;
+    u_long size = 0;
+
+    size = TIFFTileSize(tif);
+    buffer=(buffer_t) malloc(size);
+    if(buffer==NULL)
+        Error("Can't allocate memory for tile buffer%s\n","",tif,(TIFF *)0);
+    memset(buffer, (value_t) 0xFF, size);
+    return buffer;
+}
+
+
+
+/* This function writes the tile with the pixel (x,y) to TIFF image
+   structure. The tiles can be written in any order. */
+
+logical WriteTileBuffer(TIFF *tif,buffer_t buffer,u_long x,u_long y)
+{
+    if(TIFFWriteTile(tif,(u_char *) buffer,x,y,0,0)<=0)
+        return FALSE;
+    return TRUE;
+}
+
+
+
+/* Tiles are encoded like strips, EncodedTileSize returns the largest
+   size of an encoded tile, which is 0 if the tiles are not compressed,
+   GetTileCoding reads the compression of the tiles and EncodeTile
+   encodes a tile to the tile buffer, which must have EncodedTileSize
+   bytes. */
+
+u_long EncodedTileSize(TIFF *tif)
+{
+    return EncodedSize(tif,TIFFTileSize(tif)/TIFFTileRowSize(tif),
+                       TIFFTileRowSize(tif));
+}
+
+
+
+logical GetTileCoding(TIFF *tif,coding_t *coding)
+{
+    return GetCoding(tif,TIFFTileSize(tif)/TIFFTileRowSize(tif),
+                     TIFFTileRowSize(tif),coding);
+}
+
+
+
+u_long EncodeTile(coding_t *coding,buffer_t buffer,buffer_t tile)
+{
+    return EncodeRows(coding,buffer,coding->rows,tile);
+}
+
+
+
+/* This function writes an encoded tile with the pixel (x,y) to TIFF
+   image structure. */
+
+logical WriteEncodedTile(TIFF *tif,buffer_t tile,u_long x,u_long y,u_long size)
+{
+    if(TIFFWriteRawTile(tif,TIFFComputeTile(tif,x,y,0,0),(u_char *) tile,
+                        size)!=(int) size)
+        return FALSE;
+    return TRUE;
+}
+
+
+
+/* ------------------------------------------------------------------- */
+/* Functions for mapped images                                         */
+/* ------------------------------------------------------------------- */
+
+
+/* The rows of an uncompressed image in strips lie one after another
+   in the file. MapRows reserves the space of all the strips at the end
+   of the output file and maps it to memory, so the rows can be written
+   straight to the file in any order without TIFFWriteScanline. Row r
+   starts at r*TIFFScanlineSize bytes from the returned pointer.
+   Returns NULL if the image is compressed or tiled or if the file can't
+   be mapped, the rows are then written with the other functions. If
+   the mapping fails after the space is reserved, the space is left
+   unused in the file. */
+
+buffer_t MapRows(TIFF *tif)
+{
+    u_short comp;
+    u_long off,rows;
+    long page;
+
+    if(tif!=output.tif || MapBase!=NULL || isTiled(tif))
+        return NULL;
+    if(!TIFFGetField(tif,TIFFTAG_COMPRESSION,&comp) || comp!=COMPRESSION_NONE)
+        return NULL;
+    if(!TIFFGetField(tif,TIFFTAG_IMAGELENGTH,&rows))
+        return NULL;
+    if((off=TIFFReserveStrips(tif,1))==0)
+        return NULL;
+    if((page=sysconf(_SC_PAGESIZE))<=0)
+        page=1;
+    MapSize=off%page+rows*TIFFScanlineSize(tif);
+    MapBase=(char *) mmap(NULL,MapSize,PROT_READ|PROT_WRITE,MAP_SHARED,
+                          TIFFFileno(tif),(off_t) (off-off%page));
+    if(MapBase==(char *) MAP_FAILED)
+        {
+        MapBase=NULL;
+        (void)TIFFReserveStrips(tif,0);
+        return NULL;
+        }
+    return (buffer_t) (MapBase+off%page);
+}
+
+
+
+/* UnmapRows unmaps the rows mapped by MapRows. The rows are written to
+   the file by the system. */
+
+logical UnmapRows(TIFF *tif)
+{
+    if(MapBase==NULL || tif!=output.tif)
+        return FALSE;
+    if(munmap(MapBase,MapSize)!=0)
+        {
+        MapBase=NULL;
+        return FALSE;
+        }
+    MapBase=NULL;
+    return TRUE;
+}
+
+
+
 /* ------------------------------------------------------------------- */
 /* Other useful functions                                              */
 /* ------------------------------------------------------------------- */
@@ -234,7 +482,15 @@ void InitTIFF(int type,TIFF *tif,u_long width,u_long length,double resolution)
     TIFFSetField(tif, TIFFTAG_IMAGELENGTH, length);
     TIFFSetField(tif, TIFFTAG_BITSPERSAMPLE, (u_short) BITSPERSAMPLE);
     TIFFSetField(tif, TIFFTAG_COMPRESSION, (u_short) CompressionFlag);
-    TIFFSetField(tif, TIFFTAG_ROWSPERSTRIP, (u_long) ROWSPERSTRIP);
+    if(CompressionFlag==COMPRESSION_LZW)
+        TIFFSetField(tif, TIFFTAG_PREDICTOR, (u_short) PREDICTOR_HORIZONTAL);
+    if(TileSize>0)
+        {
+        TIFFSetField(tif, TIFFTAG_TILEWIDTH, TileSize);
+        TIFFSetField(tif, TIFFTAG_TILELENGTH, TileSize);
+        }
+    else
+        TIFFSetField(tif, TIFFTAG_ROWSPERSTRIP, (u_long) ROWSPERSTRIP);
     TIFFSetField(tif, TIFFTAG_RESOLUTIONUNIT, (u_short) RESOLUTIONUNIT);
     TIFFSetField(tif, TIFFTAG_XRESOLUTION, resolution);
     TIFFSetField(tif, TIFFTAG_YRESOLUTION, resolution);
@@ -260,7 +516,8 @@ int CheckImage(TIFF *tif)
     int     type;
 
     if(!TIFFGetField(tif,TIFFTAG_COMPRESSION,&comp) ||
-            !(comp==COMPRESSION_NONE || comp==COMPRESSION_PACKBITS))
+            !(comp==COMPRESSION_NONE || comp==COMPRESSION_PACKBITS ||
+              comp==COMPRESSION_LZW))
         err="Compression";
     else if(!TIFFGetField(tif,TIFFTAG_PHOTOMETRIC,&photo) ||
             !(photo==PHOTOMETRIC_RGB || photo==PHOTOMETRIC_SEPARATED))
@@ -281,3 +538,87 @@ int CheckImage(TIFF *tif)
         }
     return type;
 }
+
+
+
+/* EncodedSize returns the largest size of rows rows of size bytes
+   encoded with the compression scheme of the TIFF structure, 0 if
+   the rows are not compressed. */
+
+static u_long EncodedSize(TIFF *tif,u_long rows,u_long size)
+{
+    u_short comp;
+
+    if(!TIFFGetField(tif,TIFFTAG_COMPRESSION,&comp))
+        return 0;
+    if(comp==COMPRESSION_PACKBITS)
+        return rows*TIFFPackBitsBound(size);
+    if(comp==COMPRESSION_LZW)
+        return TIFFLZWBound(rows*size);
+    return 0;
+}
+
+
+
+/* GetCoding reads the compression scheme and predictor of the TIFF
+   structure to coding, with rows rows of size bytes. Returns FALSE if
+   the compression is not set. */
+
+static logical GetCoding(TIFF *tif,u_long rows,u_long size,coding_t *coding)
+{
+    u_short comp,predictor;
+
+    if(!TIFFGetField(tif,TIFFTAG_COMPRESSION,&comp))
+        return FALSE;
+    if(comp!=COMPRESSION_LZW || !TIFFGetField(tif,TIFFTAG_PREDICTOR,&predictor))
+        predictor=PREDICTOR_NONE;
+    coding->compression=comp;
+    coding->stride=(predictor==PREDICTOR_HORIZONTAL) ? GetTifType(tif) : 0;
+    coding->rows=rows;
+    coding->size=size;
+    return TRUE;
+}
+
+
+
+/* EncodeRows encodes rows rows from buffer to out with the compression
+   of coding. Returns the encoded size, 0 on error. Only coding is read,
+   so the rows can be encoded while the TIFF structure is changed. */
+
+static u_long EncodeRows(coding_t *coding,buffer_t buffer,u_long rows,
+                         buffer_t out)
+{
+    if(coding->compression==COMPRESSION_PACKBITS)
+        return TIFFPackBitsEncode((u_char *) out,(u_char *) buffer,
+                                  rows*coding->size,coding->size);
+    if(coding->compression==COMPRESSION_LZW)
+        return TIFFLZWEncode((u_char *) out,(u_char *) buffer,
+                             rows*coding->size,coding->size,coding->stride);
+    return 0;
+}
+
+
+
+/* ProjectedSize returns the largest size of a new TIFF file of width x
+   length pixels of type samples with the current compression and tile
+   size. The edge tiles are full tiles, compressed data may grow by a
+   half and the strip arrays and the directory take some bytes for
+   each strip. */
+
+static double ProjectedSize(int type,u_long width,u_long length)
+{
+    double size,strips;
+
+    if(TileSize>0)
+        {
+        width=(width+TileSize-1)/TileSize*TileSize;
+        length=(length+TileSize-1)/TileSize*TileSize;
+        strips=(double) (width/TileSize)*(length/TileSize);
+        }
+    else
+        strips=(double) (length+ROWSPERSTRIP-1)/ROWSPERSTRIP;
+    size=(double) width*length*type;
+    if(CompressionFlag!=COMPRESSION_NONE)
+        size*=1.5;
+    return size+16.0*strips+4096.0;
+}
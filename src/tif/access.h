@@ -29,6 +29,7 @@
 
 #define READ  "r"      /* The mode when the files are opened */
 #define WRITE "w"
+#define WRITE_BIGTIFF "w8" /* BigTIFF for files over 4 GB */
 
 
 typedef int logical;   /* Type for using logical value */
@@ -47,6 +48,18 @@ typedef struct {         /* TIFF image size and resolution type */
     } ImageSize;
 
 
+/* Compression of the strips or tiles of a TIFF image, read once from
+   the TIFF structure so that they can be encoded in other threads
+   without touching it. */
+
+typedef struct {
+    u_short compression;    /* Compression scheme */
+    int stride;             /* Differencing stride of LZW, 0 if none */
+    u_long rows;            /* Rows in a strip or tile */
+    u_long size;            /* Bytes in a row of a strip or tile */
+    } coding_t;
+
+
 
 /* ----------------------------------------------------------- */
 /* Function prototypes                                         */
@@ -72,6 +85,27 @@ logical WriteRowBuffer(TIFF *,buffer_t,u_long); /* Write buffer to file */
 logical ReadRowBuffer(TIFF *,buffer_t,u_long);  /* Read buffer from file */
 void FreeRowBuffer(buffer_t);        /* Free allocated memory. */
 
+/* These functions encode strips separately and write them. */
+u_long StripRows(TIFF *);            /* Rows in a strip */
+u_long EncodedStripSize(TIFF *);     /* Largest encoded strip, 0 if none */
+logical GetStripCoding(TIFF *,coding_t *); /* Compression of the strips */
+u_long EncodeStrip(coding_t *,buffer_t,u_long,buffer_t); /* Encode strip */
+logical WriteEncodedStrip(TIFF *,buffer_t,u_long,u_long); /* Write strip */
+
+/* These functions work with tiles, which can be written in any order. */
+void SetTileSize(u_long);            /* Tile size of output file, 0 strips */
+u_long GetTileSize(TIFF *);          /* Tile size, 0 if saved in strips */
+buffer_t AllocTileBuffer(TIFF *);    /* Allocate memory for tile buffer */
+logical WriteTileBuffer(TIFF *,buffer_t,u_long,u_long); /* Write tile */
+u_long EncodedTileSize(TIFF *);      /* Largest encoded tile, 0 if none */
+logical GetTileCoding(TIFF *,coding_t *); /* Compression of the tiles */
+u_long EncodeTile(coding_t *,buffer_t,buffer_t); /* Encode tile */
+logical WriteEncodedTile(TIFF *,buffer_t,u_long,u_long,u_long); /* Write tile */
+
+/* These functions map the rows of an uncompressed image to memory. */
+buffer_t MapRows(TIFF *);            /* Map rows of the file, NULL if not */
+logical UnmapRows(TIFF *);           /* Unmap the rows */
+
 /* Macros for getin and puting pixel in a buffer */
 #define GetPixel(buf,type,col,i)              buf[type*i+(col-(type==RGB?RED:CYAN))]
 #define PutPixel(buf,type,col,i,val)          buf[type*i+(col-(type==RGB?RED:CYAN))]=val
@@ -264,6 +264,10 @@ const int tiffDataWidth[] = {
     8,  /* TIFF_SRATIONAL */
     4,  /* TIFF_FLOAT */
     8,  /* TIFF_DOUBLE */
+    0,  /* 13, unused */
+    0,  /* 14, unused */
+    0,  /* 15, unused */
+    8,  /* TIFF_LONG8 */
 };
 
 const TIFFFieldInfo *
@@ -68,6 +68,11 @@ static  int TIFFWriteTransferFunction(TIFF*, TIFFDirEntry*);
 #endif
 static  int TIFFWriteData(TIFF *, TIFFDirEntry *, char *);
 static  int TIFFLinkDirectory(TIFF *);
+static  u_long TIFFDirSize(TIFF *, int);
+static  int TIFFWriteDirEntries(TIFF *, TIFFDirEntry *, int);
+static  u_char *TIFFPutShort(u_char *, u_short);
+static  u_char *TIFFPutLong(u_char *, u_long);
+static  u_char *TIFFPutOffset(TIFF *, u_char *, u_long);
 #else
 static  int TIFFWriteNormalTag();
 static  void TIFFSetupShortLong();
@@ -89,6 +94,11 @@ static  int TIFFWriteTransferFunction();
 #endif
 static  int TIFFWriteData();
 static  int TIFFLinkDirectory();
+static  u_long TIFFDirSize();
+static  int TIFFWriteDirEntries();
+static  u_char *TIFFPutShort();
+static  u_char *TIFFPutLong();
+static  u_char *TIFFPutOffset();
 #endif
 
 #define WriteRationalPair(type, tag1, v1, tag2, v2) {       \
@@ -175,8 +185,7 @@ DECLARE1(TIFFWriteDirectory, TIFF*, tif)
      */
     if (tif->tif_diroff == 0 && !TIFFLinkDirectory(tif))
         return (0);
-    tif->tif_dataoff =
-        tif->tif_diroff + sizeof (short) + dirsize + sizeof (long);
+    tif->tif_dataoff = tif->tif_diroff + TIFFDirSize(tif, nfields);
     if (tif->tif_dataoff & 1)
         tif->tif_dataoff++;
     (void) TIFFSeekFile(tif, tif->tif_dataoff, L_SET);
@@ -214,7 +223,8 @@ DECLARE1(TIFFWriteDirectory, TIFF*, tif)
                 TIFFTAG_TILEOFFSETS : TIFFTAG_STRIPOFFSETS;
             if (tag != fip->field_tag)
                 continue;
-            if (!TIFFWriteLongArray(tif, TIFF_LONG, tag, dir,
+            if (!TIFFWriteLongArray(tif,
+                isBigTIFF(tif) ? TIFF_LONG8 : TIFF_LONG, tag, dir,
                 (int) td->td_nstrips, td->td_stripoffset))
                 goto bad;
             break;
@@ -229,7 +239,8 @@ DECLARE1(TIFFWriteDirectory, TIFF*, tif)
                 TIFFTAG_TILEBYTECOUNTS : TIFFTAG_STRIPBYTECOUNTS;
             if (tag != fip->field_tag)
                 continue;
-            if (!TIFFWriteLongArray(tif, TIFF_LONG, tag, dir,
+            if (!TIFFWriteLongArray(tif,
+                isBigTIFF(tif) ? TIFF_LONG8 : TIFF_LONG, tag, dir,
                 (int) td->td_nstrips, td->td_stripbytecount))
                 goto bad;
             break;
@@ -311,20 +322,9 @@ DECLARE1(TIFFWriteDirectory, TIFF*, tif)
     /*
      * Write directory.
      */
-    (void) TIFFSeekFile(tif, tif->tif_diroff, L_SET);
     dircount = nfields;
-    if (!WriteOK(tif, &dircount, sizeof (short))) {
-        TIFFError(tif->tif_name, "Error writing directory count");
+    if (!TIFFWriteDirEntries(tif, (TIFFDirEntry *)data, dircount))
         goto bad;
-    }
-    if (!WriteOK(tif, data, dirsize)) {
-        TIFFError(tif->tif_name, "Error writing directory contents");
-        goto bad;
-    }
-    if (!WriteOK(tif, &tif->tif_nextdiroff, sizeof (long))) {
-        TIFFError(tif->tif_name, "Error writing directory link");
-        goto bad;
-    }
     TIFFFreeDirectory(tif);
     _TIFFfree(data);
     tif->tif_flags &= ~TIFF_DIRTYDIRECT;
@@ -437,6 +437,8 @@ DECLARE3(TIFFWriteNormalTag,
             return (0);
         break;
     }
+    case TIFF_LONG8:        /* only strip/tile offsets and counts, see above */
+        break;
     }
     return (1);
 }
@@ -731,18 +733,48 @@ DECLARE2(TIFFWriteTransferFunction, TIFF*, tif, TIFFDirEntry*, dir)
 static int
 DECLARE3(TIFFWriteData, TIFF*, tif, TIFFDirEntry*, dir, char*, cp)
 {
-    int cc;
+    u_int *lp = NULL;
+    int cc, i, status;
 
-    dir->tdir_offset = tif->tif_dataoff;
     cc = dir->tdir_count * tiffDataWidth[dir->tdir_type];
-    if (SeekOK(tif, dir->tdir_offset) &&
-        WriteOK(tif, cp, cc)) {
-        tif->tif_dataoff += (cc + 1) & ~1;
-        return (1);
+    /*
+     * LONG and RATIONAL items are passed as arrays
+     * of longs, which may be wider than the 32 bits
+     * they take in the file.
+     */
+    if (sizeof (u_long) != 4 &&
+        (dir->tdir_type == TIFF_LONG || dir->tdir_type == TIFF_SLONG ||
+         dir->tdir_type == TIFF_RATIONAL || dir->tdir_type == TIFF_SRATIONAL)) {
+        lp = (u_int *)_TIFFmalloc(cc);
+        if (lp == NULL) {
+            TIFFError(tif->tif_name,
+                "No space to write data for field \"%s\"",
+                TIFFFieldWithTag(dir->tdir_tag)->field_name);
+            return (0);
+        }
+        for (i = 0; i < cc / 4; i++)
+            lp[i] = (u_int)((u_long *)cp)[i];
+        cp = (char *)lp;
     }
-    TIFFError(tif->tif_name, "Error writing data for field \"%s\"",
-        TIFFFieldWithTag(dir->tdir_tag)->field_name);
-    return (0);
+    /*
+     * BigTIFF keeps items of 8 bytes or less in place.
+     */
+    if (isBigTIFF(tif) && cc <= 8) {
+        dir->tdir_offset = 0;
+        memcpy(&dir->tdir_offset, cp, cc);
+        status = 1;
+    } else {
+        dir->tdir_offset = tif->tif_dataoff;
+        status = SeekOK(tif, dir->tdir_offset) && WriteOK(tif, cp, cc);
+        if (status)
+            tif->tif_dataoff += (cc + 1) & ~1;
+    }
+    if (lp != NULL)
+        _TIFFfree(lp);
+    if (!status)
+        TIFFError(tif->tif_name, "Error writing data for field \"%s\"",
+            TIFFFieldWithTag(dir->tdir_tag)->field_name);
+    return (status);
 }
 
 /*
@@ -754,7 +786,9 @@ DECLARE1(TIFFLinkDirectory, TIFF*, tif)
 {
     static const char module[] = "TIFFLinkDirectory";
     u_short dircount;
-    long nextdir;
+    u_int diroff;
+    u_long nextdir, bigcount, link;
+    u_char buf[8];
 
     tif->tif_diroff = (TIFFSeekFile(tif, 0L, L_XTND)+1) &~ 1L;
     if (tif->tif_header.tiff_diroff == 0) {
@@ -762,39 +796,157 @@ DECLARE1(TIFFLinkDirectory, TIFF*, tif)
          * First directory, overwrite header.
          */
         tif->tif_header.tiff_diroff = tif->tif_diroff;
-        (void) TIFFSeekFile(tif, 0L, L_SET);
-        if (!WriteOK(tif, &tif->tif_header,
-            sizeof (tif->tif_header))) {
-            TIFFError(tif->tif_name, "Error writing TIFF header");
-            return (0);
-        }
-        return (1);
+        return (_TIFFWriteHeader(tif));
     }
     /*
      * Not the first directory, search to the last and append.
+     * The directories were written by us, so the file is in
+     * native byte order.
      */
     nextdir = tif->tif_header.tiff_diroff;
     do {
-        if (!SeekOK(tif, nextdir) ||
-            !ReadOK(tif, &dircount, sizeof (dircount))) {
-            TIFFError(module, "Error fetching directory count");
-            return (0);
-        }
-        if (tif->tif_flags & TIFF_SWAB)
-            TIFFSwabShort(&dircount);
-        TIFFSeekFile(tif, dircount * sizeof (TIFFDirEntry), L_INCR);
-        if (!ReadOK(tif, &nextdir, sizeof (nextdir))) {
-            TIFFError(module, "Error fetching directory link");
-            return (0);
+        if (isBigTIFF(tif)) {
+            if (!SeekOK(tif, nextdir) ||
+                !ReadOK(tif, &bigcount, sizeof (bigcount))) {
+                TIFFError(module, "Error fetching directory count");
+                return (0);
+            }
+            link = nextdir + TIFFDirSize(tif, (int) bigcount) - 8;
+            if (!SeekOK(tif, link) ||
+                !ReadOK(tif, &nextdir, sizeof (nextdir))) {
+                TIFFError(module, "Error fetching directory link");
+                return (0);
+            }
+        } else {
+            if (!SeekOK(tif, nextdir) ||
+                !ReadOK(tif, &dircount, sizeof (dircount))) {
+                TIFFError(module, "Error fetching directory count");
+                return (0);
+            }
+            link = nextdir + TIFFDirSize(tif, dircount) - 4;
+            if (!SeekOK(tif, link) ||
+                !ReadOK(tif, &diroff, sizeof (diroff))) {
+                TIFFError(module, "Error fetching directory link");
+                return (0);
+            }
+            nextdir = diroff;
         }
-        if (tif->tif_flags & TIFF_SWAB)
-            TIFFSwabLong((u_long *)&nextdir);
     } while (nextdir != 0);
-    (void) TIFFSeekFile(tif, -sizeof (nextdir), L_INCR);
-    if (!WriteOK(tif, &tif->tif_diroff, sizeof (tif->tif_diroff))) {
+    if (!SeekOK(tif, link) ||
+        !WriteOK(tif, buf, TIFFPutOffset(tif, buf, tif->tif_diroff) - buf)) {
         TIFFError(module, "Error writing directory link");
         return (0);
     }
     return (1);
 }
 
+/*
+ * Write the file header in the external form
+ * of a classic TIFF or a BigTIFF file.
+ */
+int
+DECLARE1(_TIFFWriteHeader, TIFF*, tif)
+{
+    u_char buf[TIFF_BIGHEADERSIZE], *cp;
+
+    cp = TIFFPutShort(buf, tif->tif_header.tiff_magic);
+    cp = TIFFPutShort(cp, tif->tif_header.tiff_version);
+    if (isBigTIFF(tif)) {
+        cp = TIFFPutShort(cp, 8);
+        cp = TIFFPutShort(cp, 0);
+    }
+    cp = TIFFPutOffset(tif, cp, tif->tif_header.tiff_diroff);
+    if (!SeekOK(tif, 0L) || !WriteOK(tif, buf, cp - buf)) {
+        TIFFError(tif->tif_name, "Error writing TIFF header");
+        return (0);
+    }
+    return (1);
+}
+
+/*
+ * External size of a directory of n entries
+ * with its count and link.
+ */
+static u_long
+DECLARE2(TIFFDirSize, TIFF*, tif, int, n)
+{
+    if (isBigTIFF(tif))
+        return (8 + n * TIFF_BIGDIRENTRYSIZE + 8);
+    return (sizeof (short) + n * TIFF_DIRENTRYSIZE + 4);
+}
+
+/*
+ * Write the n entries of the current directory in
+ * their external form.  Values that fit in 4 bytes
+ * are kept in the low 32 bits of the offset field
+ * as in a classic TIFF file, and are padded with
+ * zeros in a BigTIFF file.
+ */
+static int
+DECLARE3(TIFFWriteDirEntries, TIFF*, tif, TIFFDirEntry*, dir, int, n)
+{
+    u_char *buf, *cp;
+    u_long size;
+    int i, status;
+
+    size = TIFFDirSize(tif, n);
+    buf = (u_char *)_TIFFmalloc(size);
+    if (buf == NULL) {
+        TIFFError(tif->tif_name, "Cannot write directory, out of space");
+        return (0);
+    }
+    if (isBigTIFF(tif))
+        cp = TIFFPutOffset(tif, buf, (u_long) n);
+    else
+        cp = TIFFPutShort(buf, (u_short) n);
+    for (i = 0; i < n; i++, dir++) {
+        cp = TIFFPutShort(cp, dir->tdir_tag);
+        cp = TIFFPutShort(cp, dir->tdir_type);
+        cp = TIFFPutOffset(tif, cp, dir->tdir_count);
+        if (!isBigTIFF(tif))
+            cp = TIFFPutLong(cp, dir->tdir_offset);
+        else if (dir->tdir_count * tiffDataWidth[dir->tdir_type] <= 4) {
+            cp = TIFFPutLong(cp, dir->tdir_offset);
+            cp = TIFFPutLong(cp, 0L);
+        } else {
+            memcpy(cp, &dir->tdir_offset, 8);
+            cp += 8;
+        }
+    }
+    (void) TIFFPutOffset(tif, cp, tif->tif_nextdiroff);
+    status = SeekOK(tif, tif->tif_diroff) && WriteOK(tif, buf, size);
+    if (!status)
+        TIFFError(tif->tif_name, "Error writing directory contents");
+    _TIFFfree(buf);
+    return (status);
+}
+
+/*
+ * Put a 16-bit, a 32-bit and an offset value in native
+ * byte order.  An offset is 64 bits in a BigTIFF file.
+ */
+static u_char *
+DECLARE2(TIFFPutShort, u_char*, cp, u_short, v)
+{
+    memcpy(cp, &v, 2);
+    return (cp + 2);
+}
+
+static u_char *
+DECLARE2(TIFFPutLong, u_char*, cp, u_long, v)
+{
+    u_int w = (u_int) v;
+
+    memcpy(cp, &w, 4);
+    return (cp + 4);
+}
+
+static u_char *
+DECLARE3(TIFFPutOffset, TIFF*, tif, u_char*, cp, u_long, v)
+{
+    if (!isBigTIFF(tif))
+        return (TIFFPutLong(cp, v));
+    memcpy(cp, &v, 8);
+    return (cp + 8);
+}
+
@@ -0,0 +1,524 @@
+/*
+ * TIFF Library.
+ *
+ * LZW Compression Algorithm Support.
+ *
+ * The codes are written most significant bit first and widen
+ * one code early, as in TIFF 6.0.  The table is cleared when
+ * it is full.  With Predictor=2 the rows of 8-bit samples are
+ * differenced horizontally before encoding and summed after
+ * decoding.
+ *
+ * A strip is encoded through a private buffer, like PackBits.
+ * A strip is decoded at once to a private buffer when it is
+ * read in and the rows are copied from there.
+ */
+#include "tiffiop.h"
+#include <stdio.h>
+
+#define BITS_MIN    9           /* start with 9 bits */
+#define BITS_MAX    12          /* max of 12 bit codes */
+#define CODE_CLEAR  256         /* code to clear string table */
+#define CODE_EOI    257         /* end-of-information code */
+#define CODE_FIRST  258         /* first free code entry */
+#define CODE_MAX    MAXCODE(BITS_MAX)
+#define HSIZE       9001        /* 91% occupancy */
+#define HSHIFT      (13-8)
+#define MAXCODE(n)  ((1L<<(n))-1)
+
+typedef struct {
+    long    hash;
+    u_short code;
+} hash_t;
+
+typedef struct {
+    hash_t  hashtab[HSIZE];     /* string table of the encoder */
+    long    oldcode;            /* prefix string, -1 at start */
+    long    free_ent;           /* next free table entry */
+    long    maxcode;            /* widen codes beyond this */
+    int     nbits;              /* bits in a code */
+    u_long  nextdata;           /* bits not written yet */
+    int     nextbits;           /* number of bits in nextdata */
+} LZWEncodeState;
+
+typedef struct {
+    LZWEncodeState *enc;        /* encoder, NULL when decoding */
+    u_char  *buf;               /* encoded row or decoded strip */
+    u_long  size;               /* size of buf */
+    u_char  *bp;                /* next decoded byte */
+    long    cc;                 /* decoded bytes left */
+} LZWState;
+
+#if USE_PROTOTYPES
+static  void LZWEncodeStart(LZWEncodeState *);
+static  u_char *LZWEncodeRow(LZWEncodeState *, u_char *, u_char *, u_long, int);
+static  u_char *LZWEncodeEnd(LZWEncodeState *, u_char *);
+static  long LZWDecodeBuffer(u_char *, u_long, u_char *, long);
+static  u_long LZWRowSize(TIFF *);
+static  int LZWStride(TIFF *);
+#else
+static  void LZWEncodeStart();
+static  u_char *LZWEncodeRow();
+static  u_char *LZWEncodeEnd();
+static  long LZWDecodeBuffer();
+static  u_long LZWRowSize();
+static  int LZWStride();
+#endif
+
+#define PutNextCode(op, c) {                            \
+    nextdata = (nextdata << nbits) | (c);               \
+    nextbits += nbits;                                  \
+    *op++ = (u_char)(nextdata >> (nextbits-8));         \
+    nextbits -= 8;                                      \
+    if (nextbits >= 8) {                                \
+        *op++ = (u_char)(nextdata >> (nextbits-8));     \
+        nextbits -= 8;                                  \
+    }                                                   \
+}
+
+static void
+DECLARE1(ClearHash, LZWEncodeState*, sp)
+{
+    register hash_t *hp;
+
+    for (hp = &sp->hashtab[HSIZE-1]; hp >= sp->hashtab; hp--)
+        hp->hash = -1;
+}
+
+/*
+ * Reset the encoder for a new strip.
+ */
+static void
+DECLARE1(LZWEncodeStart, LZWEncodeState*, sp)
+{
+    ClearHash(sp);
+    sp->oldcode = -1;
+    sp->free_ent = CODE_FIRST;
+    sp->nbits = BITS_MIN;
+    sp->maxcode = MAXCODE(BITS_MIN);
+    sp->nextdata = 0;
+    sp->nextbits = 0;
+}
+
+/*
+ * Encode a row of cc bytes from bp to op.  If stride
+ * is not 0 the row is differenced horizontally over
+ * stride bytes.  Returns the spot after the codes.
+ */
+static u_char *
+DECLARE5(LZWEncodeRow, LZWEncodeState*, sp, u_char*, op, u_char*, bp, u_long, cc, int, stride)
+{
+    register hash_t *hp;
+    register long fcode, h, disp;
+    long ent = sp->oldcode, free_ent = sp->free_ent, maxcode = sp->maxcode;
+    u_long nextdata = sp->nextdata;
+    int nbits = sp->nbits, nextbits = sp->nextbits;
+    u_long i;
+    int c;
+
+    for (i = 0; i < cc; i++) {
+        c = (stride > 0 && i >= (u_long)stride ?
+            (u_char)(bp[i] - bp[i-stride]) : bp[i]);
+        if (ent == -1) {
+            PutNextCode(op, CODE_CLEAR);
+            ent = c;
+            continue;
+        }
+        fcode = ((long)c << BITS_MAX) + ent;
+        h = (c << HSHIFT) ^ ent;        /* xor hashing */
+        hp = &sp->hashtab[h];
+        if (hp->hash == fcode) {
+            ent = hp->code;
+            continue;
+        }
+        if (hp->hash >= 0) {
+            /*
+             * Primary hash failed, check secondary hash.
+             */
+            disp = HSIZE - h;
+            if (h == 0)
+                disp = 1;
+            do {
+                if ((h -= disp) < 0)
+                    h += HSIZE;
+                hp = &sp->hashtab[h];
+            } while (hp->hash >= 0 && hp->hash != fcode);
+            if (hp->hash == fcode) {
+                ent = hp->code;
+                continue;
+            }
+        }
+        /*
+         * New entry, emit code and add to table.
+         */
+        PutNextCode(op, ent);
+        ent = c;
+        hp->code = (u_short)free_ent++;
+        hp->hash = fcode;
+        if (free_ent == CODE_MAX-1) {
+            /*
+             * Table is full, emit clear code and reset.
+             */
+            ClearHash(sp);
+            PutNextCode(op, CODE_CLEAR);
+            free_ent = CODE_FIRST;
+            nbits = BITS_MIN;
+            maxcode = MAXCODE(BITS_MIN);
+        } else if (free_ent > maxcode) {
+            nbits++;
+            maxcode = MAXCODE(nbits);
+        }
+    }
+    sp->oldcode = ent;
+    sp->free_ent = free_ent;
+    sp->maxcode = maxcode;
+    sp->nbits = nbits;
+    sp->nextdata = nextdata;
+    sp->nextbits = nextbits;
+    return (op);
+}
+
+/*
+ * Finish the strip: emit the pending prefix, the
+ * end-of-information code and the last bits.
+ */
+static u_char *
+DECLARE2(LZWEncodeEnd, LZWEncodeState*, sp, u_char*, op)
+{
+    u_long nextdata = sp->nextdata;
+    int nbits = sp->nbits, nextbits = sp->nextbits;
+
+    if (sp->oldcode != -1) {
+        PutNextCode(op, sp->oldcode);
+        sp->oldcode = -1;
+    }
+    PutNextCode(op, CODE_EOI);
+    if (nextbits > 0)
+        *op++ = (u_char)(nextdata << (8-nextbits));
+    sp->nextdata = 0;
+    sp->nextbits = 0;
+    return (op);
+}
+
+/*
+ * Encode cc bytes of rows of rowsize bytes from bp
+ * to op as one strip.  If stride is not 0 the rows
+ * are differenced horizontally over stride bytes.
+ * There must be room for TIFFLZWBound(cc) bytes in op.
+ * Returns the number of bytes in op, 0 if there is
+ * no memory.
+ */
+u_long
+DECLARE5(TIFFLZWEncode, u_char*, op, u_char*, bp, u_long, cc, u_long, rowsize, int, stride)
+{
+    LZWEncodeState *sp;
+    u_char *start = op;
+    u_long n;
+
+    if ((sp = (LZWEncodeState *)_TIFFmalloc(sizeof (LZWEncodeState))) == NULL)
+        return (0);
+    LZWEncodeStart(sp);
+    while (cc > 0) {
+        n = (cc < rowsize ? cc : rowsize);
+        op = LZWEncodeRow(sp, op, bp, n, stride);
+        bp += n;
+        cc -= n;
+    }
+    op = LZWEncodeEnd(sp, op);
+    _TIFFfree(sp);
+    return (op - start);
+}
+
+/*
+ * Decode the strip of cc bytes in bp to op of occ
+ * bytes.  Returns the number of decoded bytes, -1
+ * if the codes are corrupted.
+ */
+static long
+DECLARE4(LZWDecodeBuffer, u_char*, op, u_long, occ, u_char*, bp, long, cc)
+{
+    short prefix[CODE_MAX+1];
+    u_char suffix[CODE_MAX+1];
+    u_short length[CODE_MAX+1];
+    u_char *start = op, *end = op + occ, *tp;
+    u_long nextdata = 0;
+    int nextbits = 0, nbits = BITS_MIN;
+    long code, oldcode = -1, free_ent = CODE_FIRST, c;
+
+    for (code = 0; code < 256; code++) {
+        prefix[code] = -1;
+        suffix[code] = (u_char)code;
+        length[code] = 1;
+    }
+    for (;;) {
+        while (nextbits < nbits) {
+            if (cc <= 0)
+                return (op - start);    /* no EOI code */
+            nextdata = (nextdata << 8) | *bp++;
+            cc--;
+            nextbits += 8;
+        }
+        code = (nextdata >> (nextbits - nbits)) & MAXCODE(nbits);
+        nextbits -= nbits;
+        if (code == CODE_EOI)
+            break;
+        if (code == CODE_CLEAR) {
+            free_ent = CODE_FIRST;
+            nbits = BITS_MIN;
+            oldcode = -1;
+            continue;
+        }
+        if (oldcode == -1) {
+            if (code >= 256)
+                return (-1);
+        } else {
+            if (code > free_ent || free_ent > CODE_MAX)
+                return (-1);
+            /*
+             * Add the previous string and the first byte
+             * of this one; the code may be the new entry.
+             */
+            for (c = (code < free_ent ? code : oldcode);
+                prefix[c] >= 0; c = prefix[c])
+                ;
+            prefix[free_ent] = (short)oldcode;
+            suffix[free_ent] = suffix[c];
+            length[free_ent] = length[oldcode] + 1;
+            if (++free_ent + 1 > MAXCODE(nbits) && nbits < BITS_MAX)
+                nbits++;
+        }
+        if (op + length[code] > end)
+            return (-1);
+        tp = op + length[code];
+        for (c = code; c >= 0; c = prefix[c])
+            *--tp = suffix[c];
+        op += length[code];
+        oldcode = code;
+    }
+    return (op - start);
+}
+
+static u_long
+DECLARE1(LZWRowSize, TIFF*, tif)
+{
+    return (isTiled(tif) ? TIFFTileRowSize(tif) : (u_long)tif->tif_scanlinesize);
+}
+
+/*
+ * Bytes to difference over, 0 without a predictor.
+ */
+static int
+DECLARE1(LZWStride, TIFF*, tif)
+{
+    TIFFDirectory *td = &tif->tif_dir;
+
+    if (td->td_predictor != PREDICTOR_HORIZONTAL || td->td_bitspersample != 8)
+        return (0);
+    return (td->td_planarconfig == PLANARCONFIG_CONTIG ?
+        td->td_samplesperpixel : 1);
+}
+
+static int
+DECLARE1(LZWPreEncode, TIFF*, tif)
+{
+    LZWState *sp = (LZWState *)tif->tif_data;
+
+    if (sp->enc == NULL) {
+        sp->enc = (LZWEncodeState *)_TIFFmalloc(sizeof (LZWEncodeState));
+        if (sp->enc == NULL) {
+            TIFFError(tif->tif_name, "No space for LZW encoder");
+            return (0);
+        }
+    }
+    LZWEncodeStart(sp->enc);
+    return (1);
+}
+
+/*
+ * Copy the codes from the private buffer to the
+ * raw data buffer.
+ */
+static int
+DECLARE3(LZWCopy, TIFF*, tif, u_char*, pp, long, n)
+{
+    long m;
+
+    for (; n > 0; pp += m, n -= m) {
+        if (tif->tif_rawcc >= tif->tif_rawdatasize &&
+            !TIFFFlushData1(tif))
+            return (0);
+        if ((m = tif->tif_rawdatasize - tif->tif_rawcc) > n)
+            m = n;
+        memcpy(tif->tif_rawcp, pp, m);
+        tif->tif_rawcp += m;
+        tif->tif_rawcc += m;
+    }
+    return (1);
+}
+
+/*
+ * Encode a hunk of rows.
+ */
+static int
+DECLARE4(LZWEncode, TIFF*, tif, u_char*, bp, u_long, cc, u_int, s)
+{
+    LZWState *sp = (LZWState *)tif->tif_data;
+    u_long rowsize = LZWRowSize(tif);
+    int stride = LZWStride(tif);
+    u_long m;
+
+    (void) s;
+    if (sp->buf == NULL || sp->size < TIFFLZWBound(rowsize)) {
+        if (sp->buf != NULL)
+            _TIFFfree(sp->buf);
+        sp->size = TIFFLZWBound(rowsize);
+        sp->buf = (u_char *)_TIFFmalloc(sp->size);
+        if (sp->buf == NULL) {
+            TIFFError(tif->tif_name,
+                "LZWEncode: No space for row buffer");
+            return (-1);
+        }
+    }
+    while (cc > 0) {
+        m = (cc < rowsize ? cc : rowsize);
+        if (!LZWCopy(tif, sp->buf,
+            LZWEncodeRow(sp->enc, sp->buf, bp, m, stride) - sp->buf))
+            return (-1);
+        bp += m;
+        cc -= m;
+    }
+    return (1);
+}
+
+static int
+DECLARE1(LZWPostEncode, TIFF*, tif)
+{
+    LZWState *sp = (LZWState *)tif->tif_data;
+    u_char end[8];
+
+    return (LZWCopy(tif, end, LZWEncodeEnd(sp->enc, end) - end));
+}
+
+/*
+ * Decode the strip or tile read in.
+ */
+static int
+DECLARE1(LZWPreDecode, TIFF*, tif)
+{
+    LZWState *sp = (LZWState *)tif->tif_data;
+    u_long size = isTiled(tif) ? TIFFTileSize(tif) : TIFFStripSize(tif);
+    u_long rowsize = LZWRowSize(tif);
+    int stride = LZWStride(tif);
+    u_char *row;
+    u_long i;
+
+    if (sp->buf == NULL || sp->size < size) {
+        if (sp->buf != NULL)
+            _TIFFfree(sp->buf);
+        sp->size = size;
+        sp->buf = (u_char *)_TIFFmalloc(sp->size);
+        if (sp->buf == NULL) {
+            TIFFError(tif->tif_name,
+                "LZWPreDecode: No space for strip buffer");
+            return (0);
+        }
+    }
+    sp->cc = LZWDecodeBuffer(sp->buf, size,
+        (u_char *)tif->tif_rawcp, tif->tif_rawcc);
+    if (sp->cc < 0) {
+        TIFFError(tif->tif_name,
+            "LZWPreDecode: Corrupted LZW codes in strip %d",
+            tif->tif_curstrip);
+        sp->cc = 0;
+        return (0);
+    }
+    if (stride > 0)
+        for (row = sp->buf; row + rowsize <= sp->buf + sp->cc; row += rowsize)
+            for (i = (u_long)stride; i < rowsize; i++)
+                row[i] += row[i-stride];
+    sp->bp = sp->buf;
+    return (1);
+}
+
+/*
+ * Decode a hunk of rows.
+ */
+static int
+DECLARE4(LZWDecode, TIFF*, tif, u_char*, op, u_long, occ, u_int, s)
+{
+    LZWState *sp = (LZWState *)tif->tif_data;
+
+    (void) s;
+    if ((u_long)sp->cc < occ) {
+        TIFFError(tif->tif_name,
+            "LZWDecode: Not enough data for scanline %d",
+            tif->tif_row);
+        return (0);
+    }
+    memcpy(op, sp->bp, occ);
+    sp->bp += occ;
+    sp->cc -= occ;
+    return (1);
+}
+
+/*
+ * Seek forwards nrows in the current strip.
+ */
+static int
+DECLARE2(LZWSeek, TIFF*, tif, u_long, nrows)
+{
+    LZWState *sp = (LZWState *)tif->tif_data;
+    u_long n = nrows * LZWRowSize(tif);
+
+    if ((u_long)sp->cc < n)
+        return (0);
+    sp->bp += n;
+    sp->cc -= n;
+    return (1);
+}
+
+static int
+DECLARE1(LZWCleanup, TIFF*, tif)
+{
+    LZWState *sp = (LZWState *)tif->tif_data;
+
+    if (sp) {
+        if (sp->enc)
+            _TIFFfree(sp->enc);
+        if (sp->buf)
+            _TIFFfree(sp->buf);
+        _TIFFfree(tif->tif_data);
+        tif->tif_data = NULL;
+    }
+    return (1);
+}
+
+int
+DECLARE1(TIFFInitLZW, TIFF*, tif)
+{
+    LZWState *sp;
+
+    tif->tif_data = _TIFFmalloc(sizeof (LZWState));
+    if (tif->tif_data == NULL) {
+        TIFFError(tif->tif_name, "No space for LZW state block");
+        return (0);
+    }
+    sp = (LZWState *)tif->tif_data;
+    sp->enc = NULL;
+    sp->buf = NULL;
+    sp->size = 0;
+    sp->bp = NULL;
+    sp->cc = 0;
+    tif->tif_predecode = LZWPreDecode;
+    tif->tif_decoderow = LZWDecode;
+    tif->tif_decodestrip = LZWDecode;
+    tif->tif_decodetile = LZWDecode;
+    tif->tif_preencode = LZWPreEncode;
+    tif->tif_postencode = LZWPostEncode;
+    tif->tif_encoderow = LZWEncode;
+    tif->tif_encodestrip = LZWEncode;
+    tif->tif_encodetile = LZWEncode;
+    tif->tif_seek = LZWSeek;
+    tif->tif_cleanup = LZWCleanup;
+    return (1);
+}
@@ -199,10 +199,20 @@ TIFFClientOpen(name, mode,
             TIFF_BIGENDIAN : TIFF_LITTLEENDIAN;
         tif->tif_header.tiff_version = TIFF_VERSION;
         tif->tif_header.tiff_diroff = 0;    /* filled in later */
-        if (!WriteOK(tif, &tif->tif_header, sizeof (TIFFHeader))) {
-            TIFFError(name, "Error writing TIFF header");
-            goto bad;
+        /*
+         * Mode "w8" writes a BigTIFF file, which
+         * needs longs of 64 bits for its offsets.
+         */
+        if (mode[0] == 'w' && mode[1] == '8') {
+            if (sizeof (u_long) < 8) {
+                TIFFError(name, "Cannot write BigTIFF with 32-bit offsets");
+                goto bad;
+            }
+            tif->tif_flags |= TIFF_BIGTIFF;
+            tif->tif_header.tiff_version = TIFF_BIGTIFF_VERSION;
         }
+        if (!_TIFFWriteHeader(tif))
+            goto bad;
         /*
          * Setup the byte order handling.
          */
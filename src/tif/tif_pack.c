@@ -0,0 +1,212 @@
+/*
+ * TIFF Library.
+ *
+ * PackBits Compression Algorithm Support.
+ *
+ * Every row is packed separately to runs of a repeated byte and
+ * to literal byte strings of at most 128 bytes.  The rows are
+ * first packed to a private buffer and then copied to the raw
+ * data buffer, so that a row never needs to fit in the raw data
+ * buffer in one piece.
+ */
+#include "tiffiop.h"
+#include <stdio.h>
+
+typedef struct {
+    u_char  *buf;           /* packed row */
+    u_long  size;           /* size of buf */
+} PackBitsState;
+
+#if USE_PROTOTYPES
+static  u_char *PackBitsRow(u_char *, u_char *, u_long);
+static  u_long PackBitsRowSize(TIFF *);
+#else
+static  u_char *PackBitsRow();
+static  u_long PackBitsRowSize();
+#endif
+
+/*
+ * Pack a row of cc bytes from bp to op.  Returns
+ * the spot after the packed data.
+ */
+static u_char *
+DECLARE3(PackBitsRow, u_char*, op, u_char*, bp, u_long, cc)
+{
+    u_long n;
+
+    while (cc > 0) {
+        /*
+         * Runs of two or more bytes are replicated.
+         */
+        for (n = 1; n < cc && n < 128 && bp[n] == bp[0]; n++)
+            ;
+        if (n > 1) {
+            *op++ = (u_char)(1 - n);
+            *op++ = bp[0];
+        } else {
+            /*
+             * A literal string ends where a run
+             * of three bytes begins.
+             */
+            for (n = 1; n < cc && n < 128; n++)
+                if (n + 2 < cc && bp[n] == bp[n+1] &&
+                    bp[n] == bp[n+2])
+                    break;
+            *op++ = (u_char)(n - 1);
+            memcpy(op, bp, n);
+            op += n;
+        }
+        bp += n;
+        cc -= n;
+    }
+    return (op);
+}
+
+/*
+ * Pack cc bytes of rows of rowsize bytes from bp
+ * to op.  There must be room for TIFFPackBitsBound
+ * bytes of each row in op.  Returns the number of
+ * bytes in op.
+ */
+u_long
+DECLARE4(TIFFPackBitsEncode, u_char*, op, u_char*, bp, u_long, cc, u_long, rowsize)
+{
+    u_char *start = op;
+    u_long n;
+
+    while (cc > 0) {
+        n = (cc < rowsize ? cc : rowsize);
+        op = PackBitsRow(op, bp, n);
+        bp += n;
+        cc -= n;
+    }
+    return (op - start);
+}
+
+/*
+ * Size of a row in a strip or tile.
+ */
+static u_long
+DECLARE1(PackBitsRowSize, TIFF*, tif)
+{
+    return (isTiled(tif) ? TIFFTileRowSize(tif) : (u_long)tif->tif_scanlinesize);
+}
+
+/*
+ * Encode a hunk of rows.
+ */
+static int
+DECLARE4(PackBitsEncode, TIFF*, tif, u_char*, bp, u_long, cc, u_int, s)
+{
+    PackBitsState *sp = (PackBitsState *)tif->tif_data;
+    u_long rowsize = PackBitsRowSize(tif);
+    u_char *pp;
+    long n, m;
+
+    (void) s;
+    if (sp->buf == NULL || sp->size < TIFFPackBitsBound(rowsize)) {
+        if (sp->buf != NULL)
+            _TIFFfree(sp->buf);
+        sp->size = TIFFPackBitsBound(rowsize);
+        sp->buf = (u_char *)_TIFFmalloc(sp->size);
+        if (sp->buf == NULL) {
+            TIFFError(tif->tif_name,
+                "PackBitsEncode: No space for row buffer");
+            return (-1);
+        }
+    }
+    while (cc > 0) {
+        m = (cc < rowsize ? cc : rowsize);
+        n = PackBitsRow(sp->buf, bp, m) - sp->buf;
+        bp += m;
+        cc -= m;
+        for (pp = sp->buf; n > 0; pp += m, n -= m) {
+            if (tif->tif_rawcc >= tif->tif_rawdatasize &&
+                !TIFFFlushData1(tif))
+                return (-1);
+            if ((m = tif->tif_rawdatasize - tif->tif_rawcc) > n)
+                m = n;
+            memcpy(tif->tif_rawcp, pp, m);
+            tif->tif_rawcp += m;
+            tif->tif_rawcc += m;
+        }
+    }
+    return (1);
+}
+
+/*
+ * Decode a hunk of rows.
+ */
+static int
+DECLARE4(PackBitsDecode, TIFF*, tif, u_char*, op, u_long, occ, u_int, s)
+{
+    u_char *bp = (u_char *)tif->tif_rawcp;
+    long cc = tif->tif_rawcc;
+    long n;
+    int b;
+
+    (void) s;
+    while (cc > 0 && occ > 0) {
+        n = (long)(signed char)*bp++;
+        cc--;
+        if (n >= 0) {               /* literal string */
+            if ((u_long)++n > occ || n > cc)
+                break;
+            memcpy(op, bp, n);
+            op += n; occ -= n;
+            bp += n; cc -= n;
+        } else if (n != -128) {     /* replicated byte */
+            if ((u_long)(n = 1 - n) > occ || cc < 1)
+                break;
+            b = *bp++; cc--;
+            memset(op, b, n);
+            op += n; occ -= n;
+        }
+    }
+    tif->tif_rawcp = (char *)bp;
+    tif->tif_rawcc = cc;
+    if (occ > 0) {
+        TIFFError(tif->tif_name,
+            "PackBitsDecode: Not enough data for scanline %d",
+            tif->tif_row);
+        return (0);
+    }
+    return (1);
+}
+
+static int
+DECLARE1(PackBitsCleanup, TIFF*, tif)
+{
+    PackBitsState *sp = (PackBitsState *)tif->tif_data;
+
+    if (sp) {
+        if (sp->buf)
+            _TIFFfree(sp->buf);
+        _TIFFfree(tif->tif_data);
+        tif->tif_data = NULL;
+    }
+    return (1);
+}
+
+int
+DECLARE1(TIFFInitPackBits, TIFF*, tif)
+{
+    PackBitsState *sp;
+
+    tif->tif_data = _TIFFmalloc(sizeof (PackBitsState));
+    if (tif->tif_data == NULL) {
+        TIFFError(tif->tif_name, "No space for PackBits state block");
+        return (0);
+    }
+    sp = (PackBitsState *)tif->tif_data;
+    sp->buf = NULL;
+    sp->size = 0;
+    tif->tif_decoderow = PackBitsDecode;
+    tif->tif_decodestrip = PackBitsDecode;
+    tif->tif_decodetile = PackBitsDecode;
+    tif->tif_encoderow = PackBitsEncode;
+    tif->tif_encodestrip = PackBitsEncode;
+    tif->tif_encodetile = PackBitsEncode;
+    tif->tif_cleanup = PackBitsCleanup;
+    return (1);
+}
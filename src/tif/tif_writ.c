@@ -242,6 +242,63 @@ DECLARE4(TIFFWriteRawStrip,
     return (TIFFAppendToStrip(tif, strip, data, cc) ? cc : -1);
 }
 
+/*
+ * Reserve one contiguous region at the end of the
+ * file for all the strips of an uncompressed image.
+ * The strip offsets and byte counts are set for the
+ * whole image and the file is extended to cover the
+ * region, so the caller can fill it directly (e.g.
+ * through a memory mapping) before the directory is
+ * written.  If reserve is zero a reserved region is
+ * released, but the file is not shortened.  Returns
+ * the offset of the region, or 0 on error.
+ */
+u_long
+DECLARE2(TIFFReserveStrips, TIFF*, tif, int, reserve)
+{
+    static const char module[] = "TIFFReserveStrips";
+    TIFFDirectory *td = &tif->tif_dir;
+    u_long off, size, rows;
+    u_int strip;
+    u_char zero = 0;
+
+    if (!TIFFWriteCheck(tif, 0, module))
+        return (0);
+    if (!reserve) {
+        off = td->td_stripoffset[0];
+        memset(td->td_stripoffset, 0, td->td_nstrips*sizeof (u_long));
+        memset(td->td_stripbytecount, 0, td->td_nstrips*sizeof (u_long));
+        return (off);
+    }
+    if (td->td_compression != COMPRESSION_NONE ||
+        td->td_planarconfig != PLANARCONFIG_CONTIG ||
+        td->td_stripbytecount[0] != 0) {
+        TIFFError(module,
+            "%s: Can only reserve unwritten uncompressed strips",
+            tif->tif_name);
+        return (0);
+    }
+    off = TIFFSeekFile(tif, 0L, L_XTND);
+    size = 0;
+    for (strip = 0; strip < td->td_nstrips; strip++) {
+        rows = td->td_imagelength - strip * td->td_rowsperstrip;
+        if (rows > td->td_rowsperstrip)
+            rows = td->td_rowsperstrip;
+        td->td_stripoffset[strip] = off + size;
+        td->td_stripbytecount[strip] = rows * TIFFScanlineSize(tif);
+        size += td->td_stripbytecount[strip];
+    }
+    if (size == 0 || !SeekOK(tif, off + size - 1) ||
+        !WriteOK(tif, &zero, 1)) {
+        TIFFError(module, "%s: Can not extend file for strips",
+            tif->tif_name);
+        memset(td->td_stripoffset, 0, td->td_nstrips*sizeof (u_long));
+        memset(td->td_stripbytecount, 0, td->td_nstrips*sizeof (u_long));
+        return (0);
+    }
+    return (off);
+}
+
 /*
  * Write and compress a tile of data.  The
  * tile is selected by the (x,y,z,s) coordinates.
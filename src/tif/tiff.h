@@ -38,6 +38,7 @@
  *    206-622-5500
  */
 #define TIFF_VERSION    42
+#define TIFF_BIGTIFF_VERSION    43  /* 64-bit offsets, see below */
 
 #define TIFF_BIGENDIAN      0x4d4d
 #define TIFF_LITTLEENDIAN   0x4949
@@ -48,6 +49,21 @@ typedef struct {
     unsigned long  tiff_diroff; /* byte offset to first directory */
 } TIFFHeader;
 
+/*
+ * A BigTIFF file has a header of 16 bytes: the magic
+ * number, version 43, the byte size of offsets (8), a
+ * zero short and an 8-byte offset to the first directory.
+ * Its directories have an 8-byte entry count, entries of
+ * 20 bytes with an 8-byte count and an 8-byte offset,
+ * and an 8-byte link to the next directory.  Values of
+ * 8 bytes or less are kept in the offset field.  These
+ * are the external sizes of the two forms.
+ */
+#define TIFF_HEADERSIZE     8
+#define TIFF_DIRENTRYSIZE   12
+#define TIFF_BIGHEADERSIZE  16
+#define TIFF_BIGDIRENTRYSIZE    20
+
 /*
  * TIFF Image File Directories are comprised of
  * a table of field descriptors of the form shown
@@ -93,7 +109,8 @@ typedef enum {
     TIFF_SLONG  = 9,    /* !32-bit signed integer */
     TIFF_SRATIONAL  = 10,   /* !64-bit signed fraction */
     TIFF_FLOAT  = 11,   /* !32-bit IEEE floating point */
-    TIFF_DOUBLE = 12    /* !64-bit IEEE floating point */
+    TIFF_DOUBLE = 12,   /* !64-bit IEEE floating point */
+    TIFF_LONG8  = 16    /* BigTIFF 64-bit unsigned integer */
 } TIFFDataType;
 
 /*
@@ -198,6 +215,8 @@ typedef enum {
 #define TIFFTAG_ARTIST          315 /* creator of image */
 #define TIFFTAG_HOSTCOMPUTER        316 /* machine where created */
 #define TIFFTAG_PREDICTOR       317 /* prediction scheme w/ LZW */
+#define     PREDICTOR_NONE      1   /* no prediction scheme used */
+#define     PREDICTOR_HORIZONTAL    2   /* horizontal differencing */
 #define TIFFTAG_WHITEPOINT      318 /* image white point */
 #define TIFFTAG_PRIMARYCHROMATICITIES   319 /* !primary chromaticities */
 #define TIFFTAG_COLORMAP        320 /* RGB map for pallette image */
@@ -129,15 +129,15 @@ typedef unsigned long u_long;
  */
 #ifndef ReadOK
 #define ReadOK(tif, buf, size) \
-    (TIFFReadFile(tif, (char *)buf, size) == size)
+    ((u_long)TIFFReadFile(tif, (char *)buf, size) == (u_long)(size))
 #endif
 #ifndef SeekOK
 #define SeekOK(tif, off) \
-    (TIFFSeekFile(tif, (long)off, L_SET) == (long)off)
+    (TIFFSeekFile(tif, (long)(off), L_SET) == (long)(off))
 #endif
 #ifndef WriteOK
 #define WriteOK(tif, buf, size) \
-    (TIFFWriteFile(tif, (char *)buf, size) == size)
+    ((u_long)TIFFWriteFile(tif, (char *)buf, size) == (u_long)(size))
 #endif
 
 /*
@@ -108,8 +108,8 @@
  *    JPEG_SUPPORT  enable support for JPEG DCT algorithm
  */
 /*#define   CCITT_SUPPORT*/
-/*#define   PACKBITS_SUPPORT*/
-/*#define       LZW_SUPPORT*/
+#define PACKBITS_SUPPORT
+#define LZW_SUPPORT
 /*#define THUNDER_SUPPORT*/
 /*#define NEXT_SUPPORT */
 #endif
@@ -155,6 +155,7 @@ extern  int TIFFReadEncodedTile(TIFF*, unsigned, unsigned char*, unsigned long);
 extern  int TIFFReadRawTile(TIFF*, unsigned, unsigned char*, unsigned long);
 extern  int TIFFWriteEncodedStrip(TIFF*, unsigned, unsigned char*, unsigned long);
 extern  int TIFFWriteRawStrip(TIFF*, unsigned, unsigned char*, unsigned long);
+extern  unsigned long TIFFReserveStrips(TIFF*, int);
 extern  int TIFFWriteEncodedTile(TIFF*, unsigned, unsigned char*, unsigned long);
 extern  int TIFFWriteRawTile(TIFF*, unsigned, unsigned char*, unsigned long);
 extern  void TIFFSwabShort(unsigned short *);
@@ -228,6 +229,7 @@ extern  int TIFFWriteDirectory();
 extern  int TIFFWriteScanline();
 extern  int TIFFWriteEncodedStrip();
 extern  int TIFFWriteRawStrip();
+extern  unsigned long TIFFReserveStrips();
 extern  int TIFFWriteEncodedTile();
 extern  int TIFFWriteRawTile();
 extern  void TIFFSwabShort();
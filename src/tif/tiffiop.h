@@ -251,6 +251,7 @@ struct tiff {
 #define TIFF_ISTILED        0x80    /* file is tile, not strip- based */
 #define TIFF_MAPPED     0x100   /* file is mapped into memory */
 #define TIFF_POSTENCODE     0x200   /* need call to postencode routine */
+#define TIFF_BIGTIFF        0x400   /* file is BigTIFF, 64-bit offsets */
     long    tif_diroff;     /* file offset of current directory */
     long    tif_nextdiroff;     /* file offset of following directory */
     TIFFDirectory tif_dir;      /* internal rep of current directory */
@@ -303,6 +304,7 @@ struct tiff {
 
 #define isTiled(tif)    (((tif)->tif_flags & TIFF_ISTILED) != 0)
 #define isMapped(tif)   (((tif)->tif_flags & TIFF_MAPPED) != 0)
+#define isBigTIFF(tif)  (((tif)->tif_flags & TIFF_BIGTIFF) != 0)
 #define TIFFReadFile(tif, buf, size) \
     ((*(tif)->tif_readproc)((tif)->tif_clientdata, buf, size))
 #define TIFFWriteFile(tif, buf, size) \
@@ -359,10 +361,20 @@ extern  int TIFFFlushData1(TIFF*);
 extern  void TIFFFreeDirectory(TIFF*);
 extern  int TIFFDefaultDirectory(TIFF*);
 extern  int TIFFSetCompressionScheme(TIFF *, int);
+extern  int _TIFFWriteHeader(TIFF*);
 
 extern  int TIFFInitDumpMode(TIFF*);
+/*
+ * Bounds of the encoded size of cc bytes: a PackBits
+ * row, and an LZW strip where every code stands for at
+ * least one byte, takes at most 12 bits and a clear
+ * code comes after every 3836 codes.
+ */
+#define TIFFPackBitsBound(cc)   ((cc) + ((cc) + 127) / 128)
+#define TIFFLZWBound(cc)        ((cc) + ((cc) >> 1) + ((cc) >> 10) + 8)
 #ifdef PACKBITS_SUPPORT
 extern  int TIFFInitPackBits(TIFF*);
+extern  u_long TIFFPackBitsEncode(u_char*, u_char*, u_long, u_long);
 #endif
 #ifdef CCITT_SUPPORT
 extern  int TIFFInitCCITTRLE(TIFF*), TIFFInitCCITTRLEW(TIFF*);
@@ -376,6 +388,7 @@ extern  int TIFFInitNeXT(TIFF*);
 #endif
 #ifdef LZW_SUPPORT
 extern  int TIFFInitLZW(TIFF*);
+extern  u_long TIFFLZWEncode(u_char*, u_char*, u_long, u_long, int);
 #endif
 #ifdef JPEG_SUPPORT
 extern  int TIFFInitJPEG(TIFF*);
@@ -401,10 +414,12 @@ extern  int TIFFFlushData1();
 extern  void TIFFFreeDirectory();
 extern  int TIFFDefaultDirectory();
 extern  int TIFFSetCompressionScheme();
+extern  int _TIFFWriteHeader();
 
 extern  int TIFFInitDumpMode();
 #ifdef PACKBITS_SUPPORT
 extern  int TIFFInitPackBits();
+extern  u_long TIFFPackBitsEncode();
 #endif
 #ifdef CCITT_SUPPORT
 extern  int TIFFInitCCITTRLE(), TIFFInitCCITTRLEW();
@@ -418,6 +433,7 @@ extern  int TIFFInitNeXT();
 #endif
 #ifdef LZW_SUPPORT
 extern  int TIFFInitLZW();
+extern  u_long TIFFLZWEncode();
 #endif
 #ifdef JPEG_SUPPORT
 extern  int TIFFInitJPEG();